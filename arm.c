@@ -1,125 +1,150 @@
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "arm.h"
+#include "arm_jit.h"
 #include "arm_mem.h"
 
+#include "bios.h"
 #include "io.h"
-#include "timer.h"
 
 /*
  * Utils
  */
 
-static void arm_flag_set(uint32_t flag, bool cond) {
-    if (cond)
-        arm_r.cpsr |= flag;
-    else
-        arm_r.cpsr &= ~flag;
-}
+//Inlined even when big, the callers pass constants that fold most of it away
+#ifdef __GNUC__
+#define ARM_INLINE  static inline __attribute__((always_inline))
+#else
+#define ARM_INLINE  static inline
+#endif
+
+/*
+ * Lazy flags
+ *
+ * Flag setting instructions only record what they did, NZCV are computed
+ * and written to the CPSR when something actually reads them.
+ */
+
+#define ARM_NZCV  (ARM_N | ARM_Z | ARM_C | ARM_V)
 
-static void arm_bank_to_regs(int8_t mode) {
-    if (mode != ARM_FIQ) {
-        arm_r.r[8]  = arm_r.r8_usr;
-        arm_r.r[9]  = arm_r.r9_usr;
-        arm_r.r[10] = arm_r.r10_usr;
-        arm_r.r[11] = arm_r.r11_usr;
-        arm_r.r[12] = arm_r.r12_usr;
+typedef enum {
+    ARM_FLAGS_NONE,  //CPSR is up to date
+    ARM_FLAGS_NZ,    //N and Z from the result
+    ARM_FLAGS_NZ64,  //N and Z from the 64-bits result
+    ARM_FLAGS_LOGIC, //N and Z from the result, C from the shifter
+    ARM_FLAGS_ADD,   //NZCV from an addition
+    ARM_FLAGS_SUB    //NZCV from a subtraction
+} arm_flags_e;
+
+static const uint32_t arm_flags_mask[] = {
+    0,
+    ARM_N | ARM_Z,
+    ARM_N | ARM_Z,
+    ARM_N | ARM_Z | ARM_C,
+    ARM_NZCV,
+    ARM_NZCV
+};
+
+static arm_flags_e arm_flags_op;
+static uint32_t    arm_flags_lhs;
+static uint32_t    arm_flags_rhs;
+static uint64_t    arm_flags_res;
+
+void arm_flags_sync() {
+    uint32_t res   = arm_flags_res;
+    uint32_t lhs   = arm_flags_lhs;
+    uint32_t rhs   = arm_flags_rhs;
+    uint32_t flags = 0;
+
+    if (arm_flags_op == ARM_FLAGS_NONE) return;
+
+    if (arm_flags_op == ARM_FLAGS_NZ64) {
+        if (arm_flags_res & (1ULL << 63)) flags |= ARM_N;
+        if (arm_flags_res == 0)           flags |= ARM_Z;
+    } else {
+        if (res & (1 << 31)) flags |= ARM_N;
+        if (res == 0)        flags |= ARM_Z;
     }
 
-    switch (mode) {
-        case ARM_USR:
-        case ARM_SYS:
-            arm_r.r[13] = arm_r.r13_usr;
-            arm_r.r[14] = arm_r.r14_usr;
+    switch (arm_flags_op) {
+        case ARM_FLAGS_LOGIC:
+            if (lhs) flags |= ARM_C;
         break;
 
-        case ARM_FIQ:
-            arm_r.r[8]  = arm_r.r8_fiq;
-            arm_r.r[9]  = arm_r.r9_fiq;
-            arm_r.r[10] = arm_r.r10_fiq;
-            arm_r.r[11] = arm_r.r11_fiq;
-            arm_r.r[12] = arm_r.r12_fiq;
-            arm_r.r[13] = arm_r.r13_fiq;
-            arm_r.r[14] = arm_r.r14_fiq;
+        case ARM_FLAGS_ADD:
+            if (arm_flags_res > 0xffffffff)               flags |= ARM_C;
+            if (~(lhs ^ rhs) & (lhs ^ res) & 0x80000000) flags |= ARM_V;
         break;
 
-        case ARM_IRQ:
-            arm_r.r[13] = arm_r.r13_irq;
-            arm_r.r[14] = arm_r.r14_irq;
+        case ARM_FLAGS_SUB:
+            if (arm_flags_res < 0x100000000ULL)          flags |= ARM_C;
+            if ((lhs ^ rhs) & (lhs ^ res) & 0x80000000)  flags |= ARM_V;
         break;
 
-        case ARM_SVC:
-            arm_r.r[13] = arm_r.r13_svc;
-            arm_r.r[14] = arm_r.r14_svc;
-        break;
+        default: break;
+    }
 
-        case ARM_MON:
-            arm_r.r[13] = arm_r.r13_mon;
-            arm_r.r[14] = arm_r.r14_mon;
-        break;
+    arm_r.cpsr &= ~arm_flags_mask[arm_flags_op];
+    arm_r.cpsr |= flags;
 
-        case ARM_ABT:
-            arm_r.r[13] = arm_r.r13_abt;
-            arm_r.r[14] = arm_r.r14_abt;
-        break;
+    arm_flags_op = ARM_FLAGS_NONE;
+}
 
-        case ARM_UND:
-            arm_r.r[13] = arm_r.r13_und;
-            arm_r.r[14] = arm_r.r14_und;
-        break;
-    }
+static void arm_flags_defer(arm_flags_e type, uint32_t lhs, uint32_t rhs, uint64_t res) {
+    //Flags left pending by the previous op that this one doesn't overwrite
+    if (arm_flags_mask[arm_flags_op] & ~arm_flags_mask[type]) arm_flags_sync();
+
+    arm_flags_op  = type;
+    arm_flags_lhs = lhs;
+    arm_flags_rhs = rhs;
+    arm_flags_res = res;
 }
 
-static void arm_regs_to_bank(int8_t mode) {
-    if (mode != ARM_FIQ) {
-        arm_r.r8_usr  = arm_r.r[8];
-        arm_r.r9_usr  = arm_r.r[9];
-        arm_r.r10_usr = arm_r.r[10];
-        arm_r.r11_usr = arm_r.r[11];
-        arm_r.r12_usr = arm_r.r[12];
-    }
+static void arm_flag_set(uint32_t flag, bool cond) {
+    if ((flag & ARM_NZCV) && arm_flags_op) arm_flags_sync();
 
-    switch (mode) {
-        case ARM_USR:
-        case ARM_SYS:
-            arm_r.r13_usr = arm_r.r[13];
-            arm_r.r14_usr = arm_r.r[14];
-        break;
+    if (cond)
+        arm_r.cpsr |= flag;
+    else
+        arm_r.cpsr &= ~flag;
+}
 
-        case ARM_FIQ:
-            arm_r.r8_fiq  = arm_r.r[8];
-            arm_r.r9_fiq  = arm_r.r[9];
-            arm_r.r10_fiq = arm_r.r[10];
-            arm_r.r11_fiq = arm_r.r[11];
-            arm_r.r12_fiq = arm_r.r[12];
-            arm_r.r13_fiq = arm_r.r[13];
-            arm_r.r14_fiq = arm_r.r[14];
-        break;
+//Register bank of each mode, ARM_BANK_NONE for the invalid ones
+static const uint8_t arm_bank_lut[32] = {
+    [ARM_USR] = ARM_BANK_USR,
+    [ARM_FIQ] = ARM_BANK_FIQ,
+    [ARM_IRQ] = ARM_BANK_IRQ,
+    [ARM_SVC] = ARM_BANK_SVC,
+    [ARM_MON] = ARM_BANK_MON,
+    [ARM_ABT] = ARM_BANK_ABT,
+    [ARM_UND] = ARM_BANK_UND,
+    [ARM_SYS] = ARM_BANK_USR
+};
 
-        case ARM_IRQ:
-            arm_r.r13_irq = arm_r.r[13];
-            arm_r.r14_irq = arm_r.r[14];
-        break;
+static void arm_bank_swap(int8_t curr, int8_t mode) {
+    uint8_t from = arm_bank_lut[curr & 0x1f];
+    uint8_t to   = arm_bank_lut[mode & 0x1f];
 
-        case ARM_SVC:
-            arm_r.r13_svc = arm_r.r[13];
-            arm_r.r14_svc = arm_r.r[14];
-        break;
+    if (from == to) return;
 
-        case ARM_MON:
-            arm_r.r13_mon = arm_r.r[13];
-            arm_r.r14_mon = arm_r.r[14];
-        break;
+    //R8-R12 are only banked on FIQ mode
+    bool from_fiq = from == ARM_BANK_FIQ;
+    bool to_fiq   = to   == ARM_BANK_FIQ;
 
-        case ARM_ABT:
-            arm_r.r13_abt = arm_r.r[13];
-            arm_r.r14_abt = arm_r.r[14];
-        break;
+    if (from_fiq != to_fiq) {
+        memcpy(arm_bank.r8_r12[from_fiq], arm_r.r + 8, sizeof(arm_bank.r8_r12[0]));
+        memcpy(arm_r.r + 8, arm_bank.r8_r12[to_fiq], sizeof(arm_bank.r8_r12[0]));
+    }
 
-        case ARM_UND:
-            arm_r.r13_und = arm_r.r[13];
-            arm_r.r14_und = arm_r.r[14];
-        break;
+    arm_bank.r13[from] = arm_r.r[13];
+    arm_bank.r14[from] = arm_r.r[14];
+
+    //Invalid modes keep the registers of the previous one
+    if (to != ARM_BANK_NONE) {
+        arm_r.r[13] = arm_bank.r13[to];
+        arm_r.r[14] = arm_bank.r14[to];
     }
 }
 
@@ -129,11 +154,12 @@ static void arm_mode_set(int8_t mode) {
     arm_r.cpsr &= ~0x1f;
     arm_r.cpsr |= mode;
 
-    arm_regs_to_bank(curr);
-    arm_bank_to_regs(mode);
+    arm_bank_swap(curr, mode);
 }
 
 static bool arm_flag_tst(uint32_t flag) {
+    if ((flag & ARM_NZCV) && arm_flags_op) arm_flags_sync();
+
     return arm_r.cpsr & flag;
 }
 
@@ -161,69 +187,29 @@ static bool arm_cond(int8_t cond) {
     return res;
 }
 
+//User and System modes have no SPSR
 static void arm_spsr_get(uint32_t *psr) {
-    switch (arm_r.cpsr & 0x1f) {
-        case ARM_FIQ: *psr = arm_r.spsr_fiq; break;
-        case ARM_IRQ: *psr = arm_r.spsr_irq; break;
-        case ARM_SVC: *psr = arm_r.spsr_svc; break;
-        case ARM_MON: *psr = arm_r.spsr_mon; break;
-        case ARM_ABT: *psr = arm_r.spsr_abt; break;
-        case ARM_UND: *psr = arm_r.spsr_und; break;
-    }
+    uint8_t bank = arm_bank_lut[arm_r.cpsr & 0x1f];
+
+    if (bank >= ARM_BANK_FIQ) *psr = arm_bank.spsr[bank];
 }
 
 static void arm_spsr_set(uint32_t spsr) {
-    switch (arm_r.cpsr & 0x1f) {
-        case ARM_FIQ: arm_r.spsr_fiq = spsr; break;
-        case ARM_IRQ: arm_r.spsr_irq = spsr; break;
-        case ARM_SVC: arm_r.spsr_svc = spsr; break;
-        case ARM_MON: arm_r.spsr_mon = spsr; break;
-        case ARM_ABT: arm_r.spsr_abt = spsr; break;
-        case ARM_UND: arm_r.spsr_und = spsr; break;
-    }
+    uint8_t bank = arm_bank_lut[arm_r.cpsr & 0x1f];
+
+    if (bank >= ARM_BANK_FIQ) arm_bank.spsr[bank] = spsr;
 }
 
 static void arm_spsr_to_cpsr() {
     int8_t curr = arm_r.cpsr & 0x1f;
 
+    arm_flags_sync();
+
     arm_spsr_get(&arm_r.cpsr);
 
     int8_t mode = arm_r.cpsr & 0x1f;
 
-    arm_regs_to_bank(curr);
-    arm_bank_to_regs(mode);
-}
-
-static void arm_setn(uint32_t res) {
-    arm_flag_set(ARM_N, res & (1 << 31));
-}
-
-static void arm_setn64(uint64_t res) {
-    arm_flag_set(ARM_N, res & (1ULL << 63));
-}
-
-static void arm_setz(uint32_t res) {
-    arm_flag_set(ARM_Z, res == 0);
-}
-
-static void arm_setz64(uint64_t res) {
-    arm_flag_set(ARM_Z, res == 0);
-}
-
-static void arm_addc(uint64_t res) {
-    arm_flag_set(ARM_C, res > 0xffffffff);
-}
-
-static void arm_subc(uint64_t res) {
-    arm_flag_set(ARM_C, res < 0x100000000ULL);
-}
-
-static void arm_addv(uint32_t lhs, uint32_t rhs, uint32_t res) {
-    arm_flag_set(ARM_V, ~(lhs ^ rhs) & (lhs ^ res) & 0x80000000);
-}
-
-static void arm_subv(uint32_t lhs, uint32_t rhs, uint32_t res) {
-    arm_flag_set(ARM_V, (lhs ^ rhs) & (lhs ^ res) & 0x80000000);
+    arm_bank_swap(curr, mode);
 }
 
 static uint32_t arm_saturate(int64_t val, int32_t min, int32_t max, bool q) {
@@ -249,90 +235,115 @@ static bool arm_in_thumb() {
     return arm_flag_tst(ARM_T);
 }
 
-static uint16_t arm_fetchh(access_type_e at) {
-    switch (arm_r.r[15] >> 24) {
-        case 0x0: arm_cycles += 1; return (bios_op = *(uint16_t *)(bios + (arm_r.r[15] & 0x3fff)));
-        case 0x2: arm_cycles += 3; return *(uint16_t *)(wram  + (arm_r.r[15] & 0x3ffff));
-        case 0x3: arm_cycles += 1; return *(uint16_t *)(iwram + (arm_r.r[15] & 0x7fff));
-        case 0x5: arm_cycles += 1; return *(uint16_t *)(pram  + (arm_r.r[15] & 0x3ff));
-        case 0x7: arm_cycles += 1; return *(uint16_t *)(oam   + (arm_r.r[15] & 0x3ff));
+/*
+ * Instruction fetch
+ *
+ * The PC stays on the same region for long stretches, so the memory it
+ * fetches from and the cost of each access are looked up once and kept
+ * on a context. It is rebuilt when the PC moves to another region, or
+ * when WAITCNT changes the ROM wait states.
+ */
 
-        case 0x8:
-        case 0x9:
-            if (at == NON_SEQ)
-                arm_cycles += ws_n_t16[0];
-            else
-                arm_cycles += ws_s_t16[0];
+typedef struct {
+    uint32_t region; //PC >> 24 the context is for
+    uint8_t *base;   //NULL when fetches go through the bus
+    uint32_t mask;
+    bool     bios;
+    uint8_t  n_t16;
+    uint8_t  s_t16;
+    uint8_t  n_arm;
+    uint8_t  s_arm;
+} arm_fetch_ctx_t;
 
-            return *(uint16_t *)(rom + (arm_r.r[15] & 0x1ffffff));
+#define ARM_FETCH_NONE  0xffffffff
 
-        case 0xa:
-        case 0xb:
-            if (at == NON_SEQ)
-                arm_cycles += ws_n_t16[1];
-            else
-                arm_cycles += ws_s_t16[1];
+static arm_fetch_ctx_t arm_fetch_ctx = { .region = ARM_FETCH_NONE };
 
-            return *(uint16_t *)(rom + (arm_r.r[15] & 0x1ffffff));
+void arm_fetch_inval() {
+    arm_fetch_ctx.region = ARM_FETCH_NONE;
+}
 
-        case 0xc:
-        case 0xd:
-            if (at == NON_SEQ)
-                arm_cycles += ws_n_t16[2];
-            else
-                arm_cycles += ws_s_t16[2];
+static void arm_fetch_ctx_set(uint32_t region) {
+    arm_fetch_ctx_t *ctx = &arm_fetch_ctx;
 
-            return *(uint16_t *)(rom + (arm_r.r[15] & 0x1ffffff));
+    ctx->region = region;
+    ctx->base   = NULL;
+    ctx->bios   = false;
 
-        default:
-            if (at == NON_SEQ)
-                return arm_readh_n(arm_r.r[15]);
-            else
-                return arm_readh_s(arm_r.r[15]);
+    //Fixed cost regions
+    ctx->n_t16 = ctx->s_t16 = 1;
+    ctx->n_arm = ctx->s_arm = 1;
+
+    switch (region) {
+        case 0x0: ctx->base = bios;  ctx->mask = 0x3fff; ctx->bios = true; break;
+        case 0x3: ctx->base = iwram; ctx->mask = 0x7fff;  break;
+        case 0x5: ctx->base = pram;  ctx->mask = 0x3ff;   break;
+        case 0x7: ctx->base = oam;   ctx->mask = 0x3ff;   break;
+
+        case 0x2:
+            ctx->base  = wram;
+            ctx->mask  = 0x3ffff;
+            ctx->n_t16 = ctx->s_t16 = ws_wram_fetch[0];
+            ctx->n_arm = ctx->s_arm = ws_wram_fetch[1];
+        break;
+
+        case 0x8: case 0x9:
+        case 0xa: case 0xb:
+        case 0xc: case 0xd: {
+            uint8_t idx = (region >> 1) & 3;
+
+            ctx->base  = rom;
+            ctx->mask  = 0x1ffffff;
+            ctx->n_t16 = ws_n_t16[idx];
+            ctx->s_t16 = ws_s_t16[idx];
+            ctx->n_arm = ws_n_arm[idx];
+            ctx->s_arm = ws_s_arm[idx];
+        }
+        break;
     }
+
 }
 
-static uint32_t arm_fetch(access_type_e at) {
-    switch (arm_r.r[15] >> 24) {
-        case 0x0: arm_cycles += 1; return (bios_op = *(uint32_t *)(bios + (arm_r.r[15] & 0x3fff)));
-        case 0x2: arm_cycles += 6; return *(uint32_t *)(wram  + (arm_r.r[15] & 0x3ffff));
-        case 0x3: arm_cycles += 1; return *(uint32_t *)(iwram + (arm_r.r[15] & 0x7fff));
-        case 0x5: arm_cycles += 1; return *(uint32_t *)(pram  + (arm_r.r[15] & 0x3ff));
-        case 0x7: arm_cycles += 1; return *(uint32_t *)(oam   + (arm_r.r[15] & 0x3ff));
+static uint16_t arm_fetchh(access_type_e at) {
+    arm_fetch_ctx_t *ctx = &arm_fetch_ctx;
 
-        case 0x8:
-        case 0x9:
-            if (at == NON_SEQ)
-                arm_cycles += ws_n_arm[0];
-            else
-                arm_cycles += ws_s_arm[0];
+    if ((arm_r.r[15] >> 24) != ctx->region) arm_fetch_ctx_set(arm_r.r[15] >> 24);
+
+    if (ctx->base == NULL) {
+        if (at == NON_SEQ)
+            return arm_readh_n(arm_r.r[15]);
+        else
+            return arm_readh_s(arm_r.r[15]);
+    }
 
-            return *(uint32_t *)(rom + (arm_r.r[15] & 0x1ffffff));
+    arm_r.cycles += at == NON_SEQ ? ctx->n_t16 : ctx->s_t16;
 
-        case 0xa:
-        case 0xb:
-            if (at == NON_SEQ)
-                arm_cycles += ws_n_arm[1];
-            else
-                arm_cycles += ws_s_arm[1];
+    uint16_t op = *(uint16_t *)(ctx->base + (arm_r.r[15] & ctx->mask));
 
-            return *(uint32_t *)(rom + (arm_r.r[15] & 0x1ffffff));
+    if (ctx->bios) bios_op = op;
 
-        case 0xc:
-        case 0xd:
-            if (at == NON_SEQ)
-                arm_cycles += ws_n_arm[2];
-            else
-                arm_cycles += ws_s_arm[2];
+    return op;
+}
+
+static uint32_t arm_fetch(access_type_e at) {
+    arm_fetch_ctx_t *ctx = &arm_fetch_ctx;
 
-            return *(uint32_t *)(rom + (arm_r.r[15] & 0x1ffffff));
+    if ((arm_r.r[15] >> 24) != ctx->region) arm_fetch_ctx_set(arm_r.r[15] >> 24);
 
-        default:
-            if (at == NON_SEQ)
-                return arm_read_n(arm_r.r[15]);
-            else
-                return arm_read_s(arm_r.r[15]);
+    if (ctx->base == NULL) {
+        if (at == NON_SEQ)
+            return arm_read_n(arm_r.r[15]);
+        else
+            return arm_read_s(arm_r.r[15]);
     }
+
+    arm_r.cycles += at == NON_SEQ ? ctx->n_arm : ctx->s_arm;
+
+    uint32_t op = *(uint32_t *)(ctx->base + (arm_r.r[15] & ctx->mask));
+
+    if (ctx->bios) bios_op = op;
+
+    return op;
 }
 
 static uint32_t arm_fetch_n() {
@@ -367,11 +378,39 @@ static uint32_t arm_fetch_s() {
     return op;
 }
 
+/*
+ * ROM can't be written, so while the ROM loop runs the prefetched opcodes
+ * are always the ones behind R15, and only the opcode that runs is read.
+ * The pipeline is filled in when something looks at it: open bus reads,
+ * a fused pair moving on to its second opcode, or the loop exiting.
+ */
+static bool arm_pipe_lazy;
+
+//Fills the pipeline with the ROM opcodes before pc and at pc
+static void arm_pipe_fill(uint32_t pc) {
+    if (arm_in_thumb()) {
+        arm_r.pipe[0] = *(uint16_t *)(rom + ((pc - 2) & 0x1ffffff));
+        arm_r.pipe[1] = *(uint16_t *)(rom + ((pc    ) & 0x1ffffff));
+    } else {
+        arm_r.pipe[0] = *(uint32_t *)(rom + ((pc - 4) & 0x1ffffff));
+        arm_r.pipe[1] = *(uint32_t *)(rom + ((pc    ) & 0x1ffffff));
+    }
+
+    arm_pipe_lazy = false;
+}
+
+//Called while an opcode runs, R15 is where the next prefetch came from
+void arm_pipe_sync() {
+    if (arm_pipe_lazy) arm_pipe_fill(arm_r.r[15]);
+}
+
 static void arm_load_pipe() {
-    arm_pipe[0] = arm_fetch_n();
-    arm_pipe[1] = arm_fetch_s();
+    arm_r.pipe[0] = arm_fetch_n();
+    arm_r.pipe[1] = arm_fetch_s();
+
+    arm_r.pipe_reload = true;
 
-    pipe_reload = true;
+    arm_pipe_lazy = false;
 }
 
 static void arm_r15_align() {
@@ -388,2836 +427,4075 @@ static void arm_interwork() {
     arm_load_pipe();
 }
 
+//Runs the current opcode again after it returns, for calls that wait
+void arm_op_repeat() {
+    arm_r.r[15] -= arm_in_thumb() ? 4 : 8;
+
+    arm_load_pipe();
+}
+
 static void arm_cycles_s_to_n() {
+    if (arm_fast_enb) return;
+
     if (arm_r.r[15] & 0x08000000) {
         uint8_t idx = (arm_r.r[15] >> 25) & 3;
 
         if (arm_in_thumb()) {
-            arm_cycles -= ws_s_t16[idx];
-            arm_cycles += ws_n_t16[idx];
+            arm_r.cycles -= ws_s_t16[idx];
+            arm_r.cycles += ws_n_t16[idx];
         } else {
-            arm_cycles -= ws_s_arm[idx];
-            arm_cycles += ws_n_arm[idx];
+            arm_r.cycles -= ws_s_arm[idx];
+            arm_r.cycles += ws_n_arm[idx];
         }
     }
 }
 
 /*
- * Execute
+ * Copy loops
+ *
+ * Short loops that only move words or halfwords from one pointer to
+ * another (or store the same registers over and over), count down with
+ * SUBS and branch back with BNE or BGT are recognized on their backward
+ * branch. Once an iteration ran on the interpreter, giving its cost in
+ * cycles, all but the last of the remaining iterations are done with a
+ * host memcpy, up to the next event. Registers, flags, memory and cycles
+ * end up the same as running them one by one. Anything touching memory
+ * with side effects (IO, palette, save memory) is left to the interpreter.
  */
 
-//Data Processing (Arithmetic)
-typedef struct {
-    uint64_t lhs;
-    uint64_t rhs;
-    uint8_t  rd;
-    bool     cout;
-    bool     s;
-} arm_data_t;
-
-#define ARM_ARITH_SUB  0
-#define ARM_ARITH_ADD  1
-
-#define ARM_ARITH_NO_C   0
-#define ARM_ARITH_CARRY  1
+#define ARM_COPY_CACHE  64
+#define ARM_COPY_OPS    8    //Opcodes before the branch
+#define ARM_COPY_SIZE   64   //Max. bytes per iteration
+#define ARM_COPY_NONE   0xff
 
-#define ARM_ARITH_NO_REV   0
-#define ARM_ARITH_REVERSE  1
+#define ARM_COND_NE  0b0001
+#define ARM_COND_GT  0b1100
+#define ARM_COND_AL  0b1110
 
-static void arm_arith_set(arm_data_t op, uint64_t res, bool add) {
-    if (op.rd == 15) {
-        if (op.s) {
-            arm_spsr_to_cpsr();
-            arm_r15_align();
-            arm_load_pipe();
-            arm_check_irq();
-        } else {
-            arm_r15_align();
-            arm_load_pipe();
-        }
-    } else if (op.s) {
-        arm_setn(res);
-        arm_setz(res);
+typedef struct {
+    uint8_t reg;
+    uint8_t offs;
+    uint8_t unit;
+} arm_copy_elem_t;
 
-        if (add) {
-            arm_addc(res);
-            arm_addv(op.lhs, op.rhs, res);
-        } else {
-            arm_subc(res);
-            arm_subv(op.lhs, op.rhs, res);
-        }
-    }
-}
+typedef struct {
+    uint32_t pc;     //Loop start, bit 0 set on Thumb
+    uint32_t body[ARM_COPY_OPS + 1];
+    uint8_t  count;  //Opcodes before the branch, 0 if not a copy loop
+    uint8_t  src;    //Base register of the loads, ARM_COPY_NONE on fills
+    uint8_t  dst;
+    uint8_t  cnt;
+    uint8_t  cond;
+    uint8_t  align;
+    uint32_t step;   //Counter decrement
+    uint32_t size;   //Bytes moved per iteration
+
+    //Registers holding a loaded value at the end of the iteration
+    arm_copy_elem_t loads[ARM_COPY_SIZE / 2];
+    uint8_t         loads_cnt;
+
+    //Invariant registers stored on fills
+    arm_copy_elem_t fills[ARM_COPY_SIZE / 2];
+    uint8_t         fills_cnt;
+} arm_copy_t;
+
+static arm_copy_t arm_copy_cache[ARM_COPY_CACHE];
+
+//Loop state when its branch was last taken, to time one iteration
+static struct {
+    uint32_t pc;
+    uint32_t cycles;
+    uint32_t cnt;
+    uint32_t src;
+    uint32_t dst;
+    bool     valid;
+} arm_copy_last;
+
+static uint64_t arm_copy_runs;
+static uint64_t arm_copy_bytes;
+
+//Symbolic run of one iteration, each register holds an offset into it
+#define ARM_COPY_INV  -1 //Value from before the loop
+#define ARM_COPY_BAD  -2 //Anything else
 
-static void arm_arith_add(arm_data_t op, bool adc) {
-    uint64_t res  = op.lhs + op.rhs;
-    if (adc) res += arm_flag_tst(ARM_C);
+typedef struct {
+    arm_copy_t *loop;
+    int32_t  val[16];
+    int32_t  offs[16];
+    uint64_t written;
+    bool     ok;
+} arm_copy_sim_t;
 
-    arm_r.r[op.rd] = res;
+static void arm_copy_elem(arm_copy_sim_t *sim, bool load, uint8_t unit, uint8_t base, uint8_t reg) {
+    arm_copy_t *loop = sim->loop;
 
-    arm_arith_set(op, res, ARM_ARITH_ADD);
-}
+    int32_t offs = sim->offs[base];
 
-static void arm_arith_subtract(arm_data_t op, bool sbc, bool rev) {
-    if (rev) {
-        uint64_t tmp = op.lhs;
+    if (offs < 0 || offs + unit > ARM_COPY_SIZE || (offs & (unit - 1))) {
+        sim->ok = false;
 
-        op.lhs = op.rhs;
-        op.rhs = tmp;
+        return;
     }
 
-    uint64_t res  = op.lhs - op.rhs;
-    if (sbc) res -= !arm_flag_tst(ARM_C);
+    if (loop->align < unit - 1) loop->align = unit - 1;
 
-    arm_r.r[op.rd] = res;
+    uint8_t *base_reg = load ? &loop->src : &loop->dst;
 
-    arm_arith_set(op, res, ARM_ARITH_SUB);
-}
+    if (*base_reg == ARM_COPY_NONE) *base_reg = base;
 
-static void arm_arith_rsb(arm_data_t op) {
-    arm_arith_subtract(op, ARM_ARITH_NO_C, ARM_ARITH_REVERSE);
-}
+    if (*base_reg != base) sim->ok = false;
 
-static void arm_arith_rsc(arm_data_t op) {
-    arm_arith_subtract(op, ARM_ARITH_CARRY, ARM_ARITH_REVERSE);
-}
+    if (load) {
+        uint8_t i;
 
-static void arm_arith_sbc(arm_data_t op) {
-    arm_arith_subtract(op, ARM_ARITH_CARRY, ARM_ARITH_NO_REV);
-}
+        for (i = 0; i < loop->loads_cnt; i++) {
+            if (loop->loads[i].reg == reg) break;
+        }
 
-static void arm_arith_sub(arm_data_t op) {
-    arm_arith_subtract(op, ARM_ARITH_NO_C, ARM_ARITH_NO_REV);
-}
+        loop->loads[i] = (arm_copy_elem_t){ reg, offs, unit };
 
-static void arm_arith_cmn(arm_data_t op) {
-    arm_arith_set(op, op.lhs + op.rhs, ARM_ARITH_ADD);
-}
+        if (i == loop->loads_cnt) loop->loads_cnt++;
 
-static void arm_arith_cmp(arm_data_t op) {
-    arm_arith_set(op, op.lhs - op.rhs, ARM_ARITH_SUB);
-}
+        sim->val[reg] = offs | (unit << 8);
+    } else {
+        uint64_t mask = ((1ULL << unit) - 1) << offs;
 
-//Data Processing (Logical)
-typedef enum {
-    AND,
-    BIC,
-    EOR,
-    MVN,
-    ORN,
-    ORR,
-    SHIFT
-} arm_logic_e;
+        if (sim->written & mask) {
+            sim->ok = false;
 
-static void arm_logic_set(arm_data_t op, uint32_t res) {
-    if (op.rd == 15) {
-        if (op.s) {
-            arm_spsr_to_cpsr();
-            arm_r15_align();
-            arm_load_pipe();
-            arm_check_irq();
-        } else {
-            arm_r15_align();
-            arm_load_pipe();
+            return;
         }
-    } else if (op.s) {
-        arm_setn(res);
-        arm_setz(res);
 
-        arm_flag_set(ARM_C, op.cout);
+        sim->written |= mask;
+
+        if (sim->val[reg] == ARM_COPY_INV)
+            loop->fills[loop->fills_cnt++] = (arm_copy_elem_t){ reg, offs, unit };
+        else if (sim->val[reg] != (offs | (unit << 8)))
+            sim->ok = false;
     }
 }
 
-static void arm_logic(arm_data_t op, arm_logic_e inst) {
-    uint32_t res;
+static void arm_copy_list(arm_copy_sim_t *sim, bool load, uint8_t base, uint16_t list) {
+    uint8_t i;
 
-    switch (inst) {
-        case AND: res = op.lhs &  op.rhs; break;
-        case BIC: res = op.lhs & ~op.rhs; break;
-        case EOR: res = op.lhs ^  op.rhs; break;
-        case ORN: res = op.lhs | ~op.rhs; break;
-        case ORR: res = op.lhs |  op.rhs; break;
+    if (list == 0 || (list & (1 << base)) || (list & 0x8000)) {
+        sim->ok = false;
 
-        case MVN:   res = ~op.rhs; break;
-        case SHIFT: res =  op.rhs; break;
+        return;
     }
 
-    arm_r.r[op.rd] = res;
+    for (i = 0; i < 15 && sim->ok; i++) {
+        if (list & (1 << i)) {
+            arm_copy_elem(sim, load, 4, base, i);
 
-    arm_logic_set(op, res);
+            sim->offs[base] += 4;
+        }
+    }
 }
 
-static void arm_asr(arm_data_t op) {
-    int64_t val = (int32_t)op.lhs;
-    uint8_t sh = op.rhs;
+static void arm_copy_sub(arm_copy_sim_t *sim, uint8_t rd, uint8_t rn, uint32_t imm, bool last) {
+    if (!last || rd != rn || imm == 0) sim->ok = false;
 
-    if (sh > 32) sh = 32;
+    sim->loop->cnt  = rd;
+    sim->loop->step = imm;
+}
 
-    op.rhs = val >> sh;
-    op.cout = val & (1 << (sh - 1));
+static void arm_copy_op(arm_copy_sim_t *sim, uint32_t op, bool thumb, bool last) {
+    if (thumb) {
+        uint8_t rd  = (op >> 0) & 7;
+        uint8_t rb  = (op >> 3) & 7;
+        uint8_t rd8 = (op >> 8) & 7;
 
-    arm_r.r[op.rd] = op.rhs;
+        switch (op & 0xf800) {
+            case 0xc000: arm_copy_list(sim, false, rd8, op & 0xff); return;
+            case 0xc800: arm_copy_list(sim, true,  rd8, op & 0xff); return;
+            case 0x3000: sim->offs[rd8] += op & 0xff; sim->val[rd8] = ARM_COPY_BAD; return;
+            case 0x3800: arm_copy_sub(sim, rd8, rd8, op & 0xff, last); return;
+        }
 
-    arm_logic_set(op, op.rhs);
-}
+        switch (op & 0xffc0) {
+            case 0x6000: arm_copy_elem(sim, false, 4, rb, rd); return;
+            case 0x6800: arm_copy_elem(sim, true,  4, rb, rd); return;
+            case 0x8000: arm_copy_elem(sim, false, 2, rb, rd); return;
+            case 0x8800: arm_copy_elem(sim, true,  2, rb, rd); return;
+        }
 
-static void arm_lsl(arm_data_t op) {
-    uint64_t val = op.lhs;
-    uint8_t sh = op.rhs;
+        switch (op & 0xfe00) {
+            case 0x1c00:
+                if (rd != rb) break;
 
-    bool c = arm_flag_tst(ARM_C);
+                sim->offs[rd] += (op >> 6) & 7;
+                sim->val[rd]   = ARM_COPY_BAD;
+            return;
 
-    op.rhs = val;
-    op.cout = c;
+            case 0x1e00: arm_copy_sub(sim, rd, rb, (op >> 6) & 7, last); return;
+        }
+    } else if ((op >> 28) == ARM_COND_AL) {
+        uint8_t rd = (op >> 12) & 0xf;
+        uint8_t rn = (op >> 16) & 0xf;
+
+        if (rd != 15 && rn != 15 && rd != rn) {
+            switch (op & 0x0ff00fff) {
+                case 0x04800004: arm_copy_elem(sim, false, 4, rn, rd); sim->offs[rn] += 4; return;
+                case 0x04900004: arm_copy_elem(sim, true,  4, rn, rd); sim->offs[rn] += 4; return;
+                case 0x00c000b2: arm_copy_elem(sim, false, 2, rn, rd); sim->offs[rn] += 2; return;
+                case 0x00d000b2: arm_copy_elem(sim, true,  2, rn, rd); sim->offs[rn] += 2; return;
+            }
+        }
 
-    if (sh > 32) {
-        op.rhs = 0;
-        op.cout = 0;
-    } else if (sh) {
-        op.rhs = val << sh;
-        op.cout = val & (1 << (32 - sh));
-    }
+        if (rn != 15) {
+            switch (op & 0x0ff00000) {
+                case 0x08a00000: arm_copy_list(sim, false, rn, op & 0xffff); return;
+                case 0x08b00000: arm_copy_list(sim, true,  rn, op & 0xffff); return;
+            }
+        }
 
-    arm_r.r[op.rd] = op.rhs;
+        //Immediates without rotation only
+        if (rd == rn && rd != 15 && !(op & 0xf00)) {
+            switch (op & 0x0ff00000) {
+                case 0x02800000:
+                    sim->offs[rd] += op & 0xff;
+                    sim->val[rd]   = ARM_COPY_BAD;
+                return;
 
-    arm_logic_set(op, op.rhs);
-}
-
-static void arm_lsr(arm_data_t op) {
-    uint64_t val = op.lhs;
-    uint8_t sh = op.rhs;
-
-    bool c = arm_flag_tst(ARM_C);
-
-    op.rhs = val;
-    op.cout = c;
-
-    if (sh > 32) {
-        op.rhs = 0;
-        op.cout = 0;
-    } else if (sh) {
-        op.rhs = val >> sh;
-        op.cout = val & (1 << (sh - 1));
+                case 0x02500000: arm_copy_sub(sim, rd, rn, op & 0xff, last); return;
+            }
+        }
     }
 
-    arm_r.r[op.rd] = op.rhs;
-
-    arm_logic_set(op, op.rhs);
+    sim->ok = false;
 }
 
-static void arm_ror(arm_data_t op) {
-    uint64_t val = op.lhs;
-    uint8_t sh = op.rhs;
+static bool arm_copy_decode(arm_copy_t *loop, bool thumb) {
+    arm_copy_sim_t sim = { .loop = loop, .ok = true };
 
-    bool c = arm_flag_tst(ARM_C);
+    uint8_t i;
 
-    op.rhs = val;
-    op.cout = c;
+    loop->cond  = thumb ? (arm_r.op >> 8) & 0xf : arm_r.op >> 28;
+    loop->src   = ARM_COPY_NONE;
+    loop->dst   = ARM_COPY_NONE;
+    loop->cnt   = ARM_COPY_NONE;
+    loop->align = 0;
 
-    if (sh) {
-        sh &= 0x1f;
-        if (sh == 0) sh = 32;
+    loop->loads_cnt = 0;
+    loop->fills_cnt = 0;
 
-        op.rhs = ROR(val, sh);
-        op.cout = val & (1 << (sh - 1));
-    }
+    if (loop->cond != ARM_COND_NE && loop->cond != ARM_COND_GT) return false;
 
-    arm_r.r[op.rd] = op.rhs;
+    //Thumb B has no condition
+    if (thumb && (arm_r.op & 0xf000) != 0xd000) return false;
 
-    arm_logic_set(op, op.rhs);
-}
+    for (i = 0; i < 16; i++) sim.val[i] = ARM_COPY_INV;
 
-static void arm_count_zeros(uint8_t rd) {
-    uint8_t rm = arm_op & 0xf;
-    uint32_t m = arm_r.r[rm];
-    uint32_t i, cnt = 32;
+    for (i = 0; i < loop->count && sim.ok; i++) {
+        uint32_t op = thumb ? ((uint16_t *)loop->body)[i] : loop->body[i];
 
-    for (i = 0; i < 32; i++) {
-        if (m & (1 << i)) cnt = i ^ 0x1f;
+        arm_copy_op(&sim, op, thumb, i == loop->count - 1);
     }
 
-    arm_r.r[rd] = cnt;
-}
+    if (!sim.ok || loop->dst == ARM_COPY_NONE || loop->cnt == ARM_COPY_NONE) return false;
 
-static void arm_logic_teq(arm_data_t op) {
-    arm_logic_set(op, op.lhs ^ op.rhs);
-}
+    loop->size = sim.offs[loop->dst];
 
-static void arm_logic_tst(arm_data_t op) {
-    arm_logic_set(op, op.lhs & op.rhs);
-}
+    //Every byte of the iteration written once, pointers moving past them
+    if (loop->size == 0 || sim.written != (~0ULL >> (64 - loop->size))) return false;
 
-//Data Processing Operand Decoding
-typedef struct {
-    uint32_t val;
-    bool     cout;
-} arm_shifter_t;
+    if (loop->src == ARM_COPY_NONE) {
+        if (loop->loads_cnt) return false;
+    } else {
+        if (loop->fills_cnt || sim.offs[loop->src] != loop->size) return false;
+    }
 
-#define ARM_FLAG_KEEP  0
-#define ARM_FLAG_SET   1
+    uint16_t bases = (1 << loop->dst) | (1 << loop->cnt);
+    uint16_t data  = 0;
 
-#define ARM_SHIFT_LEFT   0
-#define ARM_SHIFT_RIGHT  1
+    if (loop->dst == loop->cnt || loop->src == loop->dst || loop->src == loop->cnt) return false;
 
-static arm_data_t arm_data_imm_op() {
-    uint32_t imm   = (arm_op >>  0) & 0xff;
-    uint8_t  shift = (arm_op >>  7) & 0x1e;
-    uint8_t  rd    = (arm_op >> 12) & 0xf;
-    uint8_t  rn    = (arm_op >> 16) & 0xf;
+    if (loop->src != ARM_COPY_NONE) bases |= 1 << loop->src;
 
-    imm = ROR(imm, shift);
+    for (i = 0; i < loop->loads_cnt; i++) data |= 1 << loop->loads[i].reg;
+    for (i = 0; i < loop->fills_cnt; i++) data |= 1 << loop->fills[i].reg;
 
-    arm_data_t op = {
-        .rd   = rd,
-        .lhs  = arm_r.r[rn],
-        .rhs  = imm,
-        .cout = imm & (1 << 31),
-        .s    = SBIT(arm_op)
-    };
+    if (data & bases) return false;
 
-    return op;
+    //Only the pointers may move
+    for (i = 0; i < 16; i++) {
+        if (sim.offs[i] && !(bases & (1 << i) && i != loop->cnt)) return false;
+    }
+
+    return true;
 }
 
-static arm_shifter_t arm_data_regi(uint8_t rm, uint8_t type, uint8_t imm) {
-    arm_shifter_t out;
+//Length is from the loop start to the end of the branch
+static arm_copy_t *arm_copy_get(uint32_t pc, uint32_t len, bool thumb) {
+    arm_copy_t *loop = &arm_copy_cache[(pc >> 1) & (ARM_COPY_CACHE - 1)];
 
-    out.val = arm_r.r[rm];
-    out.cout = arm_flag_tst(ARM_C);
+    uint32_t key  = pc | thumb;
+    uint32_t size = thumb ? ARM_HWORD_SZ : ARM_WORD_SZ;
 
-    uint32_t m = out.val;
-    uint8_t c = out.cout;
+    //ROM code never changes, anything else is checked against the body below
+    if (loop->pc == key && !loop->count && (pc >> 24) >= 0x8) return NULL;
 
-    switch (type) {
-        case 0: //LSL
-            if (imm) {
-                out.val = m << imm;
-                out.cout = m & (1 << (32 - imm));
-            }
-            break;
+    if (len > sizeof(loop->body)) return NULL;
 
-        case 1: //LSR
-        case 2: //ASR
-            if (imm == 0) imm = 32;
+    uint8_t *code = arm_mem_ptr(pc, len, false);
 
-            if (type == 2)
-                out.val = (int64_t)((int32_t)m) >> imm;
-            else
-                out.val = (uint64_t)m >> imm;
+    if (code == NULL) return NULL;
 
-            out.cout = m & (1 << (imm - 1));
-            break;
+    if (loop->pc == key && !memcmp(loop->body, code, len)) return loop->count ? loop : NULL;
 
-        case 3: //ROR
-            if (imm) {
-                out.val = ROR(m, imm);
-                out.cout = m & (1 << (imm - 1));
-            } else { //RRX
-                out.val = ROR((m & ~1) | c, 1);
-                out.cout = m & 1;
-            }
-            break;
-    }
+    loop->pc    = key;
+    loop->count = (len / size) - 1;
 
-    return out;
-}
+    memcpy(loop->body, code, len);
 
-static arm_data_t arm_data_regi_op() {
-    uint8_t rm   = (arm_op >>  0) & 0xf;
-    uint8_t type = (arm_op >>  5) & 0x3;
-    uint8_t imm  = (arm_op >>  7) & 0x1f;
-    uint8_t rd   = (arm_op >> 12) & 0xf;
-    uint8_t rn   = (arm_op >> 16) & 0xf;
+    if (!arm_copy_decode(loop, thumb)) loop->count = 0;
 
-    arm_shifter_t shift = arm_data_regi(rm, type, imm);
+    return loop->count ? loop : NULL;
+}
 
-    arm_data_t op = {
-        .rd   = rd,
-        .lhs  = arm_r.r[rn],
-        .rhs  = shift.val,
-        .cout = shift.cout,
-        .s    = SBIT(arm_op)
-    };
+static void arm_copy_mark(uint32_t pc, arm_copy_t *loop) {
+    arm_copy_last.pc     = pc;
+    arm_copy_last.cycles = arm_r.cycles;
+    arm_copy_last.cnt    = arm_r.r[loop->cnt];
+    arm_copy_last.dst    = arm_r.r[loop->dst];
+    arm_copy_last.valid  = true;
 
-    return op;
+    if (loop->src != ARM_COPY_NONE) arm_copy_last.src = arm_r.r[loop->src];
 }
 
-static arm_shifter_t arm_data_regr(uint8_t rm, uint8_t type, uint8_t rs) {
-    arm_shifter_t out;
+//Called with the loop branch just taken, true when it is a copy loop
+static bool arm_copy_loop(uint32_t pc, int32_t imm) {
+    uint32_t size = arm_in_thumb() ? ARM_HWORD_SZ : ARM_WORD_SZ;
+    uint32_t len  = size - imm - size * 2;
 
-    out.val = arm_r.r[rm];
-    out.cout = arm_flag_tst(ARM_C);
+    arm_copy_t *loop = arm_copy_get(pc, len, arm_in_thumb());
 
-    if (rm == 15) out.val += 4;
+    if (loop == NULL) return false;
 
-    uint8_t sh = arm_r.r[rs];
+    uint32_t cnt = arm_r.r[loop->cnt];
+    uint32_t dst = arm_r.r[loop->dst];
+    uint32_t src = loop->src != ARM_COPY_NONE ? arm_r.r[loop->src] : 0;
 
-    if (sh >= 32) {
-        if (type == 3) sh &= 0x1f;
-        if (type == 2 || sh == 0) sh = 32;
+    //Needs the cost of one iteration, taken from the previous one
+    if (!arm_copy_last.valid ||
+        arm_copy_last.pc  != pc ||
+        arm_copy_last.cnt != cnt + loop->step ||
+        arm_copy_last.dst != dst - loop->size ||
+        (loop->src != ARM_COPY_NONE && arm_copy_last.src != src - loop->size)) {
+        arm_copy_mark(pc, loop);
 
-        out.val = 0;
-        out.cout = 0;
+        return true;
     }
 
-    if (sh && sh <= 32) {
-        uint32_t m = arm_r.r[rm];
+    uint32_t iter = arm_r.cycles - arm_copy_last.cycles;
+    uint32_t left;
 
-        switch (type) {
-            case 0: //LSL
-                out.val = (uint64_t)m << sh;
-                out.cout = m & (1 << (32 - sh));
-                break;
+    arm_copy_mark(pc, loop);
 
-            case 1: //LSR
-            case 2: //ASR
-                if (type == 2)
-                    out.val = (int64_t)((int32_t)m) >> sh;
-                else
-                    out.val = (uint64_t)m >> sh;
+    if (iter == 0 || arm_r.cycles >= arm_r.cycles_target) return true;
 
-                out.cout = m & (1 << (sh - 1));
-                break;
+    //Iterations left, the counter must land on zero for BNE
+    if (loop->cond == ARM_COND_NE) {
+        if (cnt % loop->step) return true;
 
-            case 3: //ROR
-                out.val = ROR((uint64_t)m, sh);
-                out.cout = m & (1 << (sh - 1));
-                break;
-        }
+        left = cnt / loop->step;
+    } else {
+        if ((int32_t)cnt <= 0) return true;
+
+        left = (cnt + loop->step - 1) / loop->step;
     }
 
-    arm_cycles++;
+    //The last one runs on the interpreter to leave the loop
+    uint32_t count = left - 1;
+    uint32_t until = (arm_r.cycles_target - arm_r.cycles - 1) / iter;
 
-    arm_cycles_s_to_n();
+    if (count > until) count = until;
 
-    return out;
-}
+    if (count == 0 || ((src | dst) & loop->align)) return true;
 
-static arm_data_t arm_data_regr_op() {
-    uint8_t rm   = (arm_op >>  0) & 0xf;
-    uint8_t type = (arm_op >>  5) & 0x3;
-    uint8_t rs   = (arm_op >>  8) & 0xf;
-    uint8_t rd   = (arm_op >> 12) & 0xf;
-    uint8_t rn   = (arm_op >> 16) & 0xf;
+    uint32_t bytes = count * loop->size;
 
-    arm_shifter_t shift = arm_data_regr(rm, type, rs);
+    if (bytes / loop->size != count) return true;
 
-    arm_data_t data = {
-        .rd   = rd,
-        .lhs  = arm_r.r[rn],
-        .rhs  = shift.val,
-        .cout = shift.cout,
-        .s    = SBIT(arm_op)
-    };
+    uint8_t *src_ptr = NULL;
+    uint8_t *dst_ptr;
+    uint8_t *code = arm_mem_ptr(pc, len, false);
 
-    return data;
-}
+    if (loop->src != ARM_COPY_NONE) {
+        src_ptr = arm_mem_ptr(src, bytes, false);
 
-static arm_data_t t16_data_imm3_op() {
-    uint8_t rd  = (arm_op >> 0) & 0x7;
-    uint8_t rn  = (arm_op >> 3) & 0x7;
-    uint8_t imm = (arm_op >> 6) & 0x7;
+        if (src_ptr == NULL) return true;
+    }
 
-    arm_data_t op  = {
-        .rd   = rd,
-        .lhs  = arm_r.r[rn],
-        .rhs  = imm,
-        .cout = false,
-        .s    = true
-    };
+    //No side effects before this, nothing may overlap with the output
+    dst_ptr = arm_mem_ptr(dst, bytes, false);
 
-    return op;
-}
+    if (dst_ptr == NULL ||
+        (src_ptr != NULL && src_ptr < dst_ptr + bytes && dst_ptr < src_ptr + bytes) ||
+        (code    != NULL && code    < dst_ptr + bytes && dst_ptr < code + len))
+        return true;
 
-static arm_data_t t16_data_imm8_op() {
-    uint8_t imm = (arm_op >> 0) & 0xff;
-    uint8_t rdn = (arm_op >> 8) & 0x7;
+    arm_mem_ptr(dst, bytes, true);
 
-    arm_data_t op = {
-        .rd   = rdn,
-        .lhs  = arm_r.r[rdn],
-        .rhs  = imm,
-        .cout = false,
-        .s    = true
-    };
+    uint8_t i;
 
-    return op;
-}
+    if (src_ptr != NULL) {
+        memcpy(dst_ptr, src_ptr, bytes);
 
-static arm_data_t t16_data_rdn3_op() {
-    uint8_t rdn = (arm_op >> 0) & 7;
-    uint8_t rm  = (arm_op >> 3) & 7;
+        //Values loaded by the last iteration
+        uint8_t *last = src_ptr + bytes - loop->size;
 
-    arm_data_t op = {
-        .rd   = rdn,
-        .lhs  = arm_r.r[rdn],
-        .rhs  = arm_r.r[rm],
-        .cout = false,
-        .s    = true
-    };
+        for (i = 0; i < loop->loads_cnt; i++) {
+            arm_copy_elem_t *e = &loop->loads[i];
 
-    return op;
-}
+            if (e->unit == 4)
+                arm_r.r[e->reg] = *(uint32_t *)(last + e->offs);
+            else
+                arm_r.r[e->reg] = *(uint16_t *)(last + e->offs);
+        }
 
-static arm_data_t t16_data_neg_op() {
-    uint8_t rd = (arm_op >> 0) & 7;
-    uint8_t rm = (arm_op >> 3) & 7;
+        arm_r.r[loop->src] = src + bytes;
+    } else {
+        uint8_t fill[ARM_COPY_SIZE];
+        uint32_t offs;
 
-    arm_data_t op = {
-        .rd   = rd,
-        .lhs  = 0,
-        .rhs  = arm_r.r[rm],
-        .cout = false,
-        .s    = true
-    };
+        for (i = 0; i < loop->fills_cnt; i++) {
+            arm_copy_elem_t *e = &loop->fills[i];
 
-    return op;
-}
+            memcpy(fill + e->offs, &arm_r.r[e->reg], e->unit);
+        }
 
-static arm_data_t t16_data_reg_op() {
-    uint8_t rd = (arm_op >> 0) & 7;
-    uint8_t rn = (arm_op >> 3) & 7;
-    uint8_t rm = (arm_op >> 6) & 7;
+        for (offs = 0; offs < bytes; offs += loop->size) {
+            memcpy(dst_ptr + offs, fill, loop->size);
+        }
+    }
 
-    arm_data_t op = {
-        .rd   = rd,
-        .lhs  = arm_r.r[rn],
-        .rhs  = arm_r.r[rm],
-        .cout = false,
-        .s    = true
-    };
+    arm_r.r[loop->dst] = dst + bytes;
+    arm_r.r[loop->cnt] = cnt - count * loop->step;
 
-    return op;
-}
+    //Flags of the last SUBS
+    uint32_t prev = arm_r.r[loop->cnt] + loop->step;
 
-static arm_data_t t16_data_rdn4_op(bool s) {
-    uint8_t rm = (arm_op >> 3) & 0xf;
+    arm_flags_defer(ARM_FLAGS_SUB, prev, loop->step, (uint64_t)prev - loop->step);
 
-    uint8_t rdn;
+    arm_r.cycles += count * iter;
 
-    rdn  = (arm_op >> 0) & 0x7;
-    rdn |= (arm_op >> 4) & 0x8;
+    arm_copy_runs++;
+    arm_copy_bytes += bytes;
 
-    arm_data_t op = {
-        .rd   = rdn,
-        .lhs  = arm_r.r[rdn],
-        .rhs  = arm_r.r[rm],
-        .cout = false,
-        .s    = s
-    };
+    arm_copy_mark(pc, loop);
 
-    return op;
+    return true;
 }
 
-static arm_data_t t16_data_imm7sp_op() {
-    uint16_t imm = (arm_op & 0x7f) << 2;
+/*
+ * Idle loop detection
+ *
+ * A short backward branch that arrives at its target twice with the same
+ * registers and flags, and without any write or side effecting read in
+ * between, is in a loop that can only end when an event changes memory.
+ * Each iteration is then identical, so whole iterations are skipped up to
+ * the end of the slice or the next timer overflow.
+ */
 
-    arm_data_t op = {
-        .rd   = 13,
-        .lhs  = arm_r.r[13],
-        .rhs  = imm,
-        .cout = false,
-        .s    = true
-    };
+#define ARM_IDLE_SPAN  0x40
 
-    return op;
-}
+typedef struct {
+    uint32_t pc;
+    uint32_t r[15];
+    uint32_t cpsr;
+    uint32_t writes;
+    uint32_t cycles;
+    bool     valid;
+} arm_idle_t;
 
-static arm_data_t t16_data_imm8sp_op() {
-    arm_data_t op = t16_data_imm8_op();
+static arm_idle_t arm_idle;
 
-    op.lhs = arm_r.r[13];
-    op.rhs <<= 2;
-    op.s = false;
+static bool     arm_idle_hit;
+static uint32_t arm_idle_iter; //Cycles per iteration, 0 to skip until the next event
 
-    return op;
-}
+static uint64_t arm_idle_skips;
+static uint64_t arm_idle_cycles;
 
-static arm_data_t t16_data_imm8pc_op() {
-    arm_data_t op = t16_data_imm8_op();
+//Called by taken branches after the pipeline reload, with the branch offset
+static void arm_idle_branch(int32_t imm) {
+    uint32_t pc = arm_r.r[15] - (arm_in_thumb() ? 4 : 8);
 
-    op.lhs = arm_r.r[15] & ~3;
-    op.rhs <<= 2;
-    op.s = false;
+    if (arm_idle_addr && pc == arm_idle_addr) {
+        arm_idle_hit  = true;
+        arm_idle_iter = 0;
 
-    return op;
-}
+        return;
+    }
 
-static arm_data_t t16_data_imm5_op(bool rsh) {
-    uint8_t rd  = (arm_op >> 0) & 0x7;
-    uint8_t rn  = (arm_op >> 3) & 0x7;
-    uint8_t imm = (arm_op >> 6) & 0x1f;
+    if (arm_copy_enb && imm < 0 && arm_copy_loop(pc, imm)) return;
 
-    arm_data_t op = {
-        .rd   = rd,
-        .lhs  = arm_r.r[rn],
-        .rhs  = (rsh && imm == 0 ? 32 : imm),
-        .cout = false,
-        .s    = true
-    };
+    if (!arm_idle_enb || imm >= 0 || imm < -ARM_IDLE_SPAN) return;
 
-    return op;
+    arm_flags_sync();
+
+    if (arm_idle.valid &&
+        arm_idle.pc     == pc &&
+        arm_idle.cpsr   == arm_r.cpsr &&
+        arm_idle.writes == arm_idle_writes &&
+        arm_idle.cycles != arm_r.cycles &&
+        !memcmp(arm_idle.r, arm_r.r, sizeof(arm_idle.r))) {
+        arm_idle_hit  = true;
+        arm_idle_iter = arm_r.cycles - arm_idle.cycles;
+    } else {
+        memcpy(arm_idle.r, arm_r.r, sizeof(arm_idle.r));
+
+        arm_idle.pc     = pc;
+        arm_idle.cpsr   = arm_r.cpsr;
+        arm_idle.writes = arm_idle_writes;
+        arm_idle.valid  = true;
+    }
+
+    arm_idle.cycles = arm_r.cycles;
 }
 
-//Multiplication
+/*
+ * Execute
+ */
+
+//Data Processing (Arithmetic)
 typedef struct {
     uint64_t lhs;
     uint64_t rhs;
-    uint8_t  ra;
     uint8_t  rd;
+    bool     cout;
     bool     s;
-} arm_mpy_t;
-
-#define ARM_MPY_SIGNED  0
-#define ARM_MPY_UNSIGN  1
-
-static void arm_mpy_inc_cycles(uint64_t rhs, bool u) {
-    uint32_t m1 = rhs & 0xffffff00;
-    uint32_t m2 = rhs & 0xffff0000;
-    uint32_t m3 = rhs & 0xff000000;
-
-    if      (m1 == 0 || (!u && m1 == 0xffffff00))
-        arm_cycles += 1;
-    else if (m2 == 0 || (!u && m2 == 0xffff0000))
-        arm_cycles += 2;
-    else if (m3 == 0 || (!u && m3 == 0xff000000))
-        arm_cycles += 3;
-    else
-        arm_cycles += 4;
-
-    arm_cycles_s_to_n();
-}
+} arm_data_t;
 
-static void arm_mpy_add(arm_mpy_t op) {
-    uint32_t a = arm_r.r[op.ra];
+#define ARM_ARITH_SUB  0
+#define ARM_ARITH_ADD  1
 
-    uint32_t res = a + op.lhs * op.rhs;
+#define ARM_ARITH_NO_C   0
+#define ARM_ARITH_CARRY  1
 
-    arm_r.r[op.rd] = res;
+#define ARM_ARITH_NO_REV   0
+#define ARM_ARITH_REVERSE  1
 
-    if (op.s) {
-        arm_setn(res);
-        arm_setz(res);
+ARM_INLINE void arm_arith_set(arm_data_t op, uint64_t res, bool add) {
+    if (op.rd == 15) {
+        if (op.s) {
+            arm_spsr_to_cpsr();
+            arm_r15_align();
+            arm_load_pipe();
+            arm_check_irq();
+        } else {
+            arm_r15_align();
+            arm_load_pipe();
+        }
+    } else if (op.s) {
+        arm_flags_defer(add ? ARM_FLAGS_ADD : ARM_FLAGS_SUB, op.lhs, op.rhs, res);
     }
-
-    arm_mpy_inc_cycles(op.rhs, ARM_MPY_SIGNED);
-
-    arm_cycles++;
 }
 
-static void arm_mpy(arm_mpy_t op) {
-    uint32_t res = op.lhs * op.rhs;
+ARM_INLINE void arm_arith_add(arm_data_t op, bool adc) {
+    uint64_t res  = op.lhs + op.rhs;
+    if (adc) res += arm_flag_tst(ARM_C);
 
     arm_r.r[op.rd] = res;
 
-    if (op.s) {
-        arm_setn(res);
-        arm_setz(res);
-    }
-
-    arm_mpy_inc_cycles(op.rhs, ARM_MPY_SIGNED);
+    arm_arith_set(op, res, ARM_ARITH_ADD);
 }
 
-static void arm_mpy_smla__(arm_mpy_t op, bool m, bool n) {
-    if (m) op.lhs >>= 16;
-    if (n) op.rhs >>= 16;
+ARM_INLINE void arm_arith_subtract(arm_data_t op, bool sbc, bool rev) {
+    if (rev) {
+        uint64_t tmp = op.lhs;
 
-    int64_t l = (int16_t)op.lhs;
-    int64_t r = (int16_t)op.rhs;
+        op.lhs = op.rhs;
+        op.rhs = tmp;
+    }
 
-    int64_t res = arm_r.r[op.ra] + l * r;
+    uint64_t res  = op.lhs - op.rhs;
+    if (sbc) res -= !arm_flag_tst(ARM_C);
 
     arm_r.r[op.rd] = res;
 
-    int32_t d = arm_r.r[op.rd];
-
-    if (d != res) arm_flag_set(ARM_Q, true);
+    arm_arith_set(op, res, ARM_ARITH_SUB);
+}
 
-    arm_mpy_inc_cycles(op.rhs, ARM_MPY_SIGNED);
+ARM_INLINE void arm_arith_rsb(arm_data_t op) {
+    arm_arith_subtract(op, ARM_ARITH_NO_C, ARM_ARITH_REVERSE);
+}
 
-    arm_cycles++;
+ARM_INLINE void arm_arith_rsc(arm_data_t op) {
+    arm_arith_subtract(op, ARM_ARITH_CARRY, ARM_ARITH_REVERSE);
 }
 
-static void arm_mpy_smlal(arm_mpy_t op) {
-    int64_t l = (int32_t)op.lhs;
-    int64_t r = (int32_t)op.rhs;
+ARM_INLINE void arm_arith_sbc(arm_data_t op) {
+    arm_arith_subtract(op, ARM_ARITH_CARRY, ARM_ARITH_NO_REV);
+}
 
-    int64_t a = arm_r.r[op.ra];
-    int64_t d = arm_r.r[op.rd];
+ARM_INLINE void arm_arith_sub(arm_data_t op) {
+    arm_arith_subtract(op, ARM_ARITH_NO_C, ARM_ARITH_NO_REV);
+}
 
-    a |= d << 32;
+ARM_INLINE void arm_arith_cmn(arm_data_t op) {
+    arm_arith_set(op, op.lhs + op.rhs, ARM_ARITH_ADD);
+}
 
-    int64_t res = a + l * r;
+ARM_INLINE void arm_arith_cmp(arm_data_t op) {
+    arm_arith_set(op, op.lhs - op.rhs, ARM_ARITH_SUB);
+}
 
-    arm_r.r[op.ra] = res;
-    arm_r.r[op.rd] = res >> 32;
+//Data Processing (Logical)
+typedef enum {
+    AND,
+    BIC,
+    EOR,
+    MVN,
+    ORN,
+    ORR,
+    SHIFT
+} arm_logic_e;
 
-    if (op.s) {
-        arm_setn64(res);
-        arm_setz64(res);
+ARM_INLINE void arm_logic_set(arm_data_t op, uint32_t res) {
+    if (op.rd == 15) {
+        if (op.s) {
+            arm_spsr_to_cpsr();
+            arm_r15_align();
+            arm_load_pipe();
+            arm_check_irq();
+        } else {
+            arm_r15_align();
+            arm_load_pipe();
+        }
+    } else if (op.s) {
+        arm_flags_defer(ARM_FLAGS_LOGIC, op.cout, 0, res);
     }
-
-    arm_mpy_inc_cycles(op.rhs, ARM_MPY_SIGNED);
-
-    arm_cycles += 2;
 }
 
-static void arm_mpy_smlal__(arm_mpy_t op, bool m, bool n) {
-    if (m) op.lhs >>= 16;
-    if (n) op.rhs >>= 16;
+ARM_INLINE void arm_logic(arm_data_t op, arm_logic_e inst) {
+    uint32_t res;
 
-    int64_t l = (int16_t)op.lhs;
-    int64_t r = (int16_t)op.rhs;
+    switch (inst) {
+        case AND: res = op.lhs &  op.rhs; break;
+        case BIC: res = op.lhs & ~op.rhs; break;
+        case EOR: res = op.lhs ^  op.rhs; break;
+        case ORN: res = op.lhs | ~op.rhs; break;
+        case ORR: res = op.lhs |  op.rhs; break;
 
-    int64_t a = arm_r.r[op.ra];
-    int64_t d = arm_r.r[op.rd];
+        case MVN:   res = ~op.rhs; break;
+        case SHIFT: res =  op.rhs; break;
+    }
 
-    a |= d << 32;
+    arm_r.r[op.rd] = res;
 
-    int64_t res = a + l * r;
+    arm_logic_set(op, res);
+}
 
-    arm_r.r[op.ra] = res;
-    arm_r.r[op.rd] = res >> 32;
+static void arm_asr(arm_data_t op) {
+    int64_t val = (int32_t)op.lhs;
+    uint8_t sh = op.rhs;
 
-    arm_mpy_inc_cycles(op.rhs, ARM_MPY_SIGNED);
+    if (sh > 32) sh = 32;
 
-    arm_cycles += 2;
-}
+    op.rhs = val >> sh;
+    op.cout = val & (1 << (sh - 1));
 
-static void arm_mpy_smlaw_(arm_mpy_t op, bool m) {
-    if (m) op.lhs >>= 16;
+    arm_r.r[op.rd] = op.rhs;
 
-    int64_t l = (int16_t)op.lhs;
-    int64_t a = arm_r.r[op.ra];
+    arm_logic_set(op, op.rhs);
+}
 
-    int64_t res = (a << 16) + l * op.rhs;
+static void arm_lsl(arm_data_t op) {
+    uint64_t val = op.lhs;
+    uint8_t sh = op.rhs;
 
-    arm_r.r[op.rd] = res >> 16;
+    bool c = arm_flag_tst(ARM_C);
 
-    int32_t d = (int32_t)arm_r.r[op.rd];
+    op.rhs = val;
+    op.cout = c;
 
-    if (d != res) arm_flag_set(ARM_Q, true);
+    if (sh > 32) {
+        op.rhs = 0;
+        op.cout = 0;
+    } else if (sh) {
+        op.rhs = val << sh;
+        op.cout = val & (1 << (32 - sh));
+    }
 
-    arm_mpy_inc_cycles(op.rhs, ARM_MPY_SIGNED);
+    arm_r.r[op.rd] = op.rhs;
 
-    arm_cycles++;
+    arm_logic_set(op, op.rhs);
 }
 
-static void arm_mpy_smul(arm_mpy_t op, bool m, bool n) {
-    if (m) op.lhs >>= 16;
-    if (n) op.rhs >>= 16;
+static void arm_lsr(arm_data_t op) {
+    uint64_t val = op.lhs;
+    uint8_t sh = op.rhs;
 
-    int64_t l = (int16_t)op.lhs;
-    int64_t r = (int16_t)op.rhs;
+    bool c = arm_flag_tst(ARM_C);
 
-    int64_t res = l * r;
+    op.rhs = val;
+    op.cout = c;
 
-    arm_r.r[op.rd] = res;
+    if (sh > 32) {
+        op.rhs = 0;
+        op.cout = 0;
+    } else if (sh) {
+        op.rhs = val >> sh;
+        op.cout = val & (1 << (sh - 1));
+    }
 
-    arm_mpy_inc_cycles(op.rhs, ARM_MPY_SIGNED);
+    arm_r.r[op.rd] = op.rhs;
+
+    arm_logic_set(op, op.rhs);
 }
 
-static void arm_mpy_smull(arm_mpy_t op) {
-    int64_t l = (int32_t)op.lhs;
-    int64_t r = (int32_t)op.rhs;
+static void arm_ror(arm_data_t op) {
+    uint64_t val = op.lhs;
+    uint8_t sh = op.rhs;
 
-    int64_t res = l * r;
+    bool c = arm_flag_tst(ARM_C);
 
-    arm_r.r[op.ra] = res;
-    arm_r.r[op.rd] = res >> 32;
+    op.rhs = val;
+    op.cout = c;
 
-    if (op.s) {
-        arm_setn64(res);
-        arm_setz64(res);
+    if (sh) {
+        sh &= 0x1f;
+        if (sh == 0) sh = 32;
+
+        op.rhs = ROR(val, sh);
+        op.cout = val & (1 << (sh - 1));
     }
 
-    arm_mpy_inc_cycles(op.rhs, ARM_MPY_SIGNED);
+    arm_r.r[op.rd] = op.rhs;
 
-    arm_cycles++;
+    arm_logic_set(op, op.rhs);
 }
 
-static void arm_mpy_smulw_(arm_mpy_t op, bool m) {
-    if (m) op.lhs >>= 16;
-
-    int64_t res =  (int16_t)op.lhs * op.rhs;
+static void arm_count_zeros(uint8_t rd) {
+    uint8_t rm = arm_r.op & 0xf;
+    uint32_t m = arm_r.r[rm];
+    uint32_t i, cnt = 32;
 
-    arm_r.r[op.rd] = res >> 16;
+    for (i = 0; i < 32; i++) {
+        if (m & (1 << i)) cnt = i ^ 0x1f;
+    }
 
-    arm_mpy_inc_cycles(op.rhs, ARM_MPY_SIGNED);
+    arm_r.r[rd] = cnt;
 }
 
-static void arm_mpy_umlal(arm_mpy_t op) {
-    uint64_t l = op.lhs;
-    uint64_t r = op.rhs;
+ARM_INLINE void arm_logic_teq(arm_data_t op) {
+    arm_logic_set(op, op.lhs ^ op.rhs);
+}
 
-    uint64_t a = arm_r.r[op.ra];
-    uint64_t d = arm_r.r[op.rd];
+ARM_INLINE void arm_logic_tst(arm_data_t op) {
+    arm_logic_set(op, op.lhs & op.rhs);
+}
 
-    a |= d << 32;
+//Data Processing Operand Decoding
+typedef struct {
+    uint32_t val;
+    bool     cout;
+} arm_shifter_t;
 
-    uint64_t res = a + l * r;
+#define ARM_FLAG_KEEP  0
+#define ARM_FLAG_SET   1
 
-    arm_r.r[op.ra] = res;
-    arm_r.r[op.rd] = res >> 32;
+#define ARM_SHIFT_LEFT   0
+#define ARM_SHIFT_RIGHT  1
 
-    if (op.s) {
-        arm_setn64(res);
-        arm_setz64(res);
-    }
+ARM_INLINE arm_data_t arm_data_imm_op(bool s) {
+    uint32_t imm   = (arm_r.op >>  0) & 0xff;
+    uint8_t  shift = (arm_r.op >>  7) & 0x1e;
+    uint8_t  rd    = (arm_r.op >> 12) & 0xf;
+    uint8_t  rn    = (arm_r.op >> 16) & 0xf;
 
-    arm_mpy_inc_cycles(op.rhs, ARM_MPY_UNSIGN);
+    imm = ROR(imm, shift);
 
-    arm_cycles += 2;
-}
+    arm_data_t op = {
+        .rd   = rd,
+        .lhs  = arm_r.r[rn],
+        .rhs  = imm,
+        .cout = imm & (1 << 31),
+        .s    = s
+    };
 
-static void arm_mpy_umull(arm_mpy_t op) {
-    uint64_t l = op.lhs;
-    uint64_t r = op.rhs;
+    return op;
+}
 
-    uint64_t res = l * r;
+static arm_shifter_t arm_data_regi(uint8_t rm, uint8_t type, uint8_t imm) {
+    arm_shifter_t out;
 
-    arm_r.r[op.ra] = res;
-    arm_r.r[op.rd] = res >> 32;
+    out.val = arm_r.r[rm];
+    out.cout = arm_flag_tst(ARM_C);
+
+    uint32_t m = out.val;
+    uint8_t c = out.cout;
+
+    switch (type) {
+        case 0: //LSL
+            if (imm) {
+                out.val = m << imm;
+                out.cout = m & (1 << (32 - imm));
+            }
+            break;
+
+        case 1: //LSR
+        case 2: //ASR
+            if (imm == 0) imm = 32;
+
+            if (type == 2)
+                out.val = (int64_t)((int32_t)m) >> imm;
+            else
+                out.val = (uint64_t)m >> imm;
+
+            out.cout = m & (1 << (imm - 1));
+            break;
 
-    if (op.s) {
-        arm_setn64(res);
-        arm_setz64(res);
+        case 3: //ROR
+            if (imm) {
+                out.val = ROR(m, imm);
+                out.cout = m & (1 << (imm - 1));
+            } else { //RRX
+                out.val = ROR((m & ~1) | c, 1);
+                out.cout = m & 1;
+            }
+            break;
     }
 
-    arm_mpy_inc_cycles(op.rhs, ARM_MPY_UNSIGN);
+    return out;
+}
+
+/*
+ * The shift type and S bit are constants on the data processing handlers,
+ * and the carry in is only read when the result needs it (cout).
+ */
+ARM_INLINE arm_data_t arm_data_regi_op(uint8_t type, bool s, bool cout) {
+    uint8_t rm  = (arm_r.op >>  0) & 0xf;
+    uint8_t imm = (arm_r.op >>  7) & 0x1f;
+    uint8_t rd  = (arm_r.op >> 12) & 0xf;
+    uint8_t rn  = (arm_r.op >> 16) & 0xf;
+
+    uint32_t m = arm_r.r[rm];
+    uint32_t val = m;
+    bool c = false;
+
+    switch (type) {
+        case 0: //LSL
+            if (imm) {
+                val = m << imm;
+                c = m & (1 << (32 - imm));
+            } else if (cout) {
+                c = arm_flag_tst(ARM_C);
+            }
+            break;
+
+        case 1: //LSR
+            if (imm == 0) imm = 32;
+
+            val = (uint64_t)m >> imm;
+            c = m & (1 << (imm - 1));
+            break;
+
+        case 2: //ASR
+            if (imm == 0) imm = 32;
+
+            val = (int64_t)((int32_t)m) >> imm;
+            c = m & (1 << (imm - 1));
+            break;
+
+        case 3: //ROR
+            if (imm) {
+                val = ROR(m, imm);
+                c = m & (1 << (imm - 1));
+            } else { //RRX
+                val = ROR((m & ~1) | arm_flag_tst(ARM_C), 1);
+                c = m & 1;
+            }
+            break;
+    }
+
+    arm_data_t op = {
+        .rd   = rd,
+        .lhs  = arm_r.r[rn],
+        .rhs  = val,
+        .cout = c,
+        .s    = s
+    };
 
-    arm_cycles++;
+    return op;
 }
 
-static arm_mpy_t arm_mpy_op() {
-    uint8_t rn = (arm_op >>  0) & 0xf;
-    uint8_t rm = (arm_op >>  8) & 0xf;
-    uint8_t ra = (arm_op >> 12) & 0xf;
-    uint8_t rd = (arm_op >> 16) & 0xf;
-    bool    s  = (arm_op >> 20) & 0x1;
+ARM_INLINE arm_data_t arm_data_regr_op(uint8_t type, bool s, bool cout) {
+    uint8_t rm = (arm_r.op >>  0) & 0xf;
+    uint8_t rs = (arm_r.op >>  8) & 0xf;
+    uint8_t rd = (arm_r.op >> 12) & 0xf;
+    uint8_t rn = (arm_r.op >> 16) & 0xf;
 
-    arm_mpy_t op = {
-        .lhs = arm_r.r[rn],
-        .rhs = arm_r.r[rm],
-        .ra  = ra,
-        .rd  = rd,
-        .s   = s
+    uint32_t m = arm_r.r[rm];
+    uint32_t val = m;
+    bool c = cout && arm_flag_tst(ARM_C);
+
+    if (rm == 15) val += 4;
+
+    uint8_t sh = arm_r.r[rs];
+
+    if (sh >= 32) {
+        if (type == 3) sh &= 0x1f;
+        if (type == 2 || sh == 0) sh = 32;
+
+        val = 0;
+        c = false;
+    }
+
+    if (sh && sh <= 32) {
+        switch (type) {
+            case 0: //LSL
+                val = (uint64_t)m << sh;
+                c = m & (1 << (32 - sh));
+                break;
+
+            case 1: //LSR
+                val = (uint64_t)m >> sh;
+                c = m & (1 << (sh - 1));
+                break;
+
+            case 2: //ASR
+                val = (int64_t)((int32_t)m) >> sh;
+                c = m & (1 << (sh - 1));
+                break;
+
+            case 3: //ROR
+                val = ROR((uint64_t)m, sh);
+                c = m & (1 << (sh - 1));
+                break;
+        }
+    }
+
+    arm_r.cycles++;
+
+    arm_cycles_s_to_n();
+
+    arm_data_t op = {
+        .rd   = rd,
+        .lhs  = arm_r.r[rn],
+        .rhs  = val,
+        .cout = c,
+        .s    = s
     };
 
     return op;
 }
 
-static arm_mpy_t t16_mpy_op() {
-    uint8_t rdn = (arm_op >> 0) & 7;
-    uint8_t rm  = (arm_op >> 3) & 7;
+static arm_data_t t16_data_imm3_op() {
+    uint8_t rd  = (arm_r.op >> 0) & 0x7;
+    uint8_t rn  = (arm_r.op >> 3) & 0x7;
+    uint8_t imm = (arm_r.op >> 6) & 0x7;
 
-    arm_mpy_t op = {
+    arm_data_t op  = {
+        .rd   = rd,
+        .lhs  = arm_r.r[rn],
+        .rhs  = imm,
+        .cout = false,
+        .s    = true
+    };
+
+    return op;
+}
+
+static arm_data_t t16_data_imm8_op() {
+    uint8_t imm = (arm_r.op >> 0) & 0xff;
+    uint8_t rdn = (arm_r.op >> 8) & 0x7;
+
+    arm_data_t op = {
+        .rd   = rdn,
+        .lhs  = arm_r.r[rdn],
+        .rhs  = imm,
+        .cout = false,
+        .s    = true
+    };
+
+    return op;
+}
+
+static arm_data_t t16_data_rdn3_op() {
+    uint8_t rdn = (arm_r.op >> 0) & 7;
+    uint8_t rm  = (arm_r.op >> 3) & 7;
+
+    arm_data_t op = {
         .rd   = rdn,
         .lhs  = arm_r.r[rdn],
         .rhs  = arm_r.r[rm],
+        .cout = false,
         .s    = true
     };
 
     return op;
 }
 
-//Processor State
-#define PRIV_MASK   0xf8ff03df
-#define USR_MASK    0xf8ff0000
-#define STATE_MASK  0x01000020
+static arm_data_t t16_data_neg_op() {
+    uint8_t rd = (arm_r.op >> 0) & 7;
+    uint8_t rm = (arm_r.op >> 3) & 7;
 
-typedef struct {
-    uint8_t  rd;
-    uint32_t psr;
-    uint32_t mask;
-    bool     r;
-} arm_psr_t;
+    arm_data_t op = {
+        .rd   = rd,
+        .lhs  = 0,
+        .rhs  = arm_r.r[rm],
+        .cout = false,
+        .s    = true
+    };
 
-static void arm_psr_to_reg(arm_psr_t op) {
-    if (op.r) {
-        arm_spsr_get(&arm_r.r[op.rd]);
-    } else {
-        if ((arm_r.cpsr & 0x1f) == ARM_USR)
-            arm_r.r[op.rd] = arm_r.cpsr & USR_MASK;
-        else
-            arm_r.r[op.rd] = arm_r.cpsr & PRIV_MASK;
-    }
+    return op;
 }
 
-static void arm_reg_to_psr(arm_psr_t op) {
-    uint32_t spsr = 0;
-    uint32_t mask = 0;
+static arm_data_t t16_data_reg_op() {
+    uint8_t rd = (arm_r.op >> 0) & 7;
+    uint8_t rn = (arm_r.op >> 3) & 7;
+    uint8_t rm = (arm_r.op >> 6) & 7;
+
+    arm_data_t op = {
+        .rd   = rd,
+        .lhs  = arm_r.r[rn],
+        .rhs  = arm_r.r[rm],
+        .cout = false,
+        .s    = true
+    };
+
+    return op;
+}
+
+static arm_data_t t16_data_rdn4_op(bool s) {
+    uint8_t rm = (arm_r.op >> 3) & 0xf;
+
+    uint8_t rdn;
+
+    rdn  = (arm_r.op >> 0) & 0x7;
+    rdn |= (arm_r.op >> 4) & 0x8;
+
+    arm_data_t op = {
+        .rd   = rdn,
+        .lhs  = arm_r.r[rdn],
+        .rhs  = arm_r.r[rm],
+        .cout = false,
+        .s    = s
+    };
+
+    return op;
+}
+
+static arm_data_t t16_data_imm7sp_op() {
+    uint16_t imm = (arm_r.op & 0x7f) << 2;
+
+    arm_data_t op = {
+        .rd   = 13,
+        .lhs  = arm_r.r[13],
+        .rhs  = imm,
+        .cout = false,
+        .s    = true
+    };
+
+    return op;
+}
+
+static arm_data_t t16_data_imm8sp_op() {
+    arm_data_t op = t16_data_imm8_op();
+
+    op.lhs = arm_r.r[13];
+    op.rhs <<= 2;
+    op.s = false;
+
+    return op;
+}
+
+static arm_data_t t16_data_imm8pc_op() {
+    arm_data_t op = t16_data_imm8_op();
+
+    op.lhs = arm_r.r[15] & ~3;
+    op.rhs <<= 2;
+    op.s = false;
+
+    return op;
+}
+
+static arm_data_t t16_data_imm5_op(bool rsh) {
+    uint8_t rd  = (arm_r.op >> 0) & 0x7;
+    uint8_t rn  = (arm_r.op >> 3) & 0x7;
+    uint8_t imm = (arm_r.op >> 6) & 0x1f;
+
+    arm_data_t op = {
+        .rd   = rd,
+        .lhs  = arm_r.r[rn],
+        .rhs  = (rsh && imm == 0 ? 32 : imm),
+        .cout = false,
+        .s    = true
+    };
+
+    return op;
+}
+
+//Multiplication
+typedef struct {
+    uint64_t lhs;
+    uint64_t rhs;
+    uint8_t  ra;
+    uint8_t  rd;
+    bool     s;
+} arm_mpy_t;
+
+#define ARM_MPY_SIGNED  0
+#define ARM_MPY_UNSIGN  1
+
+static void arm_mpy_inc_cycles(uint64_t rhs, bool u) {
+    if (arm_fast_enb) {
+        arm_r.cycles++;
+
+        return;
+    }
+
+    uint32_t m1 = rhs & 0xffffff00;
+    uint32_t m2 = rhs & 0xffff0000;
+    uint32_t m3 = rhs & 0xff000000;
+
+    if      (m1 == 0 || (!u && m1 == 0xffffff00))
+        arm_r.cycles += 1;
+    else if (m2 == 0 || (!u && m2 == 0xffff0000))
+        arm_r.cycles += 2;
+    else if (m3 == 0 || (!u && m3 == 0xff000000))
+        arm_r.cycles += 3;
+    else
+        arm_r.cycles += 4;
+
+    arm_cycles_s_to_n();
+}
+
+static void arm_mpy_add(arm_mpy_t op) {
+    uint32_t a = arm_r.r[op.ra];
+
+    uint32_t res = a + op.lhs * op.rhs;
+
+    arm_r.r[op.rd] = res;
+
+    if (op.s) arm_flags_defer(ARM_FLAGS_NZ, 0, 0, res);
+
+    arm_mpy_inc_cycles(op.rhs, ARM_MPY_SIGNED);
+
+    arm_r.cycles++;
+}
+
+static void arm_mpy(arm_mpy_t op) {
+    uint32_t res = op.lhs * op.rhs;
+
+    arm_r.r[op.rd] = res;
+
+    if (op.s) arm_flags_defer(ARM_FLAGS_NZ, 0, 0, res);
+
+    arm_mpy_inc_cycles(op.rhs, ARM_MPY_SIGNED);
+}
+
+static void arm_mpy_smla__(arm_mpy_t op, bool m, bool n) {
+    if (m) op.lhs >>= 16;
+    if (n) op.rhs >>= 16;
+
+    int64_t l = (int16_t)op.lhs;
+    int64_t r = (int16_t)op.rhs;
+
+    int64_t res = arm_r.r[op.ra] + l * r;
+
+    arm_r.r[op.rd] = res;
+
+    int32_t d = arm_r.r[op.rd];
+
+    if (d != res) arm_flag_set(ARM_Q, true);
+
+    arm_mpy_inc_cycles(op.rhs, ARM_MPY_SIGNED);
+
+    arm_r.cycles++;
+}
+
+static void arm_mpy_smlal(arm_mpy_t op) {
+    int64_t l = (int32_t)op.lhs;
+    int64_t r = (int32_t)op.rhs;
+
+    int64_t a = arm_r.r[op.ra];
+    int64_t d = arm_r.r[op.rd];
+
+    a |= d << 32;
+
+    int64_t res = a + l * r;
+
+    arm_r.r[op.ra] = res;
+    arm_r.r[op.rd] = res >> 32;
+
+    if (op.s) arm_flags_defer(ARM_FLAGS_NZ64, 0, 0, res);
+
+    arm_mpy_inc_cycles(op.rhs, ARM_MPY_SIGNED);
+
+    arm_r.cycles += 2;
+}
+
+static void arm_mpy_smlal__(arm_mpy_t op, bool m, bool n) {
+    if (m) op.lhs >>= 16;
+    if (n) op.rhs >>= 16;
+
+    int64_t l = (int16_t)op.lhs;
+    int64_t r = (int16_t)op.rhs;
+
+    int64_t a = arm_r.r[op.ra];
+    int64_t d = arm_r.r[op.rd];
+
+    a |= d << 32;
+
+    int64_t res = a + l * r;
+
+    arm_r.r[op.ra] = res;
+    arm_r.r[op.rd] = res >> 32;
+
+    arm_mpy_inc_cycles(op.rhs, ARM_MPY_SIGNED);
+
+    arm_r.cycles += 2;
+}
+
+static void arm_mpy_smlaw_(arm_mpy_t op, bool m) {
+    if (m) op.lhs >>= 16;
+
+    int64_t l = (int16_t)op.lhs;
+    int64_t a = arm_r.r[op.ra];
+
+    int64_t res = (a << 16) + l * op.rhs;
+
+    arm_r.r[op.rd] = res >> 16;
+
+    int32_t d = (int32_t)arm_r.r[op.rd];
+
+    if (d != res) arm_flag_set(ARM_Q, true);
+
+    arm_mpy_inc_cycles(op.rhs, ARM_MPY_SIGNED);
+
+    arm_r.cycles++;
+}
+
+static void arm_mpy_smul(arm_mpy_t op, bool m, bool n) {
+    if (m) op.lhs >>= 16;
+    if (n) op.rhs >>= 16;
+
+    int64_t l = (int16_t)op.lhs;
+    int64_t r = (int16_t)op.rhs;
+
+    int64_t res = l * r;
+
+    arm_r.r[op.rd] = res;
+
+    arm_mpy_inc_cycles(op.rhs, ARM_MPY_SIGNED);
+}
+
+static void arm_mpy_smull(arm_mpy_t op) {
+    int64_t l = (int32_t)op.lhs;
+    int64_t r = (int32_t)op.rhs;
+
+    int64_t res = l * r;
+
+    arm_r.r[op.ra] = res;
+    arm_r.r[op.rd] = res >> 32;
+
+    if (op.s) arm_flags_defer(ARM_FLAGS_NZ64, 0, 0, res);
+
+    arm_mpy_inc_cycles(op.rhs, ARM_MPY_SIGNED);
+
+    arm_r.cycles++;
+}
+
+static void arm_mpy_smulw_(arm_mpy_t op, bool m) {
+    if (m) op.lhs >>= 16;
+
+    int64_t res =  (int16_t)op.lhs * op.rhs;
+
+    arm_r.r[op.rd] = res >> 16;
+
+    arm_mpy_inc_cycles(op.rhs, ARM_MPY_SIGNED);
+}
+
+static void arm_mpy_umlal(arm_mpy_t op) {
+    uint64_t l = op.lhs;
+    uint64_t r = op.rhs;
+
+    uint64_t a = arm_r.r[op.ra];
+    uint64_t d = arm_r.r[op.rd];
+
+    a |= d << 32;
+
+    uint64_t res = a + l * r;
+
+    arm_r.r[op.ra] = res;
+    arm_r.r[op.rd] = res >> 32;
+
+    if (op.s) arm_flags_defer(ARM_FLAGS_NZ64, 0, 0, res);
+
+    arm_mpy_inc_cycles(op.rhs, ARM_MPY_UNSIGN);
+
+    arm_r.cycles += 2;
+}
+
+static void arm_mpy_umull(arm_mpy_t op) {
+    uint64_t l = op.lhs;
+    uint64_t r = op.rhs;
+
+    uint64_t res = l * r;
+
+    arm_r.r[op.ra] = res;
+    arm_r.r[op.rd] = res >> 32;
+
+    if (op.s) arm_flags_defer(ARM_FLAGS_NZ64, 0, 0, res);
+
+    arm_mpy_inc_cycles(op.rhs, ARM_MPY_UNSIGN);
+
+    arm_r.cycles++;
+}
+
+static arm_mpy_t arm_mpy_op() {
+    uint8_t rn = (arm_r.op >>  0) & 0xf;
+    uint8_t rm = (arm_r.op >>  8) & 0xf;
+    uint8_t ra = (arm_r.op >> 12) & 0xf;
+    uint8_t rd = (arm_r.op >> 16) & 0xf;
+    bool    s  = (arm_r.op >> 20) & 0x1;
+
+    arm_mpy_t op = {
+        .lhs = arm_r.r[rn],
+        .rhs = arm_r.r[rm],
+        .ra  = ra,
+        .rd  = rd,
+        .s   = s
+    };
+
+    return op;
+}
+
+static arm_mpy_t t16_mpy_op() {
+    uint8_t rdn = (arm_r.op >> 0) & 7;
+    uint8_t rm  = (arm_r.op >> 3) & 7;
+
+    arm_mpy_t op = {
+        .rd   = rdn,
+        .lhs  = arm_r.r[rdn],
+        .rhs  = arm_r.r[rm],
+        .s    = true
+    };
+
+    return op;
+}
+
+//Processor State
+#define PRIV_MASK   0xf8ff03df
+#define USR_MASK    0xf8ff0000
+#define STATE_MASK  0x01000020
+
+typedef struct {
+    uint8_t  rd;
+    uint32_t psr;
+    uint32_t mask;
+    bool     r;
+} arm_psr_t;
+
+static void arm_psr_to_reg(arm_psr_t op) {
+    arm_flags_sync();
+
+    if (op.r) {
+        arm_spsr_get(&arm_r.r[op.rd]);
+    } else {
+        if ((arm_r.cpsr & 0x1f) == ARM_USR)
+            arm_r.r[op.rd] = arm_r.cpsr & USR_MASK;
+        else
+            arm_r.r[op.rd] = arm_r.cpsr & PRIV_MASK;
+    }
+}
+
+static void arm_reg_to_psr(arm_psr_t op) {
+    uint32_t spsr = 0;
+    uint32_t mask = 0;
+
+    if (op.mask & 1) mask  = 0x000000ff;
+    if (op.mask & 2) mask |= 0x0000ff00;
+    if (op.mask & 4) mask |= 0x00ff0000;
+    if (op.mask & 8) mask |= 0xff000000;
+
+    uint32_t sec_msk;
+
+    if ((arm_r.cpsr & 0x1f) == ARM_USR)
+        sec_msk = USR_MASK;
+    else
+        sec_msk = PRIV_MASK;
+
+    if (op.r) sec_msk |= STATE_MASK;
+
+    mask &= sec_msk;
+
+    op.psr &= mask;
+
+    if (op.r) {
+        arm_spsr_get(&spsr);
+        arm_spsr_set((spsr & ~mask) | op.psr);
+    } else {
+        int8_t curr = arm_r.cpsr & 0x1f;
+        int8_t mode = op.psr     & 0x1f;
+
+        arm_flags_sync();
+
+        arm_r.cpsr &= ~mask;
+        arm_r.cpsr |= op.psr;
+
+        arm_bank_swap(curr, mode);
+
+        arm_check_irq();
+    }
+}
+
+static arm_psr_t arm_mrs_op() {
+    arm_psr_t op = {
+        .rd = (arm_r.op >> 12) & 0xf,
+        .r  = (arm_r.op >> 22) & 0x1
+    };
+
+    return op;
+}
+
+static arm_psr_t arm_msr_imm_op() {
+    arm_data_t data = arm_data_imm_op(false);
+
+    arm_psr_t op = {
+        .psr  = data.rhs,
+        .mask = (arm_r.op >> 16) & 0xf,
+        .r    = (arm_r.op >> 22) & 0x1
+    };
+
+    return op;
+}
+
+static arm_psr_t arm_msr_reg_op() {
+    uint8_t rm   = (arm_r.op >>  0) & 0xf;
+    uint8_t mask = (arm_r.op >> 16) & 0xf;
+    bool    r    = (arm_r.op >> 22) & 0x1;
+
+    arm_psr_t op = {
+        .psr  = arm_r.r[rm],
+        .mask = mask,
+        .r    = r
+    };
+
+    return op;
+}
+
+//Load/Store
+typedef struct {
+    uint16_t regs;
+    uint8_t  rn;
+    uint8_t  rt2;
+    uint8_t  rt;
+    uint32_t addr;
+    int32_t  disp;
+    uint32_t data; //Value to store, read before the base is written back
+} arm_memio_t;
+
+typedef enum {
+    BYTE  = 1,
+    HWORD = 2,
+    WORD  = 4,
+    DWORD = 8
+} arm_size_e;
+
+static uint32_t arm_memio_reg_get(uint8_t reg) {
+    if (reg == 15)
+        return arm_r.r[15] + 4;
+    else
+        return arm_r.r[reg];
+}
+
+static uint8_t arm_memio_count(uint16_t regs) {
+    uint8_t i, cnt = 0;
+
+    for (i = 0; i < 16; i++) {
+        if (regs & (1 << i)) cnt++;
+    }
+
+    return cnt;
+}
+
+//Loads the listed registers from consecutive words
+static void arm_memio_load_regs(uint32_t addr, uint16_t regs) {
+    uint32_t *words = arm_read_words_s(addr, arm_memio_count(regs));
+    uint8_t i;
+
+    for (i = 0; i < 16; i++) {
+        if (regs & (1 << i)) {
+            if (words != NULL)
+                arm_r.r[i] = *words++;
+            else
+                arm_r.r[i] = arm_read_s(addr);
+
+            addr += 4;
+        }
+    }
+}
+
+static void arm_memio_ldm(arm_memio_t op) {
+    arm_r.r[op.rn] += op.disp;
+
+    arm_memio_load_regs(op.addr, op.regs);
+
+    if (op.regs & 0x8000) {
+        arm_r15_align();
+        arm_load_pipe();
+    }
+
+    arm_r.cycles++;
+
+    arm_cycles_s_to_n();
+}
+
+static void arm_memio_ldm_usr(arm_memio_t op) {
+    if (arm_r.op & 0x8000) {
+        arm_memio_ldm(op);
+        arm_spsr_to_cpsr();
+        arm_check_irq();
+    } else {
+        int8_t mode = arm_r.cpsr & 0x1f;
+
+        arm_mode_set(ARM_USR);
+        arm_memio_ldm(op);
+        arm_mode_set(mode);
+    }
+}
+
+static void arm_memio_stm(arm_memio_t op) {
+    uint32_t *words = arm_write_words_s(op.addr, arm_memio_count(op.regs));
+    bool first = true;
+    uint8_t i;
+
+    for (i = 0; i < 16; i++) {
+        if (op.regs & (1 << i)) {
+            if (words != NULL)
+                *words++ = arm_memio_reg_get(i);
+            else
+                arm_write_s(op.addr, arm_memio_reg_get(i));
+
+            if (first) {
+                arm_r.r[op.rn] += op.disp;
+
+                first = false;
+            }
+
+            op.addr += 4;
+        }
+    }
+
+    arm_cycles_s_to_n();
+}
+
+static void arm_memio_stm_usr(arm_memio_t op) {
+    int8_t mode = arm_r.cpsr & 0x1f;
+
+    arm_mode_set(ARM_USR);
+    arm_memio_stm(op);
+    arm_mode_set(mode);
+}
+
+static void arm_memio_ldr(arm_memio_t op) {
+    arm_r.r[op.rt] = arm_read_n(op.addr);
+
+    if (op.rt == 15) {
+        arm_r15_align();
+        arm_load_pipe();
+    }
+
+    arm_r.cycles++;
+
+    arm_cycles_s_to_n();
+}
+
+static void arm_memio_ldrb(arm_memio_t op) {
+    arm_r.r[op.rt] = arm_readb_n(op.addr);
+
+    if (op.rt == 15) {
+        arm_r15_align();
+        arm_load_pipe();
+    }
+
+    arm_r.cycles++;
+
+    arm_cycles_s_to_n();
+}
+
+static void arm_memio_ldrh(arm_memio_t op) {
+    arm_r.r[op.rt] = arm_readh_n(op.addr);
+
+    if (op.rt == 15) {
+        arm_r15_align();
+        arm_load_pipe();
+    }
+
+    arm_r.cycles++;
+
+    arm_cycles_s_to_n();
+}
+
+static void arm_memio_ldrsb(arm_memio_t op) {
+    int32_t value = arm_readb_n(op.addr);
+
+    value <<= 24;
+    value >>= 24;
+
+    arm_r.r[op.rt] = value;
+
+    if (op.rt == 15) {
+        arm_r15_align();
+        arm_load_pipe();
+    }
+
+    arm_r.cycles++;
+
+    arm_cycles_s_to_n();
+}
+
+static void arm_memio_ldrsh(arm_memio_t op) {
+    int32_t value = arm_readh_n(op.addr);
+
+    value <<= (op.addr & 1 ? 24 : 16);
+    value >>= (op.addr & 1 ? 24 : 16);
+
+    arm_r.r[op.rt] = value;
+
+    if (op.rt == 15) {
+        arm_r15_align();
+        arm_load_pipe();
+    }
+
+    arm_r.cycles++;
+
+    arm_cycles_s_to_n();
+}
+
+static void arm_memio_ldrd(arm_memio_t op) {
+    arm_r.r[op.rt]  = arm_read_n(op.addr + 0);
+    arm_r.r[op.rt2] = arm_read_s(op.addr + 4);
+
+    if (op.rt2 == 15) {
+        arm_r15_align();
+        arm_load_pipe();
+    }
+
+    arm_r.cycles++;
+
+    arm_cycles_s_to_n();
+}
+
+static void arm_memio_str(arm_memio_t op) {
+    arm_write_n(op.addr, op.data);
+
+    arm_cycles_s_to_n();
+}
+
+static void arm_memio_strb(arm_memio_t op) {
+    arm_writeb_n(op.addr, op.data);
+
+    arm_cycles_s_to_n();
+}
+
+static void arm_memio_strh(arm_memio_t op) {
+    arm_writeh_n(op.addr, op.data);
+
+    arm_cycles_s_to_n();
+}
+
+static void arm_memio_strd(arm_memio_t op) {
+    arm_write_n(op.addr + 0, arm_memio_reg_get(op.rt));
+    arm_write_s(op.addr + 4, arm_memio_reg_get(op.rt2));
+
+    arm_cycles_s_to_n();
+}
+
+static void arm_memio_load_usr(arm_memio_t op, arm_size_e size) {
+    int8_t mode = arm_r.cpsr & 0x1f;
+
+    arm_mode_set(ARM_USR);
+
+    switch (size) {
+        case BYTE:  arm_memio_ldrb(op); break;
+        case HWORD: arm_memio_ldrh(op); break;
+        case WORD:  arm_memio_ldr(op);  break;
+        case DWORD: arm_memio_ldrd(op); break;
+    }
+
+    arm_mode_set(mode);
+}
+
+static void arm_memio_store_usr(arm_memio_t op, arm_size_e size) {
+    int8_t mode = arm_r.cpsr & 0x1f;
+
+    arm_mode_set(ARM_USR);
+
+    switch (size) {
+        case BYTE:  arm_memio_strb(op); break;
+        case HWORD: arm_memio_strh(op); break;
+        case WORD:  arm_memio_str(op);  break;
+        case DWORD: arm_memio_strd(op); break;
+    }
+
+    arm_mode_set(mode);
+}
+
+static void arm_memio_ldrbt(arm_memio_t op) {
+    arm_memio_load_usr(op, BYTE);
+}
+
+static void arm_memio_strbt(arm_memio_t op) {
+    arm_memio_store_usr(op, BYTE);
+}
+
+static arm_memio_t arm_memio_mult_op() {
+    uint16_t regs = (arm_r.op >>  0) & 0xffff;
+    uint8_t  rn   = (arm_r.op >> 16) & 0xf;
+    bool     w    = (arm_r.op >> 21) & 0x1;
+    bool     u    = (arm_r.op >> 23) & 0x1;
+    bool     p    = (arm_r.op >> 24) & 0x1;
+
+    uint8_t i, cnt = 0;
+
+    for (i = 0; i < 16; i++) {
+        if (regs & (1 << i)) cnt += 4;
+    }
+
+    arm_memio_t op = {
+        .regs = regs,
+        .rn   = rn,
+        .addr = arm_r.r[rn] & ~3
+    };
+
+    if (!u)     op.addr -= cnt;
+    if (u == p) op.addr += 4;
+
+    if (w) {
+        if (u)
+            op.disp =  cnt;
+        else
+            op.disp = -cnt;
+    } else {
+        op.disp = 0;
+    }
+
+    return op;
+}
+
+static arm_memio_t arm_memio_imm_op() {
+    uint16_t imm = (arm_r.op >>  0) & 0xfff;
+    uint8_t  rt  = (arm_r.op >> 12) & 0xf;
+    uint8_t  rn  = (arm_r.op >> 16) & 0xf;
+    bool     w   = (arm_r.op >> 21) & 0x1;
+    bool     u   = (arm_r.op >> 23) & 0x1;
+    bool     p   = (arm_r.op >> 24) & 0x1;
+
+    arm_memio_t op = {
+        .rt   = rt,
+        .addr = arm_r.r[rn],
+        .data = arm_memio_reg_get(rt)
+    };
 
-    if (op.mask & 1) mask  = 0x000000ff;
-    if (op.mask & 2) mask |= 0x0000ff00;
-    if (op.mask & 4) mask |= 0x00ff0000;
-    if (op.mask & 8) mask |= 0xff000000;
+    if (rn == 15) op.addr &= ~3;
 
-    uint32_t sec_msk;
+    int32_t disp;
 
-    if ((arm_r.cpsr & 0x1f) == ARM_USR)
-        sec_msk = USR_MASK;
+    if (u)
+        disp =  imm;
     else
-        sec_msk = PRIV_MASK;
+        disp = -imm;
 
-    if (op.r) sec_msk |= STATE_MASK;
+    if (p)       op.addr     += disp;
+    if (!p || w) arm_r.r[rn] += disp;
 
-    mask &= sec_msk;
+    return op;
+}
 
-    op.psr &= mask;
+static arm_memio_t arm_memio_reg_op() {
+    uint8_t rm   = (arm_r.op >>  0) & 0xf;
+    uint8_t type = (arm_r.op >>  5) & 0x3;
+    uint8_t imm  = (arm_r.op >>  7) & 0x1f;
+    uint8_t rt   = (arm_r.op >> 12) & 0xf;
+    uint8_t rn   = (arm_r.op >> 16) & 0xf;
+    bool    w    = (arm_r.op >> 21) & 0x1;
+    bool    u    = (arm_r.op >> 23) & 0x1;
+    bool    p    = (arm_r.op >> 24) & 0x1;
 
-    if (op.r) {
-        arm_spsr_get(&spsr);
-        arm_spsr_set((spsr & ~mask) | op.psr);
-    } else {
-        int8_t curr = arm_r.cpsr & 0x1f;
-        int8_t mode = op.psr     & 0x1f;
+    arm_memio_t op = {
+        .rt   = rt,
+        .addr = arm_r.r[rn],
+        .data = arm_memio_reg_get(rt)
+    };
 
-        arm_r.cpsr &= ~mask;
-        arm_r.cpsr |= op.psr;
+    if (rn == 15) op.addr &= ~3;
 
-        arm_regs_to_bank(curr);
-        arm_bank_to_regs(mode);
+    arm_shifter_t shift = arm_data_regi(rm, type, imm);
 
-        arm_check_irq();
-    }
-}
+    int32_t disp;
 
-static arm_psr_t arm_mrs_op() {
-    arm_psr_t op = {
-        .rd = (arm_op >> 12) & 0xf,
-        .r  = (arm_op >> 22) & 0x1
-    };
+    if (u)
+        disp =  shift.val;
+    else
+        disp = -shift.val;
+
+    if (p)       op.addr     += disp;
+    if (!p || w) arm_r.r[rn] += disp;
 
     return op;
 }
 
-static arm_psr_t arm_msr_imm_op() {
-    arm_data_t data = arm_data_imm_op();
+static arm_memio_t arm_memio_immt_op() {
+    uint32_t imm = (arm_r.op >>  0) & 0xfff;
+    uint8_t  rt  = (arm_r.op >> 12) & 0xf;
+    uint8_t  rn  = (arm_r.op >> 16) & 0xf;
+    bool     u   = (arm_r.op >> 23) & 0x1;
 
-    arm_psr_t op = {
-        .psr  = data.rhs,
-        .mask = (arm_op >> 16) & 0xf,
-        .r    = (arm_op >> 22) & 0x1
+    arm_memio_t op = {
+        .rt   = rt,
+        .addr = arm_r.r[rn],
+        .data = arm_memio_reg_get(rt)
     };
 
+    if (u)
+        arm_r.r[rn] += imm;
+    else
+        arm_r.r[rn] -= imm;
+
     return op;
 }
 
-static arm_psr_t arm_msr_reg_op() {
-    uint8_t rm   = (arm_op >>  0) & 0xf;
-    uint8_t mask = (arm_op >> 16) & 0xf;
-    bool    r    = (arm_op >> 22) & 0x1;
+static arm_memio_t arm_memio_regt_op() {
+    uint8_t rm   = (arm_r.op >>  0) & 0xf;
+    uint8_t type = (arm_r.op >>  5) & 0x3;
+    uint8_t imm  = (arm_r.op >>  7) & 0x1f;
+    uint8_t rt   = (arm_r.op >> 12) & 0xf;
+    uint8_t rn   = (arm_r.op >> 16) & 0xf;
+    bool    u    = (arm_r.op >> 23) & 0x1;
 
-    arm_psr_t op = {
-        .psr  = arm_r.r[rm],
-        .mask = mask,
-        .r    = r
+    arm_memio_t op = {
+        .rt   = rt,
+        .addr = arm_r.r[rn],
+        .data = arm_memio_reg_get(rt)
     };
 
+    arm_shifter_t shift = arm_data_regi(rm, type, imm);
+
+    if (u)
+        arm_r.r[rn] += shift.val;
+    else
+        arm_r.r[rn] -= shift.val;
+
     return op;
 }
 
-//Load/Store
-typedef struct {
-    uint16_t regs;
-    uint8_t  rn;
-    uint8_t  rt2;
-    uint8_t  rt;
-    uint32_t addr;
-    int32_t  disp;
-} arm_memio_t;
+static arm_memio_t arm_memio_immdh_op() {
+    uint8_t  rt  = (arm_r.op >> 12) & 0xf;
+    uint8_t  rn  = (arm_r.op >> 16) & 0xf;
+    bool     w   = (arm_r.op >> 21) & 0x1;
+    bool     u   = (arm_r.op >> 23) & 0x1;
+    bool     p   = (arm_r.op >> 24) & 0x1;
 
-typedef enum {
-    BYTE  = 1,
-    HWORD = 2,
-    WORD  = 4,
-    DWORD = 8
-} arm_size_e;
+    arm_memio_t op = {
+        .rt   = rt,
+        .rt2  = rt | 1,
+        .addr = arm_r.r[rn],
+        .data = arm_memio_reg_get(rt)
+    };
 
-static uint32_t arm_memio_reg_get(uint8_t reg) {
-    if (reg == 15)
-        return arm_r.r[15] + 4;
+    if (rn == 15) op.addr &= ~3;
+
+    uint16_t imm;
+    int32_t disp;
+
+    imm  = (arm_r.op >> 0) & 0xf;
+    imm |= (arm_r.op >> 4) & 0xf0;
+
+    if (u)
+        disp =  imm;
     else
-        return arm_r.r[reg];
+        disp = -imm;
+
+    if (p)       op.addr     += disp;
+    if (!p || w) arm_r.r[rn] += disp;
+
+    return op;
 }
 
-static void arm_memio_ldm(arm_memio_t op) {
-    uint8_t i;
+static arm_memio_t arm_memio_regdh_op() {
+    uint8_t rm = (arm_r.op >>  0) & 0xf;
+    uint8_t rt = (arm_r.op >> 12) & 0xf;
+    uint8_t rn = (arm_r.op >> 16) & 0xf;
+    bool    w  = (arm_r.op >> 21) & 0x1;
+    bool    u  = (arm_r.op >> 23) & 0x1;
+    bool    p  = (arm_r.op >> 24) & 0x1;
 
-    arm_r.r[op.rn] += op.disp;
+    arm_memio_t op = {
+        .rt   = rt,
+        .rt2  = rt | 1,
+        .addr = arm_r.r[rn],
+        .data = arm_memio_reg_get(rt)
+    };
 
-    for (i = 0; i < 16; i++) {
-        if (op.regs & (1 << i)) {
-            arm_r.r[i] = arm_read_s(op.addr);
+    if (rn == 15) op.addr &= ~3;
 
-            op.addr += 4;
-        }
-    }
+    int32_t disp;
 
-    if (op.regs & 0x8000) {
-        arm_r15_align();
-        arm_load_pipe();
-    }
+    if (u)
+        disp =  arm_r.r[rm];
+    else
+        disp = -arm_r.r[rm];
 
-    arm_cycles++;
+    if (p)       op.addr     += disp;
+    if (!p || w) arm_r.r[rn] += disp;
 
-    arm_cycles_s_to_n();
+    return op;
 }
 
-static void arm_memio_ldm_usr(arm_memio_t op) {
-    if (arm_op & 0x8000) {
-        arm_memio_ldm(op);
-        arm_spsr_to_cpsr();
-        arm_check_irq();
-    } else {
-        int8_t mode = arm_r.cpsr & 0x1f;
+static arm_memio_t t16_memio_mult_op() {
+    uint8_t regs = (arm_r.op >> 0) & 0xff;
+    uint8_t rn   = (arm_r.op >> 8) & 0x7;
 
-        arm_mode_set(ARM_USR);
-        arm_memio_ldm(op);
-        arm_mode_set(mode);
+    uint8_t i, cnt = 0;
+
+    for (i = 0; i < 8; i++) {
+        if (regs & (1 << i)) cnt += 4;
     }
-}
 
-static void arm_memio_stm(arm_memio_t op) {
-    bool first = true;
-    uint8_t i;
+    arm_memio_t op = {
+        .regs = regs,
+        .rn   = rn,
+        .addr = arm_r.r[rn] & ~3,
+        .disp = cnt
+    };
 
-    for (i = 0; i < 16; i++) {
-        if (op.regs & (1 << i)) {
-            arm_write_s(op.addr, arm_memio_reg_get(i));
+    return op;
+}
 
-            if (first) {
-                arm_r.r[op.rn] += op.disp;
+static arm_memio_t t16_memio_imm5_op(int8_t step) {
+    uint8_t rt  = (arm_r.op >> 0) & 0x7;
+    uint8_t imm = (arm_r.op >> 6) & 0x1f;
+    uint8_t rn  = (arm_r.op >> 3) & 0x7;
 
-                first = false;
-            }
+    uint32_t addr = arm_r.r[rn] + imm * step;
 
-            op.addr += 4;
-        }
-    }
+    arm_memio_t op = {
+        .rt   = rt,
+        .addr = addr,
+        .data = arm_r.r[rt]
+    };
 
-    arm_cycles_s_to_n();
+    return op;
 }
 
-static void arm_memio_stm_usr(arm_memio_t op) {
-    int8_t mode = arm_r.cpsr & 0x1f;
+static arm_memio_t t16_memio_imm8sp_op() {
+    uint16_t imm = (arm_r.op << 2) & 0x3fc;
+    uint8_t  rt  = (arm_r.op >> 8) & 0x7;
 
-    arm_mode_set(ARM_USR);
-    arm_memio_stm(op);
-    arm_mode_set(mode);
+    uint32_t addr = arm_r.r[13] + imm;
+
+    arm_memio_t op = {
+        .rt   = rt,
+        .addr = addr,
+        .data = arm_r.r[rt]
+    };
+
+    return op;
 }
 
-static void arm_memio_ldr(arm_memio_t op) {
-    arm_r.r[op.rt] = arm_read_n(op.addr);
+static arm_memio_t t16_memio_imm8pc_op() {
+    uint16_t imm = (arm_r.op << 2) & 0x3fc;
+    uint8_t  rt  = (arm_r.op >> 8) & 0x7;
 
-    if (op.rt == 15) {
-        arm_r15_align();
-        arm_load_pipe();
-    }
+    uint32_t addr = (arm_r.r[15] & ~3) + imm;
 
-    arm_cycles++;
+    arm_memio_t op = {
+        .rt   = rt,
+        .addr = addr,
+        .data = arm_r.r[rt]
+    };
 
-    arm_cycles_s_to_n();
+    return op;
 }
 
-static void arm_memio_ldrb(arm_memio_t op) {
-    arm_r.r[op.rt] = arm_readb_n(op.addr);
+static arm_memio_t t16_memio_reg_op() {
+    uint8_t rt = (arm_r.op >> 0) & 0x7;
+    uint8_t rn = (arm_r.op >> 3) & 0x7;
+    uint8_t rm = (arm_r.op >> 6) & 0x7;
 
-    if (op.rt == 15) {
-        arm_r15_align();
-        arm_load_pipe();
-    }
+    uint32_t addr = arm_r.r[rn] + arm_r.r[rm];
 
-    arm_cycles++;
+    arm_memio_t op = {
+        .rt   = rt,
+        .addr = addr,
+        .data = arm_r.r[rt]
+    };
 
-    arm_cycles_s_to_n();
+    return op;
 }
 
-static void arm_memio_ldrh(arm_memio_t op) {
-    arm_r.r[op.rt] = arm_readh_n(op.addr);
+//Parallel arithmetic
+typedef struct {
+    arm_word lhs;
+    arm_word rhs;
+    uint8_t  rd;
+} arm_parith_t;
 
-    if (op.rt == 15) {
-        arm_r15_align();
-        arm_load_pipe();
-    }
+static void arm_parith_qadd(arm_parith_t op) {
+    int64_t lhs = op.lhs.w;
+    int64_t rhs = op.rhs.w;
 
-    arm_cycles++;
+    arm_r.r[op.rd] = arm_ssatq(lhs + rhs);
+}
 
-    arm_cycles_s_to_n();
+static void arm_parith_qsub(arm_parith_t op) {
+    int64_t lhs = op.lhs.w;
+    int64_t rhs = op.rhs.w;
+
+    arm_r.r[op.rd] = arm_ssatq(lhs - rhs);
 }
 
-static void arm_memio_ldrsb(arm_memio_t op) {
-    int32_t value = arm_readb_n(op.addr);
+static void arm_parith_qdadd(arm_parith_t op) {
+    int64_t lhs = op.lhs.w;
+    int64_t rhs = op.rhs.w;
 
-    value <<= 24;
-    value >>= 24;
+    int32_t doubled = arm_ssatq(rhs << 1);
 
-    arm_r.r[op.rt] = value;
+    arm_r.r[op.rd] = arm_ssatq(lhs + doubled);
+}
 
-    if (op.rt == 15) {
-        arm_r15_align();
-        arm_load_pipe();
-    }
+static void arm_parith_qdsub(arm_parith_t op) {
+    int64_t lhs = op.lhs.w;
+    int64_t rhs = op.rhs.w;
 
-    arm_cycles++;
+    int32_t doubled = arm_ssatq(rhs << 1);
 
-    arm_cycles_s_to_n();
+    arm_r.r[op.rd] = arm_ssatq(lhs - doubled);
 }
 
-static void arm_memio_ldrsh(arm_memio_t op) {
-    int32_t value = arm_readh_n(op.addr);
+static arm_parith_t arm_parith_op() {
+    uint8_t rm = (arm_r.op >>  0) & 0xf;
+    uint8_t rd = (arm_r.op >> 12) & 0xf;
+    uint8_t rn = (arm_r.op >> 16) & 0xf;
 
-    value <<= (op.addr & 1 ? 24 : 16);
-    value >>= (op.addr & 1 ? 24 : 16);
+    arm_parith_t op = {
+        .lhs.w = arm_r.r[rm],
+        .rhs.w = arm_r.r[rn],
+        .rd    = rd
+    };
 
-    arm_r.r[op.rt] = value;
+    return op;
+}
 
-    if (op.rt == 15) {
-        arm_r15_align();
-        arm_load_pipe();
-    }
+/*
+ * ARM Data Processing
+ *
+ * One handler per opcode, operand form, shift type and S bit. Those are all
+ * part of the decode table index, so none of them is looked at at run time.
+ */
 
-    arm_cycles++;
+ARM_INLINE void arm_adc_dp(arm_data_t op) { arm_arith_add(op, ARM_ARITH_CARRY); }
+ARM_INLINE void arm_add_dp(arm_data_t op) { arm_arith_add(op, ARM_ARITH_NO_C);  }
+ARM_INLINE void arm_and_dp(arm_data_t op) { arm_logic(op, AND);                 }
+ARM_INLINE void arm_bic_dp(arm_data_t op) { arm_logic(op, BIC);                 }
+ARM_INLINE void arm_cmn_dp(arm_data_t op) { arm_arith_cmn(op);                  }
+ARM_INLINE void arm_cmp_dp(arm_data_t op) { arm_arith_cmp(op);                  }
+ARM_INLINE void arm_eor_dp(arm_data_t op) { arm_logic(op, EOR);                 }
+ARM_INLINE void arm_mov_dp(arm_data_t op) { arm_logic(op, SHIFT);               }
+ARM_INLINE void arm_mvn_dp(arm_data_t op) { arm_logic(op, MVN);                 }
+ARM_INLINE void arm_orr_dp(arm_data_t op) { arm_logic(op, ORR);                 }
+ARM_INLINE void arm_rsb_dp(arm_data_t op) { arm_arith_rsb(op);                  }
+ARM_INLINE void arm_rsc_dp(arm_data_t op) { arm_arith_rsc(op);                  }
+ARM_INLINE void arm_sbc_dp(arm_data_t op) { arm_arith_sbc(op);                  }
+ARM_INLINE void arm_sub_dp(arm_data_t op) { arm_arith_sub(op);                  }
+ARM_INLINE void arm_teq_dp(arm_data_t op) { arm_logic_teq(op);                  }
+ARM_INLINE void arm_tst_dp(arm_data_t op) { arm_logic_tst(op);                  }
+
+//Name, opcode, uses the shifter carry out
+#define ARM_DP_OPS(Y, X)          \
+    Y(X, arm_adc,  0b0101, false) \
+    Y(X, arm_add,  0b0100, false) \
+    Y(X, arm_and,  0b0000, true)  \
+    Y(X, arm_bic,  0b1110, true)  \
+    Y(X, arm_eor,  0b0001, true)  \
+    Y(X, arm_mov,  0b1101, true)  \
+    Y(X, arm_mvn,  0b1111, true)  \
+    Y(X, arm_orr,  0b1100, true)  \
+    Y(X, arm_rsb,  0b0011, false) \
+    Y(X, arm_rsc,  0b0111, false) \
+    Y(X, arm_sbc,  0b0110, false) \
+    Y(X, arm_sub,  0b0010, false)
+
+//Compare and test, the S bit is always set
+#define ARM_DP_TESTS(Y, X)        \
+    Y(X, arm_cmn,  0b1011, false) \
+    Y(X, arm_cmp,  0b1010, false) \
+    Y(X, arm_teq,  0b1001, true)  \
+    Y(X, arm_tst,  0b1000, true)
+
+#define ARM_DP_DEF_SHIFT(name, logic, sh, type)                                             \
+    static void name##_regi_##sh()     { name##_dp(arm_data_regi_op(type, false, false)); } \
+    static void name##_regi_##sh##_s() { name##_dp(arm_data_regi_op(type, true,  logic)); } \
+    static void name##_regr_##sh()     { name##_dp(arm_data_regr_op(type, false, false)); } \
+    static void name##_regr_##sh##_s() { name##_dp(arm_data_regr_op(type, true,  logic)); }
+
+#define ARM_DP_DEF(X, name, opc, logic)                               \
+    static void name##_imm()   { name##_dp(arm_data_imm_op(false)); } \
+    static void name##_imm_s() { name##_dp(arm_data_imm_op(true));  } \
+    ARM_DP_DEF_SHIFT(name, logic, lsl, 0)                             \
+    ARM_DP_DEF_SHIFT(name, logic, lsr, 1)                             \
+    ARM_DP_DEF_SHIFT(name, logic, asr, 2)                             \
+    ARM_DP_DEF_SHIFT(name, logic, ror, 3)
+
+#define ARM_DP_DEF_TEST_SHIFT(name, logic, sh, type)                                   \
+    static void name##_regi_##sh() { name##_dp(arm_data_regi_op(type, true, logic)); } \
+    static void name##_regr_##sh() { name##_dp(arm_data_regr_op(type, true, logic)); }
+
+#define ARM_DP_DEF_TEST(X, name, opc, logic)                       \
+    static void name##_imm() { name##_dp(arm_data_imm_op(true)); } \
+    ARM_DP_DEF_TEST_SHIFT(name, logic, lsl, 0)                     \
+    ARM_DP_DEF_TEST_SHIFT(name, logic, lsr, 1)                     \
+    ARM_DP_DEF_TEST_SHIFT(name, logic, asr, 2)                     \
+    ARM_DP_DEF_TEST_SHIFT(name, logic, ror, 3)
+
+ARM_DP_OPS(ARM_DP_DEF, _)
+ARM_DP_TESTS(ARM_DP_DEF_TEST, _)
 
-    arm_cycles_s_to_n();
+//Add with Carry
+static void t16_adc_rdn3() {
+    arm_arith_add(t16_data_rdn3_op(), ARM_ARITH_CARRY);
 }
 
-static void arm_memio_ldrd(arm_memio_t op) {
-    arm_r.r[op.rt]  = arm_read_n(op.addr + 0);
-    arm_r.r[op.rt2] = arm_read_s(op.addr + 4);
+//Add
+static void t16_add_imm3() {
+    arm_arith_add(t16_data_imm3_op(), ARM_ARITH_NO_C);
+}
 
-    if (op.rt2 == 15) {
-        arm_r15_align();
-        arm_load_pipe();
-    }
+static void t16_add_imm8() {
+    arm_arith_add(t16_data_imm8_op(), ARM_ARITH_NO_C);
+}
 
-    arm_cycles++;
+static void t16_add_reg() {
+    arm_arith_add(t16_data_reg_op(), ARM_ARITH_NO_C);
+}
 
-    arm_cycles_s_to_n();
+static void t16_add_rdn4() {
+    arm_arith_add(t16_data_rdn4_op(ARM_FLAG_KEEP), ARM_ARITH_NO_C);
 }
 
-static void arm_memio_str(arm_memio_t op) {
-    arm_write_n(op.addr, arm_memio_reg_get(op.rt));
+static void t16_add_sp7() {
+    arm_arith_add(t16_data_imm7sp_op(), ARM_ARITH_NO_C);
+}
 
-    arm_cycles_s_to_n();
+static void t16_add_sp8() {
+    arm_arith_add(t16_data_imm8sp_op(), ARM_ARITH_NO_C);
 }
 
-static void arm_memio_strb(arm_memio_t op) {
-    arm_writeb_n(op.addr, arm_memio_reg_get(op.rt));
+static void t16_adr() {
+    arm_arith_add(t16_data_imm8pc_op(), ARM_ARITH_NO_C);
+}
 
-    arm_cycles_s_to_n();
+//And
+static void t16_and_rdn3() {
+    arm_logic(t16_data_rdn3_op(), AND);
 }
 
-static void arm_memio_strh(arm_memio_t op) {
-    arm_writeh_n(op.addr, arm_memio_reg_get(op.rt));
+//Arithmetic Shift Right
+static void t16_asr_imm5() {
+    arm_asr(t16_data_imm5_op(ARM_SHIFT_RIGHT));
+}
 
-    arm_cycles_s_to_n();
+static void t16_asr_rdn3() {
+    arm_asr(t16_data_rdn3_op());
 }
 
-static void arm_memio_strd(arm_memio_t op) {
-    arm_write_n(op.addr + 0, arm_memio_reg_get(op.rt));
-    arm_write_s(op.addr + 4, arm_memio_reg_get(op.rt2));
+//Branch
+static void arm_b() {
+    int32_t imm = arm_r.op;
 
-    arm_cycles_s_to_n();
+    imm <<= 8;
+    imm >>= 6;
+
+    arm_r.r[15] += imm;
+
+    arm_load_pipe();
+    arm_idle_branch(imm);
 }
 
-static void arm_memio_load_usr(arm_memio_t op, arm_size_e size) {
-    int8_t mode = arm_r.cpsr & 0x1f;
+static void t16_b_imm11() {
+    int32_t imm = arm_r.op;
 
-    arm_mode_set(ARM_USR);
+    imm <<= 21;
+    imm >>= 20;
 
-    switch (size) {
-        case BYTE:  arm_memio_ldrb(op); break;
-        case HWORD: arm_memio_ldrh(op); break;
-        case WORD:  arm_memio_ldr(op);  break;
-        case DWORD: arm_memio_ldrd(op); break;
-    }
+    arm_r.r[15] += imm;
 
-    arm_mode_set(mode);
+    arm_load_pipe();
+    arm_idle_branch(imm);
 }
 
-static void arm_memio_store_usr(arm_memio_t op, arm_size_e size) {
-    int8_t mode = arm_r.cpsr & 0x1f;
+//Thumb Conditional Branches
+static void t16_b_imm8() {
+    int32_t imm = arm_r.op;
 
-    arm_mode_set(ARM_USR);
+    imm <<= 24;
+    imm >>= 23;
 
-    switch (size) {
-        case BYTE:  arm_memio_strb(op); break;
-        case HWORD: arm_memio_strh(op); break;
-        case WORD:  arm_memio_str(op);  break;
-        case DWORD: arm_memio_strd(op); break;
-    }
+    int8_t cond = (arm_r.op >> 8) & 0xf;
 
-    arm_mode_set(mode);
+    if (arm_cond(cond)) {
+        arm_r.r[15] += imm;
+
+        arm_load_pipe();
+        arm_idle_branch(imm);
+    }
 }
 
-static void arm_memio_ldrbt(arm_memio_t op) {
-    arm_memio_load_usr(op, BYTE);
+//Bit Clear
+static void t16_bic_rdn3() {
+    arm_logic(t16_data_rdn3_op(), BIC);
 }
 
-static void arm_memio_strbt(arm_memio_t op) {
-    arm_memio_store_usr(op, BYTE);
+//Breakpoint
+void arm_bkpt() {
+    arm_int(ARM_VEC_PABT, ARM_ABT);
 }
 
-static arm_memio_t arm_memio_mult_op() {
-    uint16_t regs = (arm_op >>  0) & 0xffff;
-    uint8_t  rn   = (arm_op >> 16) & 0xf;
-    bool     w    = (arm_op >> 21) & 0x1;
-    bool     u    = (arm_op >> 23) & 0x1;
-    bool     p    = (arm_op >> 24) & 0x1;
+void t16_bkpt() {
+    arm_int(ARM_VEC_PABT, ARM_ABT);
+}
 
-    uint8_t i, cnt = 0;
+//Branch with Link
+static void arm_bl() {
+    int32_t imm = arm_r.op;
 
-    for (i = 0; i < 16; i++) {
-        if (regs & (1 << i)) cnt += 4;
-    }
+    imm <<= 8;
+    imm >>= 6;
 
-    arm_memio_t op = {
-        .regs = regs,
-        .rn   = rn,
-        .addr = arm_r.r[rn] & ~3
-    };
+    arm_r.r[14] =  arm_r.r[15] - ARM_WORD_SZ;
+    arm_r.r[15] = (arm_r.r[15] & ~3) + imm;
 
-    if (!u)     op.addr -= cnt;
-    if (u == p) op.addr += 4;
+    arm_load_pipe();
+}
 
-    if (w) {
-        if (u)
-            op.disp =  cnt;
-        else
-            op.disp = -cnt;
-    } else {
-        op.disp = 0;
-    }
+//Branch with Link and Exchange
+static void arm_blx_imm() {
+    int32_t imm = arm_r.op;
 
-    return op;
-}
+    imm <<= 8;
+    imm >>= 6;
 
-static arm_memio_t arm_memio_imm_op() {
-    uint16_t imm = (arm_op >>  0) & 0xfff;
-    uint8_t  rt  = (arm_op >> 12) & 0xf;
-    uint8_t  rn  = (arm_op >> 16) & 0xf;
-    bool     w   = (arm_op >> 21) & 0x1;
-    bool     u   = (arm_op >> 23) & 0x1;
-    bool     p   = (arm_op >> 24) & 0x1;
+    imm |= (arm_r.op >> 23) & 2;
 
-    arm_memio_t op = {
-        .rt   = rt,
-        .addr = arm_r.r[rn]
-    };
+    arm_flag_set(ARM_T, true);
 
-    if (rn == 15) op.addr &= ~3;
+    arm_r.r[14]  = arm_r.r[15] - ARM_WORD_SZ;
+    arm_r.r[15] += imm;
 
-    int32_t disp;
+    arm_load_pipe();
+}
 
-    if (u)
-        disp =  imm;
-    else
-        disp = -imm;
+static void arm_blx_reg() {
+    uint8_t rm = arm_r.op & 0xf;
 
-    if (p)       op.addr     += disp;
-    if (!p || w) arm_r.r[rn] += disp;
+    arm_r.r[14] = arm_r.r[15] - ARM_WORD_SZ;
+    arm_r.r[15] = arm_r.r[rm];
 
-    return op;
+    arm_interwork();
 }
 
-static arm_memio_t arm_memio_reg_op() {
-    uint8_t rm   = (arm_op >>  0) & 0xf;
-    uint8_t type = (arm_op >>  5) & 0x3;
-    uint8_t imm  = (arm_op >>  7) & 0x1f;
-    uint8_t rt   = (arm_op >> 12) & 0xf;
-    uint8_t rn   = (arm_op >> 16) & 0xf;
-    bool    w    = (arm_op >> 21) & 0x1;
-    bool    u    = (arm_op >> 23) & 0x1;
-    bool    p    = (arm_op >> 24) & 0x1;
+static void t16_blx() {
+    uint8_t rm = (arm_r.op >> 3) & 0xf;
 
-    arm_memio_t op = {
-        .rt   = rt,
-        .addr = arm_r.r[rn]
-    };
+    arm_r.r[14] = (arm_r.r[15] - ARM_HWORD_SZ) | 1;
+    arm_r.r[15] =  arm_r.r[rm];
 
-    if (rn == 15) op.addr &= ~3;
+    arm_interwork();
+}
 
-    arm_shifter_t shift = arm_data_regi(rm, type, imm);
+static void t16_blx_h2() {
+    int32_t imm = arm_r.op;
 
-    int32_t disp;
+    imm <<= 21;
+    imm >>= 9;
 
-    if (u)
-        disp =  shift.val;
-    else
-        disp = -shift.val;
+    arm_r.r[14]  = arm_r.r[15];
+    arm_r.r[14] += imm;
+}
 
-    if (p)       op.addr     += disp;
-    if (!p || w) arm_r.r[rn] += disp;
+static void t16_blx_lrimm() {
+    uint32_t imm = arm_r.r[14];
 
-    return op;
+    imm += (arm_r.op & 0x7ff) << 1;
+
+    arm_r.r[14] = (arm_r.r[15] - ARM_HWORD_SZ) | 1;
+    arm_r.r[15] = imm & ~1;
 }
 
-static arm_memio_t arm_memio_immt_op() {
-    uint32_t imm = (arm_op >>  0) & 0xfff;
-    uint8_t  rt  = (arm_op >> 12) & 0xf;
-    uint8_t  rn  = (arm_op >> 16) & 0xf;
-    bool     u   = (arm_op >> 23) & 0x1;
+static void t16_blx_h1() {
+    t16_blx_lrimm();
+    arm_interwork();
+}
 
-    arm_memio_t op = {
-        .rt   = rt,
-        .addr = arm_r.r[rn]
-    };
+static void t16_blx_h3() {
+    t16_blx_lrimm();
+    arm_load_pipe();
+}
 
-    if (u)
-        arm_r.r[rn] += imm;
-    else
-        arm_r.r[rn] -= imm;
+//Branch and Exchange
+static void arm_bx() {
+    uint8_t rm = arm_r.op & 0xf;
 
-    return op;
+    arm_r.r[15] = arm_r.r[rm];
+
+    arm_interwork();
 }
 
-static arm_memio_t arm_memio_regt_op() {
-    uint8_t rm   = (arm_op >>  0) & 0xf;
-    uint8_t type = (arm_op >>  5) & 0x3;
-    uint8_t imm  = (arm_op >>  7) & 0x1f;
-    uint8_t rt   = (arm_op >> 12) & 0xf;
-    uint8_t rn   = (arm_op >> 16) & 0xf;
-    bool    u    = (arm_op >> 23) & 0x1;
+static void t16_bx() {
+    uint8_t rm = (arm_r.op >> 3) & 0xf;
 
-    arm_memio_t op = {
-        .rt   = rt,
-        .addr = arm_r.r[rn]
-    };
+    arm_r.r[15] = arm_r.r[rm];
+
+    arm_interwork();
+}
+
+//Coprocessor Data Processing
+static void arm_cdp() {
+    //No coprocessors used
+}
 
-    arm_shifter_t shift = arm_data_regi(rm, type, imm);
+static void arm_cdp2() {
+    //No coprocessors used
+}
 
-    if (u)
-        arm_r.r[rn] += shift.val;
-    else
-        arm_r.r[rn] -= shift.val;
+//Count Leading Zeros
+static void arm_clz() {
+    arm_count_zeros((arm_r.op >> 12) & 0xf);
+}
 
-    return op;
+//Compare Negative
+static void t16_cmn_rdn3() {
+    arm_arith_cmn(t16_data_rdn3_op());
 }
 
-static arm_memio_t arm_memio_immdh_op() {
-    uint8_t  rt  = (arm_op >> 12) & 0xf;
-    uint8_t  rn  = (arm_op >> 16) & 0xf;
-    bool     w   = (arm_op >> 21) & 0x1;
-    bool     u   = (arm_op >> 23) & 0x1;
-    bool     p   = (arm_op >> 24) & 0x1;
+//Compare
+static void t16_cmp_imm8() {
+    arm_arith_cmp(t16_data_imm8_op());
+}
 
-    arm_memio_t op = {
-        .rt   = rt,
-        .rt2  = rt | 1,
-        .addr = arm_r.r[rn]
-    };
+static void t16_cmp_rdn3() {
+    arm_arith_cmp(t16_data_rdn3_op());
+}
 
-    if (rn == 15) op.addr &= ~3;
+static void t16_cmp_rdn4() {
+    arm_arith_cmp(t16_data_rdn4_op(true));
+}
 
-    uint16_t imm;
-    int32_t disp;
+//Exclusive Or
+static void t16_eor_rdn3() {
+    arm_logic(t16_data_rdn3_op(), EOR);
+}
 
-    imm  = (arm_op >> 0) & 0xf;
-    imm |= (arm_op >> 4) & 0xf0;
+//Load Coprocessor
+static void arm_ldc() {
+    //No coprocessors used
+}
 
-    if (u)
-        disp =  imm;
-    else
-        disp = -imm;
+static void arm_ldc2() {
+    //No coprocessors used
+}
 
-    if (p)       op.addr     += disp;
-    if (!p || w) arm_r.r[rn] += disp;
+//Load Multiple
+static void arm_ldm() {
+    arm_memio_ldm(arm_memio_mult_op());
+}
 
-    return op;
+static void arm_ldm_usr() {
+    arm_memio_ldm_usr(arm_memio_mult_op());
 }
 
-static arm_memio_t arm_memio_regdh_op() {
-    uint8_t rm = (arm_op >>  0) & 0xf;
-    uint8_t rt = (arm_op >> 12) & 0xf;
-    uint8_t rn = (arm_op >> 16) & 0xf;
-    bool    w  = (arm_op >> 21) & 0x1;
-    bool    u  = (arm_op >> 23) & 0x1;
-    bool    p  = (arm_op >> 24) & 0x1;
+static void t16_ldm() {
+    arm_memio_ldm(t16_memio_mult_op());
+}
 
-    arm_memio_t op = {
-        .rt   = rt,
-        .rt2  = rt | 1,
-        .addr = arm_r.r[rn]
-    };
+//Load Register
+static void arm_ldr_imm() {
+    arm_memio_ldr(arm_memio_imm_op());
+}
 
-    if (rn == 15) op.addr &= ~3;
+static void arm_ldr_reg() {
+    arm_memio_ldr(arm_memio_reg_op());
+}
 
-    int32_t disp;
+static void t16_ldr_imm5() {
+    arm_memio_ldr(t16_memio_imm5_op(ARM_WORD_SZ));
+}
 
-    if (u)
-        disp =  arm_r.r[rm];
-    else
-        disp = -arm_r.r[rm];
+static void t16_ldr_sp8() {
+    arm_memio_ldr(t16_memio_imm8sp_op());
+}
 
-    if (p)       op.addr     += disp;
-    if (!p || w) arm_r.r[rn] += disp;
+static void t16_ldr_pc8() {
+    arm_memio_ldr(t16_memio_imm8pc_op());
+}
 
-    return op;
+static void t16_ldr_reg() {
+    arm_memio_ldr(t16_memio_reg_op());
 }
 
-static arm_memio_t t16_memio_mult_op() {
-    uint8_t regs = (arm_op >> 0) & 0xff;
-    uint8_t rn   = (arm_op >> 8) & 0x7;
+//Load Register Byte
+static void arm_ldrb_imm() {
+    arm_memio_ldrb(arm_memio_imm_op());
+}
 
-    uint8_t i, cnt = 0;
+static void arm_ldrb_reg() {
+    arm_memio_ldrb(arm_memio_reg_op());
+}
 
-    for (i = 0; i < 8; i++) {
-        if (regs & (1 << i)) cnt += 4;
-    }
+static void t16_ldrb_imm5() {
+    arm_memio_ldrb(t16_memio_imm5_op(ARM_BYTE_SZ));
+}
 
-    arm_memio_t op = {
-        .regs = regs,
-        .rn   = rn,
-        .addr = arm_r.r[rn] & ~3,
-        .disp = cnt
-    };
+static void t16_ldrb_reg() {
+    arm_memio_ldrb(t16_memio_reg_op());
+}
 
-    return op;
+//Load Register Byte Unprivileged
+static void arm_ldrbt_imm() {
+    arm_memio_ldrbt(arm_memio_immt_op());
 }
 
-static arm_memio_t t16_memio_imm5_op(int8_t step) {
-    uint8_t rt  = (arm_op >> 0) & 0x7;
-    uint8_t imm = (arm_op >> 6) & 0x1f;
-    uint8_t rn  = (arm_op >> 3) & 0x7;
+static void arm_ldrbt_reg() {
+    arm_memio_ldrbt(arm_memio_regt_op());
+}
 
-    uint32_t addr = arm_r.r[rn] + imm * step;
+//Load Register Dual
+static void arm_ldrd_imm() {
+    arm_memio_ldrd(arm_memio_immdh_op());
+}
 
-    arm_memio_t op = {
-        .rt   = rt,
-        .addr = addr
-    };
+static void arm_ldrd_reg() {
+    arm_memio_ldrd(arm_memio_regdh_op());
+}
 
-    return op;
+//Load Register Halfword
+static void arm_ldrh_imm() {
+    arm_memio_ldrh(arm_memio_immdh_op());
 }
 
-static arm_memio_t t16_memio_imm8sp_op() {
-    uint16_t imm = (arm_op << 2) & 0x3fc;
-    uint8_t  rt  = (arm_op >> 8) & 0x7;
+static void arm_ldrh_reg() {
+    arm_memio_ldrh(arm_memio_regdh_op());
+}
 
-    uint32_t addr = arm_r.r[13] + imm;
+static void t16_ldrh_imm5() {
+    arm_memio_ldrh(t16_memio_imm5_op(ARM_HWORD_SZ));
+}
 
-    arm_memio_t op = {
-        .rt   = rt,
-        .addr = addr
-    };
+static void t16_ldrh_reg() {
+    arm_memio_ldrh(t16_memio_reg_op());
+}
 
-    return op;
+//Load Register Signed Byte
+static void arm_ldrsb_imm() {
+    arm_memio_ldrsb(arm_memio_immdh_op());
 }
 
-static arm_memio_t t16_memio_imm8pc_op() {
-    uint16_t imm = (arm_op << 2) & 0x3fc;
-    uint8_t  rt  = (arm_op >> 8) & 0x7;
+static void arm_ldrsb_reg() {
+    arm_memio_ldrsb(arm_memio_regdh_op());
+}
 
-    uint32_t addr = (arm_r.r[15] & ~3) + imm;
+static void t16_ldrsb_reg() {
+    arm_memio_ldrsb(t16_memio_reg_op());
+}
 
-    arm_memio_t op = {
-        .rt   = rt,
-        .addr = addr
-    };
+//Load Register Signed Halfword
+static void arm_ldrsh_imm() {
+    arm_memio_ldrsh(arm_memio_immdh_op());
+}
 
-    return op;
+static void arm_ldrsh_reg() {
+    arm_memio_ldrsh(arm_memio_regdh_op());
 }
 
-static arm_memio_t t16_memio_reg_op() {
-    uint8_t rt = (arm_op >> 0) & 0x7;
-    uint8_t rn = (arm_op >> 3) & 0x7;
-    uint8_t rm = (arm_op >> 6) & 0x7;
+static void t16_ldrsh_reg() {
+    arm_memio_ldrsh(t16_memio_reg_op());
+}
 
-    uint32_t addr = arm_r.r[rn] + arm_r.r[rm];
+//Logical Shift Left
+static void t16_lsl_imm5() {
+    arm_lsl(t16_data_imm5_op(ARM_SHIFT_LEFT));
+}
 
-    arm_memio_t op = {
-        .rt   = rt,
-        .addr = addr
-    };
+static void t16_lsl_rdn3() {
+    arm_lsl(t16_data_rdn3_op());
+}
 
-    return op;
+//Logical Shift Right
+static void t16_lsr_imm5() {
+    arm_lsr(t16_data_imm5_op(ARM_SHIFT_RIGHT));
 }
 
-//Parallel arithmetic
-typedef struct {
-    arm_word lhs;
-    arm_word rhs;
-    uint8_t  rd;
-} arm_parith_t;
+static void t16_lsr_rdn3() {
+    arm_lsr(t16_data_rdn3_op());
+}
 
-static void arm_parith_qadd(arm_parith_t op) {
-    int64_t lhs = op.lhs.w;
-    int64_t rhs = op.rhs.w;
+//Move to Coprocessor from Register
+static void arm_mcr() {
+    //No coprocessors used
+}
 
-    arm_r.r[op.rd] = arm_ssatq(lhs + rhs);
+static void arm_mcr2() {
+    //No coprocessors used
 }
 
-static void arm_parith_qsub(arm_parith_t op) {
-    int64_t lhs = op.lhs.w;
-    int64_t rhs = op.rhs.w;
+//Move to Coprocessor from Two Registers
+static void arm_mcrr() {
+    //No coprocessors used
+}
 
-    arm_r.r[op.rd] = arm_ssatq(lhs - rhs);
+static void arm_mcrr2() {
+    //No coprocessors used
 }
 
-static void arm_parith_qdadd(arm_parith_t op) {
-    int64_t lhs = op.lhs.w;
-    int64_t rhs = op.rhs.w;
+//Multiply Add
+static void arm_mla() {
+    arm_mpy_add(arm_mpy_op());
+}
 
-    int32_t doubled = arm_ssatq(rhs << 1);
+//Move
+static void t16_mov_imm() {
+    uint8_t imm = (arm_r.op >> 0) & 0xff;
+    uint8_t rd  = (arm_r.op >> 8) & 0x7;
 
-    arm_r.r[op.rd] = arm_ssatq(lhs + doubled);
+    arm_r.r[rd] = imm;
+
+    arm_flags_defer(ARM_FLAGS_NZ, 0, 0, arm_r.r[rd]);
 }
 
-static void arm_parith_qdsub(arm_parith_t op) {
-    int64_t lhs = op.lhs.w;
-    int64_t rhs = op.rhs.w;
+static void t16_mov_rd4() {
+    uint8_t rm = (arm_r.op >> 3) & 0xf;
 
-    int32_t doubled = arm_ssatq(rhs << 1);
+    uint8_t rd;
 
-    arm_r.r[op.rd] = arm_ssatq(lhs - doubled);
-}
+    rd  = (arm_r.op >> 0) & 7;
+    rd |= (arm_r.op >> 4) & 8;
 
-static arm_parith_t arm_parith_op() {
-    uint8_t rm = (arm_op >>  0) & 0xf;
-    uint8_t rd = (arm_op >> 12) & 0xf;
-    uint8_t rn = (arm_op >> 16) & 0xf;
+    arm_r.r[rd] = arm_r.r[rm];
 
-    arm_parith_t op = {
-        .lhs.w = arm_r.r[rm],
-        .rhs.w = arm_r.r[rn],
-        .rd    = rd
-    };
+    if (rd == 15) {
+        arm_r.r[rd] &= ~1;
 
-    return op;
+        arm_load_pipe();
+    }
 }
 
-//Add with Carry
-static void arm_adc_imm() {
-    arm_arith_add(arm_data_imm_op(), ARM_ARITH_CARRY);
-}
+static void t16_mov_rd3() {
+    int8_t rd = (arm_r.op >> 0) & 7;
+    int8_t rm = (arm_r.op >> 3) & 7;
 
-static void arm_adc_regi() {
-    arm_arith_add(arm_data_regi_op(), ARM_ARITH_CARRY);
+    arm_r.r[rd] = arm_r.r[rm];
+
+    arm_flags_defer(ARM_FLAGS_NZ, 0, 0, arm_r.r[rd]);
 }
 
-static void arm_adc_regr() {
-    arm_arith_add(arm_data_regr_op(), ARM_ARITH_CARRY);
+//Move to Register from Coprocessor
+static void arm_mrc() {
+    //No coprocessors used
 }
 
-static void t16_adc_rdn3() {
-    arm_arith_add(t16_data_rdn3_op(), ARM_ARITH_CARRY);
+static void arm_mrc2() {
+    //No coprocessors used
 }
 
-//Add
-static void arm_add_imm() {
-    arm_arith_add(arm_data_imm_op(), ARM_ARITH_NO_C);
+//Move to Two Registers from Coprocessor
+static void arm_mrrc() {
+    //No coprocessors used
 }
 
-static void arm_add_regi() {
-    arm_arith_add(arm_data_regi_op(), ARM_ARITH_NO_C);
+static void arm_mrrc2() {
+    //No coprocessors used
 }
 
-static void arm_add_regr() {
-    arm_arith_add(arm_data_regr_op(), ARM_ARITH_NO_C);
+//Move to Register from Status
+static void arm_mrs() {
+    arm_psr_to_reg(arm_mrs_op());
 }
 
-static void t16_add_imm3() {
-    arm_arith_add(t16_data_imm3_op(), ARM_ARITH_NO_C);
+//Move to Status from Register (also NOP/SEV)
+static void arm_msr_imm() {
+    arm_reg_to_psr(arm_msr_imm_op());
 }
 
-static void t16_add_imm8() {
-    arm_arith_add(t16_data_imm8_op(), ARM_ARITH_NO_C);
+static void arm_msr_reg() {
+    arm_reg_to_psr(arm_msr_reg_op());
 }
 
-static void t16_add_reg() {
-    arm_arith_add(t16_data_reg_op(), ARM_ARITH_NO_C);
+//Multiply
+static void arm_mul() {
+    arm_mpy(arm_mpy_op());
 }
 
-static void t16_add_rdn4() {
-    arm_arith_add(t16_data_rdn4_op(ARM_FLAG_KEEP), ARM_ARITH_NO_C);
+static void t16_mul() {
+    arm_mpy(t16_mpy_op());
 }
 
-static void t16_add_sp7() {
-    arm_arith_add(t16_data_imm7sp_op(), ARM_ARITH_NO_C);
+//Move Not
+static void t16_mvn_rdn3() {
+    arm_logic(t16_data_rdn3_op(), MVN);
 }
 
-static void t16_add_sp8() {
-    arm_arith_add(t16_data_imm8sp_op(), ARM_ARITH_NO_C);
+//Or
+static void t16_orr_rdn3() {
+    arm_logic(t16_data_rdn3_op(), ORR);
 }
 
-static void t16_adr() {
-    arm_arith_add(t16_data_imm8pc_op(), ARM_ARITH_NO_C);
+//Preload Data
+static void arm_pld_imm() {
+    //Performance oriented instruction, just ignore
 }
 
-//And
-static void arm_and_imm() {
-    arm_logic(arm_data_imm_op(), AND);
+static void arm_pld_reg() {
+    //Performance oriented instruction, just ignore
 }
 
-static void arm_and_regi() {
-    arm_logic(arm_data_regi_op(), AND);
+//Pop
+static void t16_pop() {
+    uint16_t regs;
+
+    regs  = (arm_r.op >> 0) & 0x00ff;
+    regs |= (arm_r.op << 7) & 0x8000;
+
+    arm_r.r[13] &= ~3;
+
+    arm_memio_load_regs(arm_r.r[13], regs);
+
+    arm_r.r[13] += arm_memio_count(regs) * 4;
+
+    if (regs & 0x8000) {
+        arm_r.r[15] &= ~1;
+
+        arm_load_pipe();
+    }
 }
 
-static void arm_and_regr() {
-    arm_logic(arm_data_regr_op(), AND);
+//Push
+static void t16_push() {
+    uint16_t regs;
+
+    regs  = (arm_r.op >> 0) & 0x00ff;
+    regs |= (arm_r.op << 6) & 0x4000;
+
+    uint8_t cnt = arm_memio_count(regs);
+
+    uint32_t addr = (arm_r.r[13] & ~3) - cnt * 4;
+
+    arm_r.r[13] = addr;
+
+    uint32_t *words = arm_write_words_s(addr, cnt);
+
+    uint8_t i;
+
+    for (i = 0; i < 16; i++) {
+        if (regs & (1 << i)) {
+            if (words != NULL)
+                *words++ = arm_memio_reg_get(i);
+            else
+                arm_write_s(addr, arm_memio_reg_get(i));
+
+            addr += 4;
+        }
+    }
 }
 
-static void t16_and_rdn3() {
-    arm_logic(t16_data_rdn3_op(), AND);
+//Saturating Add
+static void arm_qadd() {
+    arm_parith_qadd(arm_parith_op());
 }
 
-//Bit Shift (ASR, LSL, ...)
-static void arm_shift_imm() {
-    arm_logic(arm_data_regi_op(), SHIFT);
+//Saturating Double and Add
+static void arm_qdadd() {
+    arm_parith_qdadd(arm_parith_op());
 }
 
-static void arm_shift_reg() {
-    arm_logic(arm_data_regr_op(), SHIFT);
+//Saturating Double and Subtract
+static void arm_qdsub() {
+    arm_parith_qdsub(arm_parith_op());
 }
 
-//Arithmetic Shift Right
-static void t16_asr_imm5() {
-    arm_asr(t16_data_imm5_op(ARM_SHIFT_RIGHT));
+//Saturating Subtract
+static void arm_qsub() {
+    arm_parith_qsub(arm_parith_op());
 }
 
-static void t16_asr_rdn3() {
-    arm_asr(t16_data_rdn3_op());
+//Rotate Right
+static void t16_ror() {
+    arm_ror(t16_data_rdn3_op());
 }
 
-//Branch
-static void arm_b() {
-    int32_t imm = arm_op;
+//Reverse Subtract
+static void t16_rsb_rdn3() {
+    arm_arith_sub(t16_data_neg_op());
+}
 
-    imm <<= 8;
-    imm >>= 6;
+//Subtract with Carry
+static void t16_sbc_rdn3() {
+    arm_arith_sbc(t16_data_rdn3_op());
+}
 
-    arm_r.r[15] += imm;
+//Signed Multiply Accumulate
+static void arm_smla__() {
+    bool m = (arm_r.op >> 5) & 1;
+    bool n = (arm_r.op >> 6) & 1;
 
-    arm_load_pipe();
+    arm_mpy_smla__(arm_mpy_op(), m, n);
 }
 
-static void t16_b_imm11() {
-    int32_t imm = arm_op;
-
-    imm <<= 21;
-    imm >>= 20;
+//Signed Multiply Accumulate Long
+static void arm_smlal() {
+    arm_mpy_smlal(arm_mpy_op());
+}
 
-    arm_r.r[15] += imm;
+//Signed Multiply Accumulate Long (Halfwords)
+static void arm_smlal__() {
+    bool m = (arm_r.op >> 5) & 1;
+    bool n = (arm_r.op >> 6) & 1;
 
-    arm_load_pipe();
+    arm_mpy_smlal__(arm_mpy_op(), m, n);
 }
 
-//Thumb Conditional Branches
-static void t16_b_imm8() {
-    int32_t imm = arm_op;
+//Signed Multiply Accumulate Word by Halfword
+static void arm_smlaw_() {
+    arm_mpy_smlaw_(arm_mpy_op(), (arm_r.op >> 6) & 1);
+}
 
-    imm <<= 24;
-    imm >>= 23;
+//Signed Multiply
+static void arm_smul() {
+    bool m = (arm_r.op >> 5) & 1;
+    bool n = (arm_r.op >> 6) & 1;
 
-    int8_t cond = (arm_op >> 8) & 0xf;
+    arm_mpy_smul(arm_mpy_op(), m, n);
+}
 
-    if (arm_cond(cond)) {
-        arm_r.r[15] += imm;
+//Signed Multiply Long
+static void arm_smull() {
+    arm_mpy_smull(arm_mpy_op());
+}
 
-        arm_load_pipe();
-    }
+//Signed Multiply Word by Halfword
+static void arm_smulw_() {
+    arm_mpy_smulw_(arm_mpy_op(), (arm_r.op >> 6) & 1);
 }
 
-//Bit Clear
-static void arm_bic_imm() {
-    arm_logic(arm_data_imm_op(), BIC);
+//Store Coprocessor
+static void arm_stc() {
+    //No coprocessors used
 }
 
-static void arm_bic_regi() {
-    arm_logic(arm_data_regi_op(), BIC);
+static void arm_stc2() {
+    //No coprocessors used
 }
 
-static void arm_bic_regr() {
-    arm_logic(arm_data_regr_op(), BIC);
+//Store Multiple
+static void arm_stm() {
+    arm_memio_stm(arm_memio_mult_op());
 }
 
-static void t16_bic_rdn3() {
-    arm_logic(t16_data_rdn3_op(), BIC);
+static void arm_stm_usr() {
+    arm_memio_stm_usr(arm_memio_mult_op());
 }
 
-//Breakpoint
-void arm_bkpt() {
-    arm_int(ARM_VEC_PABT, ARM_ABT);
+static void t16_stm() {
+    arm_memio_stm(t16_memio_mult_op());
 }
 
-void t16_bkpt() {
-    arm_int(ARM_VEC_PABT, ARM_ABT);
+//Store Register
+static void arm_str_imm() {
+    arm_memio_str(arm_memio_imm_op());
 }
 
-//Branch with Link
-static void arm_bl() {
-    int32_t imm = arm_op;
+static void arm_str_reg() {
+    arm_memio_str(arm_memio_reg_op());
+}
 
-    imm <<= 8;
-    imm >>= 6;
+static void t16_str_imm5() {
+    arm_memio_str(t16_memio_imm5_op(ARM_WORD_SZ));
+}
 
-    arm_r.r[14] =  arm_r.r[15] - ARM_WORD_SZ;
-    arm_r.r[15] = (arm_r.r[15] & ~3) + imm;
+static void t16_str_sp8() {
+    arm_memio_str(t16_memio_imm8sp_op());
+}
 
-    arm_load_pipe();
+static void t16_str_reg() {
+    arm_memio_str(t16_memio_reg_op());
 }
 
-//Branch with Link and Exchange
-static void arm_blx_imm() {
-    int32_t imm = arm_op;
+//Store Register Byte
+static void arm_strb_imm() {
+    arm_memio_strb(arm_memio_imm_op());
+}
 
-    imm <<= 8;
-    imm >>= 6;
+static void arm_strb_reg() {
+    arm_memio_strb(arm_memio_reg_op());
+}
 
-    imm |= (arm_op >> 23) & 2;
+static void t16_strb_imm5() {
+    arm_memio_strb(t16_memio_imm5_op(ARM_BYTE_SZ));
+}
 
-    arm_flag_set(ARM_T, true);
+static void t16_strb_reg() {
+    arm_memio_strb(t16_memio_reg_op());
+}
 
-    arm_r.r[14]  = arm_r.r[15] - ARM_WORD_SZ;
-    arm_r.r[15] += imm;
+//Store Register Byte Unprivileged
+static void arm_strbt_imm() {
+    arm_memio_strbt(arm_memio_immt_op());
+}
 
-    arm_load_pipe();
+static void arm_strbt_reg() {
+    arm_memio_strbt(arm_memio_regt_op());
 }
 
-static void arm_blx_reg() {
-    uint8_t rm = arm_op & 0xf;
+//Store Register Dual
+static void arm_strd_imm() {
+    arm_memio_strd(arm_memio_immdh_op());
+}
 
-    arm_r.r[14] = arm_r.r[15] - ARM_WORD_SZ;
-    arm_r.r[15] = arm_r.r[rm];
+static void arm_strd_reg() {
+    arm_memio_strd(arm_memio_regdh_op());
+}
 
-    arm_interwork();
+//Store Register Halfword
+static void arm_strh_imm() {
+    arm_memio_strh(arm_memio_immdh_op());
 }
 
-static void t16_blx() {
-    uint8_t rm = (arm_op >> 3) & 0xf;
+static void arm_strh_reg() {
+    arm_memio_strh(arm_memio_regdh_op());
+}
 
-    arm_r.r[14] = (arm_r.r[15] - ARM_HWORD_SZ) | 1;
-    arm_r.r[15] =  arm_r.r[rm];
+static void t16_strh_imm5() {
+    arm_memio_strh(t16_memio_imm5_op(ARM_HWORD_SZ));
+}
 
-    arm_interwork();
+static void t16_strh_reg() {
+    arm_memio_strh(t16_memio_reg_op());
 }
 
-static void t16_blx_h2() {
-    int32_t imm = arm_op;
+//Subtract
+static void t16_sub_imm3() {
+    arm_arith_sub(t16_data_imm3_op());
+}
 
-    imm <<= 21;
-    imm >>= 9;
+static void t16_sub_imm8() {
+    arm_arith_sub(t16_data_imm8_op());
+}
 
-    arm_r.r[14]  = arm_r.r[15];
-    arm_r.r[14] += imm;
+static void t16_sub_reg() {
+    arm_arith_sub(t16_data_reg_op());
 }
 
-static void t16_blx_lrimm() {
-    uint32_t imm = arm_r.r[14];
+static void t16_sub_sp7() {
+    arm_arith_sub(t16_data_imm7sp_op());
+}
 
-    imm += (arm_op & 0x7ff) << 1;
+//Supervisor Call
+static void arm_svc() {
+    if (bios_hle && bios_swi((arm_r.op >> 16) & 0xff)) return;
 
-    arm_r.r[14] = (arm_r.r[15] - ARM_HWORD_SZ) | 1;
-    arm_r.r[15] = imm & ~1;
+    arm_int(ARM_VEC_SVC, ARM_SVC);
 }
 
-static void t16_blx_h1() {
-    t16_blx_lrimm();
-    arm_interwork();
-}
+static void t16_svc() {
+    if (bios_hle && bios_swi(arm_r.op & 0xff)) return;
 
-static void t16_blx_h3() {
-    t16_blx_lrimm();
-    arm_load_pipe();
+    arm_int(ARM_VEC_SVC, ARM_SVC);
 }
 
-//Branch and Exchange
-static void arm_bx() {
-    uint8_t rm = arm_op & 0xf;
+//Swap
+static void arm_swp() {
+    uint8_t rt2 = (arm_r.op >>  0) & 0xf;
+    uint8_t rt  = (arm_r.op >> 12) & 0xf;
+    uint8_t rn  = (arm_r.op >> 16) & 0xf;
+    bool    b   = (arm_r.op >> 22) & 0x1;
 
-    arm_r.r[15] = arm_r.r[rm];
+    uint32_t val;
 
-    arm_interwork();
-}
+    if (b)
+        val = arm_readb_n(arm_r.r[rn]);
+    else
+        val = arm_read_n(arm_r.r[rn]);
 
-static void t16_bx() {
-    uint8_t rm = (arm_op >> 3) & 0xf;
+    if (b)
+        arm_writeb_n(arm_r.r[rn], arm_r.r[rt2]);
+    else
+        arm_write_n(arm_r.r[rn], arm_r.r[rt2]);
 
-    arm_r.r[15] = arm_r.r[rm];
+    arm_r.r[rt] = val;
 
-    arm_interwork();
+    arm_r.cycles++;
 }
 
-//Coprocessor Data Processing
-static void arm_cdp() {
-    //No coprocessors used
+//Test
+static void t16_tst_rdn3() {
+    arm_logic_tst(t16_data_rdn3_op());
 }
 
-static void arm_cdp2() {
-    //No coprocessors used
+//Unsigned Multiply Accumulate Long
+static void arm_umlal() {
+    arm_mpy_umlal(arm_mpy_op());
 }
 
-//Count Leading Zeros
-static void arm_clz() {
-    arm_count_zeros((arm_op >> 12) & 0xf);
+//Unsigned Multiply Long
+static void arm_umull() {
+    arm_mpy_umull(arm_mpy_op());
 }
 
-//Compare Negative
-static void arm_cmn_imm() {
-    arm_arith_cmn(arm_data_imm_op());
+//Undefined
+static void arm_und() {
+    arm_int(ARM_VEC_UND, ARM_UND);
 }
 
-static void arm_cmn_regi() {
-    arm_arith_cmn(arm_data_regi_op());
-}
+/*
+ * Decode
+ */
 
-static void arm_cmn_regr() {
-    arm_arith_cmn(arm_data_regr_op());
-}
+static void arm_proc_fill(void (**arr)(), void (*proc)(), int32_t size) {
+    int32_t i;
 
-static void t16_cmn_rdn3() {
-    arm_arith_cmn(t16_data_rdn3_op());
+    for (i = 0; i < size; i++) {
+        arr[i] = proc;
+    }
 }
 
-//Compare
-static void arm_cmp_imm() {
-    arm_arith_cmp(arm_data_imm_op());
-}
+static void arm_proc_set(void (**arr)(), void (*proc)(), uint32_t op, uint32_t mask, int32_t bits) {
+    //Bits you need on op needs to be set 1 on mask
+    int32_t i, j;
+    int32_t zbits = 0;
+    int32_t zpos[bits];
 
-static void arm_cmp_regi() {
-    arm_arith_cmp(arm_data_regi_op());
-}
+    for (i = 0; i < bits; i++) {
+        if ((mask & (1 << i)) == 0) zpos[zbits++] = i;
+    }
 
-static void arm_cmp_regr() {
-    arm_arith_cmp(arm_data_regr_op());
-}
+    for (i = 0; i < (1 << zbits); i++) {
+        op &= mask;
 
-static void t16_cmp_imm8() {
-    arm_arith_cmp(t16_data_imm8_op());
-}
+        for (j = 0; j < zbits; j++) {
+            op |= ((i >> j) & 1) << zpos[j];
+        }
 
-static void t16_cmp_rdn3() {
-    arm_arith_cmp(t16_data_rdn3_op());
+        arr[op] = proc;
+    }
 }
 
-static void t16_cmp_rdn4() {
-    arm_arith_cmp(t16_data_rdn4_op(true));
-}
+void (*arm_proc[2][4096])();
+void (*thumb_proc[2048])();
 
-//Exclusive Or
-static void arm_eor_imm() {
-    arm_logic(arm_data_imm_op(), EOR);
-}
+//ROM pre-decode, built lazily for each mode
+#define ARM_ROM_PAGE_SHIFT  12
+#define ARM_ROM_PAGE_SIZE   (1 << ARM_ROM_PAGE_SHIFT)
+#define ARM_ROM_PAGES       (0x2000000 >> ARM_ROM_PAGE_SHIFT)
+
+static void (**arm_rom_proc[2][ARM_ROM_PAGES])();
+
+static uint64_t arm_rom_hits;
+static uint64_t arm_rom_misses;
+static uint32_t arm_rom_pages[2];
+
+//Decode masks, shared by the handler tables and the threaded core
+//Format 27:20,7:4 entries of the data processing handlers
+#define ARM_DP_PROC_SHIFT(X, name, opc, sh, type)                                      \
+    X(name##_regi_##sh,     0b000000000000 | (opc) << 5 | (type) << 1, 0b111111110111) \
+    X(name##_regi_##sh##_s, 0b000000010000 | (opc) << 5 | (type) << 1, 0b111111110111) \
+    X(name##_regr_##sh,     0b000000000001 | (opc) << 5 | (type) << 1, 0b111111111111) \
+    X(name##_regr_##sh##_s, 0b000000010001 | (opc) << 5 | (type) << 1, 0b111111111111)
+
+#define ARM_DP_PROC(X, name, opc, logic)                         \
+    X(name##_imm,   0b001000000000 | (opc) << 5, 0b111111110000) \
+    X(name##_imm_s, 0b001000010000 | (opc) << 5, 0b111111110000) \
+    ARM_DP_PROC_SHIFT(X, name, opc, lsl, 0)                      \
+    ARM_DP_PROC_SHIFT(X, name, opc, lsr, 1)                      \
+    ARM_DP_PROC_SHIFT(X, name, opc, asr, 2)                      \
+    ARM_DP_PROC_SHIFT(X, name, opc, ror, 3)
+
+#define ARM_DP_PROC_TEST_SHIFT(X, name, opc, sh, type)                             \
+    X(name##_regi_##sh, 0b000000010000 | (opc) << 5 | (type) << 1, 0b111111110111) \
+    X(name##_regr_##sh, 0b000000010001 | (opc) << 5 | (type) << 1, 0b111111111111)
+
+#define ARM_DP_PROC_TEST(X, name, opc, logic)                  \
+    X(name##_imm, 0b001000010000 | (opc) << 5, 0b111111110000) \
+    ARM_DP_PROC_TEST_SHIFT(X, name, opc, lsl, 0)               \
+    ARM_DP_PROC_TEST_SHIFT(X, name, opc, lsr, 1)               \
+    ARM_DP_PROC_TEST_SHIFT(X, name, opc, asr, 2)               \
+    ARM_DP_PROC_TEST_SHIFT(X, name, opc, ror, 3)
+
+#define ARM_PROC_COND(X)                              \
+    ARM_DP_OPS(ARM_DP_PROC, X)                        \
+    ARM_DP_TESTS(ARM_DP_PROC_TEST, X)                 \
+    X(arm_b,          0b101000000000, 0b111100000000) \
+    X(arm_bkpt,       0b000100100111, 0b111111111111) \
+    X(arm_bl,         0b101100000000, 0b111100000000) \
+    X(arm_blx_reg,    0b000100100011, 0b111111111111) \
+    X(arm_bx,         0b000100100001, 0b111111111111) \
+    X(arm_cdp,        0b111000000000, 0b111100000001) \
+    X(arm_clz,        0b000101100001, 0b111111111111) \
+    X(arm_ldc,        0b110000010000, 0b111000010000) \
+    X(arm_ldm,        0b100000010000, 0b111001010000) \
+    X(arm_ldm_usr,    0b100001010000, 0b111001010000) \
+    X(arm_ldr_imm,    0b010000010000, 0b111001010000) \
+    X(arm_ldr_reg,    0b011000010000, 0b111001010001) \
+    X(arm_ldrb_imm,   0b010001010000, 0b111001010000) \
+    X(arm_ldrb_reg,   0b011001010000, 0b111001010001) \
+    X(arm_ldrbt_imm,  0b010001110000, 0b111101110000) \
+    X(arm_ldrbt_reg,  0b011001110000, 0b111101110001) \
+    X(arm_ldrd_imm,   0b000001001101, 0b111001011111) \
+    X(arm_ldrd_reg,   0b000000001101, 0b111001011111) \
+    X(arm_ldrh_imm,   0b000001011011, 0b111001011111) \
+    X(arm_ldrh_reg,   0b000000011011, 0b111001011111) \
+    X(arm_ldrsb_imm,  0b000001011101, 0b111001011111) \
+    X(arm_ldrsb_reg,  0b000000011101, 0b111001011111) \
+    X(arm_ldrsh_imm,  0b000001011111, 0b111001011111) \
+    X(arm_ldrsh_reg,  0b000000011111, 0b111001011111) \
+    X(arm_mcr,        0b111000000001, 0b111100010001) \
+    X(arm_mcrr,       0b110001000000, 0b111111110000) \
+    X(arm_mla,        0b000000101001, 0b111111101111) \
+    X(arm_mrc,        0b111000010001, 0b111100010001) \
+    X(arm_mrrc,       0b110001010000, 0b111111110000) \
+    X(arm_mrs,        0b000100000000, 0b111110111111) \
+    X(arm_msr_imm,    0b001100100000, 0b111111110000) \
+    X(arm_msr_reg,    0b000100100000, 0b111110111111) \
+    X(arm_mul,        0b000000001001, 0b111111101111) \
+    X(arm_qadd,       0b000100000101, 0b111111111111) \
+    X(arm_qdadd,      0b000101000101, 0b111111111111) \
+    X(arm_qdsub,      0b000101100101, 0b111111111111) \
+    X(arm_qsub,       0b000100100101, 0b111111111111) \
+    X(arm_smla__,     0b000100001000, 0b111111111001) \
+    X(arm_smlal,      0b000011101001, 0b111111101111) \
+    X(arm_smlal__,    0b000101001000, 0b111111111001) \
+    X(arm_smlaw_,     0b000100101000, 0b111111111011) \
+    X(arm_smul,       0b000101101000, 0b111111111001) \
+    X(arm_smull,      0b000011001001, 0b111111101111) \
+    X(arm_smulw_,     0b000100101010, 0b111111111011) \
+    X(arm_stc,        0b110000000000, 0b111000010000) \
+    X(arm_stm,        0b100000000000, 0b111001010000) \
+    X(arm_stm_usr,    0b100001000000, 0b111001010000) \
+    X(arm_str_imm,    0b010000000000, 0b111001010000) \
+    X(arm_str_reg,    0b011000000000, 0b111001010001) \
+    X(arm_strb_imm,   0b010001000000, 0b111001010000) \
+    X(arm_strb_reg,   0b011001000000, 0b111001010001) \
+    X(arm_strbt_imm,  0b010001100000, 0b111101110000) \
+    X(arm_strbt_reg,  0b011001100000, 0b111101110001) \
+    X(arm_strd_imm,   0b000001001111, 0b111001011111) \
+    X(arm_strd_reg,   0b000000001111, 0b111001011111) \
+    X(arm_strh_imm,   0b000001001011, 0b111001011111) \
+    X(arm_strh_reg,   0b000000001011, 0b111001011111) \
+    X(arm_svc,        0b111100000000, 0b111100000000) \
+    X(arm_swp,        0b000100001001, 0b111110111111) \
+    X(arm_umlal,      0b000010101001, 0b111111101111) \
+    X(arm_umull,      0b000010001001, 0b111111101111)
+
+#define ARM_PROC_UNCOND(X)                            \
+    X(arm_blx_imm,    0b101000000000, 0b111000000000) \
+    X(arm_cdp2,       0b111000000000, 0b111100000001) \
+    X(arm_ldc2,       0b110000010000, 0b111000010000) \
+    X(arm_mcr2,       0b111000000001, 0b111100010001) \
+    X(arm_mcrr2,      0b110001000000, 0b111111110000) \
+    X(arm_mrc2,       0b111000010001, 0b111100010001) \
+    X(arm_mrrc2,      0b110001010000, 0b111111110000) \
+    X(arm_pld_imm,    0b010101010000, 0b111101110000) \
+    X(arm_pld_reg,    0b011101010000, 0b111101110000) \
+    X(arm_stc2,       0b110000000000, 0b111000010000)
+
+#define THUMB_PROC(X)                               \
+    X(t16_adc_rdn3,   0b01000001010, 0b11111111110) \
+    X(t16_add_imm3,   0b00011100000, 0b11111110000) \
+    X(t16_add_imm8,   0b00110000000, 0b11111000000) \
+    X(t16_add_reg,    0b00011000000, 0b11111110000) \
+    X(t16_add_rdn4,   0b01000100000, 0b11111111000) \
+    X(t16_add_sp7,    0b10110000000, 0b11111000000) \
+    X(t16_add_sp8,    0b10101000000, 0b11111000000) \
+    X(t16_adr,        0b10100000000, 0b11111000000) \
+    X(t16_and_rdn3,   0b01000000000, 0b11111111110) \
+    X(t16_asr_imm5,   0b00010000000, 0b11111000000) \
+    X(t16_asr_rdn3,   0b01000001000, 0b11111111110) \
+    X(t16_b_imm8,     0b11010000000, 0b11110000000) \
+    X(t16_b_imm11,    0b11100000000, 0b11111000000) \
+    X(t16_bic_rdn3,   0b01000011100, 0b11111111110) \
+    X(t16_bkpt,       0b10111110000, 0b11111111000) \
+    X(t16_blx,        0b01000111100, 0b11111111100) \
+    X(t16_blx_h1,     0b11101000000, 0b11111000000) \
+    X(t16_blx_h2,     0b11110000000, 0b11111000000) \
+    X(t16_blx_h3,     0b11111000000, 0b11111000000) \
+    X(t16_bx,         0b01000111000, 0b11111111100) \
+    X(t16_cmn_rdn3,   0b01000010110, 0b11111111110) \
+    X(t16_cmp_imm8,   0b00101000000, 0b11111000000) \
+    X(t16_cmp_rdn3,   0b01000010100, 0b11111111110) \
+    X(t16_cmp_rdn4,   0b01000101000, 0b11111111000) \
+    X(t16_eor_rdn3,   0b01000000010, 0b11111111110) \
+    X(t16_ldm,        0b11001000000, 0b11111000000) \
+    X(t16_ldr_imm5,   0b01101000000, 0b11111000000) \
+    X(t16_ldr_sp8,    0b10011000000, 0b11111000000) \
+    X(t16_ldr_pc8,    0b01001000000, 0b11111000000) \
+    X(t16_ldr_reg,    0b01011000000, 0b11111110000) \
+    X(t16_ldrb_imm5,  0b01111000000, 0b11111000000) \
+    X(t16_ldrb_reg,   0b01011100000, 0b11111110000) \
+    X(t16_ldrh_imm5,  0b10001000000, 0b11111000000) \
+    X(t16_ldrh_reg,   0b01011010000, 0b11111110000) \
+    X(t16_ldrsb_reg,  0b01010110000, 0b11111110000) \
+    X(t16_ldrsh_reg,  0b01011110000, 0b11111110000) \
+    X(t16_lsl_imm5,   0b00000000000, 0b11111000000) \
+    X(t16_lsl_rdn3,   0b01000000100, 0b11111111110) \
+    X(t16_lsr_imm5,   0b00001000000, 0b11111000000) \
+    X(t16_lsr_rdn3,   0b01000000110, 0b11111111110) \
+    X(t16_mov_imm,    0b00100000000, 0b11111000000) \
+    X(t16_mov_rd4,    0b01000110000, 0b11111111000) \
+    X(t16_mov_rd3,    0b00000000000, 0b11111111110) \
+    X(t16_mul,        0b01000011010, 0b11111111110) \
+    X(t16_mvn_rdn3,   0b01000011110, 0b11111111110) \
+    X(t16_orr_rdn3,   0b01000011000, 0b11111111110) \
+    X(t16_pop,        0b10111100000, 0b11111110000) \
+    X(t16_push,       0b10110100000, 0b11111110000) \
+    X(t16_ror,        0b01000001110, 0b11111111110) \
+    X(t16_rsb_rdn3,   0b01000010010, 0b11111111110) \
+    X(t16_sbc_rdn3,   0b01000001100, 0b11111111110) \
+    X(t16_stm,        0b11000000000, 0b11111000000) \
+    X(t16_str_imm5,   0b01100000000, 0b11111000000) \
+    X(t16_str_sp8,    0b10010000000, 0b11111000000) \
+    X(t16_str_reg,    0b01010000000, 0b11111110000) \
+    X(t16_strb_imm5,  0b01110000000, 0b11111000000) \
+    X(t16_strb_reg,   0b01010100000, 0b11111110000) \
+    X(t16_strh_imm5,  0b10000000000, 0b11111000000) \
+    X(t16_strh_reg,   0b01010010000, 0b11111110000) \
+    X(t16_sub_imm3,   0b00011110000, 0b11111110000) \
+    X(t16_sub_imm8,   0b00111000000, 0b11111000000) \
+    X(t16_sub_reg,    0b00011010000, 0b11111110000) \
+    X(t16_sub_sp7,    0b10110000100, 0b11111111100) \
+    X(t16_svc,        0b11011111100, 0b11111111000) \
+    X(t16_tst_rdn3,   0b01000010000, 0b11111111110)
+
+#define ARM_PROC_SET_COND(proc, op, mask)    arm_proc_set(arm_proc[0], proc, op, mask, 12);
+#define ARM_PROC_SET_UNCOND(proc, op, mask)  arm_proc_set(arm_proc[1], proc, op, mask, 12);
+#define THUMB_PROC_SET(proc, op, mask)       arm_proc_set(thumb_proc,  proc, op, mask, 11);
 
-static void arm_eor_regi() {
-    arm_logic(arm_data_regi_op(), EOR);
-}
+static void arm_proc_init() {
+    //Format 27:20,7:4
+    arm_proc_fill(arm_proc[0], arm_und, 4096);
+    arm_proc_fill(arm_proc[1], arm_und, 4096);
 
-static void arm_eor_regr() {
-    arm_logic(arm_data_regr_op(), EOR);
-}
+    //Conditional
+    ARM_PROC_COND(ARM_PROC_SET_COND)
 
-static void t16_eor_rdn3() {
-    arm_logic(t16_data_rdn3_op(), EOR);
+    //Unconditional
+    ARM_PROC_UNCOND(ARM_PROC_SET_UNCOND)
 }
 
-//Load Coprocessor
-static void arm_ldc() {
-    //No coprocessors used
-}
+static void thumb_proc_init() {
+    //Format 15:5
+    arm_proc_fill(thumb_proc, arm_und, 2048);
 
-static void arm_ldc2() {
-    //No coprocessors used
+    THUMB_PROC(THUMB_PROC_SET)
 }
 
-//Load Multiple
-static void arm_ldm() {
-    arm_memio_ldm(arm_memio_mult_op());
-}
+/*
+ * Thumb superinstructions
+ *
+ * Common pairs of opcodes on consecutive halfwords run from one handler,
+ * picked when the ROM page or cached block is decoded. The second opcode
+ * only runs when the loop would have gone on to it, so cycles, flags and
+ * interrupt timing are the same as running them one at a time. The set
+ * comes from the --profile-pairs counts.
+ */
 
-static void arm_ldm_usr() {
-    arm_memio_ldm_usr(arm_memio_mult_op());
-}
+#define T16_FUSE(X)                 \
+    X(t16_blx_h2,    t16_blx_h3)    \
+    X(t16_cmp_imm8,  t16_b_imm8)    \
+    X(t16_cmp_rdn3,  t16_b_imm8)    \
+    X(t16_ldr_pc8,   t16_ldrh_imm5) \
+    X(t16_ldr_pc8,   t16_ldr_pc8)   \
+    X(t16_push,      t16_sub_sp7)   \
+    X(t16_push,      t16_pop)       \
+    X(t16_add_sp7,   t16_pop)       \
+    X(t16_pop,       t16_add_sp7)   \
+    X(t16_b_imm8,    t16_mov_imm)   \
+    X(t16_mov_imm,   t16_mov_imm)   \
+    X(t16_mov_rd3,   t16_ldm)       \
+    X(t16_mov_rd3,   t16_stm)
 
-static void t16_ldm() {
-    arm_memio_ldm(t16_memio_mult_op());
-}
+static bool t16_fused; //Set when a pair ran both opcodes
 
-//Load Register
-static void arm_ldr_imm() {
-    arm_memio_ldr(arm_memio_imm_op());
-}
+//Retires the first opcode of a pair and starts the second
+static bool t16_fuse_next() {
+    if (arm_r.pipe_reload || arm_r.int_halt || arm_blk_dirty ||
+        arm_r.cycles >= arm_r.cycles_target) return false;
 
-static void arm_ldr_reg() {
-    arm_memio_ldr(arm_memio_reg_op());
-}
+    arm_pipe_sync();
 
-static void t16_ldr_imm5() {
-    arm_memio_ldr(t16_memio_imm5_op(ARM_WORD_SZ));
-}
+    arm_r.r[15] += ARM_HWORD_SZ;
 
-static void t16_ldr_sp8() {
-    arm_memio_ldr(t16_memio_imm8sp_op());
-}
+    arm_r.cycles_step = arm_r.cycles;
 
-static void t16_ldr_pc8() {
-    arm_memio_ldr(t16_memio_imm8pc_op());
-}
+    arm_r.op      = arm_r.pipe[0];
+    arm_r.pipe[0] = arm_r.pipe[1];
+    arm_r.pipe[1] = arm_fetchh(SEQUENTIAL);
 
-static void t16_ldr_reg() {
-    arm_memio_ldr(t16_memio_reg_op());
-}
+    t16_fused = true;
 
-//Load Register Byte
-static void arm_ldrb_imm() {
-    arm_memio_ldrb(arm_memio_imm_op());
+    return true;
 }
 
-static void arm_ldrb_reg() {
-    arm_memio_ldrb(arm_memio_reg_op());
-}
+#define T16_FUSE_PROC(fst, snd)       \
+    static void fst##__##snd() {      \
+        fst();                        \
+                                      \
+        if (t16_fuse_next()) snd();   \
+    }
 
-static void t16_ldrb_imm5() {
-    arm_memio_ldrb(t16_memio_imm5_op(ARM_BYTE_SZ));
-}
+T16_FUSE(T16_FUSE_PROC)
 
-static void t16_ldrb_reg() {
-    arm_memio_ldrb(t16_memio_reg_op());
-}
+#define T16_FUSE_GET(fst, snd)  if (proc == fst && next == snd) return fst##__##snd;
 
-//Load Register Byte Unprivileged
-static void arm_ldrbt_imm() {
-    arm_memio_ldrbt(arm_memio_immt_op());
-}
+//Handler for the opcode followed by the one with the next handler
+static void (*t16_fuse_get(void (*proc)(), void (*next)()))() {
+    if (arm_fuse_enb) {
+        T16_FUSE(T16_FUSE_GET)
+    }
 
-static void arm_ldrbt_reg() {
-    arm_memio_ldrbt(arm_memio_regt_op());
+    return proc;
 }
 
-//Load Register Dual
-static void arm_ldrd_imm() {
-    arm_memio_ldrd(arm_memio_immdh_op());
-}
+static void arm_rom_decode(uint32_t page, bool thumb) {
+    uint32_t count = ARM_ROM_PAGE_SIZE >> (thumb ? 1 : 2);
+    uint32_t base  = page << ARM_ROM_PAGE_SHIFT;
+    uint32_t i;
 
-static void arm_ldrd_reg() {
-    arm_memio_ldrd(arm_memio_regdh_op());
-}
+    void (**proc)() = malloc(count * sizeof(*proc));
 
-//Load Register Halfword
-static void arm_ldrh_imm() {
-    arm_memio_ldrh(arm_memio_immdh_op());
-}
+    for (i = 0; i < count; i++) {
+        if (thumb) {
+            uint16_t op = *(uint16_t *)(rom + base + i * 2);
 
-static void arm_ldrh_reg() {
-    arm_memio_ldrh(arm_memio_regdh_op());
-}
+            proc[i] = thumb_proc[op >> 5];
+        } else {
+            uint32_t op = *(uint32_t *)(rom + base + i * 4);
+            uint32_t idx;
 
-static void t16_ldrh_imm5() {
-    arm_memio_ldrh(t16_memio_imm5_op(ARM_HWORD_SZ));
-}
+            idx  = (op >> 16) & 0xff0;
+            idx |= (op >>  4) & 0x00f;
 
-static void t16_ldrh_reg() {
-    arm_memio_ldrh(t16_memio_reg_op());
-}
+            proc[i] = arm_proc[(op >> 28) == 0xf][idx];
+        }
+    }
 
-//Load Register Signed Byte
-static void arm_ldrsb_imm() {
-    arm_memio_ldrsb(arm_memio_immdh_op());
-}
+    //Pairs end on the page, the next one may not be decoded
+    if (thumb) {
+        for (i = 0; i + 1 < count; i++)
+            proc[i] = t16_fuse_get(proc[i], thumb_proc[*(uint16_t *)(rom + base + i * 2 + 2) >> 5]);
+    }
 
-static void arm_ldrsb_reg() {
-    arm_memio_ldrsb(arm_memio_regdh_op());
+    arm_rom_proc[thumb][page] = proc;
+    arm_rom_pages[thumb]++;
 }
 
-static void t16_ldrsb_reg() {
-    arm_memio_ldrsb(t16_memio_reg_op());
-}
+void arm_rom_decode_all() {
+    uint32_t page;
 
-//Load Register Signed Halfword
-static void arm_ldrsh_imm() {
-    arm_memio_ldrsh(arm_memio_immdh_op());
-}
+    for (page = 0; page < ARM_ROM_PAGES; page++) {
+        if ((page << ARM_ROM_PAGE_SHIFT) >= cart_rom_size) break;
 
-static void arm_ldrsh_reg() {
-    arm_memio_ldrsh(arm_memio_regdh_op());
+        if (arm_rom_proc[0][page] == NULL) arm_rom_decode(page, false);
+        if (arm_rom_proc[1][page] == NULL) arm_rom_decode(page, true);
+    }
 }
 
-static void t16_ldrsh_reg() {
-    arm_memio_ldrsh(t16_memio_reg_op());
-}
+void arm_rom_stats() {
+    uint32_t arm_kb   = (arm_rom_pages[0] * (ARM_ROM_PAGE_SIZE >> 2) * sizeof(void *)) >> 10;
+    uint32_t thumb_kb = (arm_rom_pages[1] * (ARM_ROM_PAGE_SIZE >> 1) * sizeof(void *)) >> 10;
 
-//Logical Shift Left
-static void t16_lsl_imm5() {
-    arm_lsl(t16_data_imm5_op(ARM_SHIFT_LEFT));
-}
+    uint64_t total = arm_rom_hits + arm_rom_misses;
 
-static void t16_lsl_rdn3() {
-    arm_lsl(t16_data_rdn3_op());
-}
+    printf("ROM pre-decode: %u ARM pages (%u KiB), %u Thumb pages (%u KiB)\n",
+        arm_rom_pages[0], arm_kb,
+        arm_rom_pages[1], thumb_kb);
 
-//Logical Shift Right
-static void t16_lsr_imm5() {
-    arm_lsr(t16_data_imm5_op(ARM_SHIFT_RIGHT));
+    printf("ROM pre-decode: %llu hits, %llu misses (%.2f%% hit rate)\n",
+        (unsigned long long)arm_rom_hits,
+        (unsigned long long)arm_rom_misses,
+        total ? (arm_rom_hits * 100.0) / total : 0.0);
 }
 
-static void t16_lsr_rdn3() {
-    arm_lsr(t16_data_rdn3_op());
+void arm_copy_stats() {
+    printf("Copy loops: %llu runs, %llu bytes moved\n",
+        (unsigned long long)arm_copy_runs,
+        (unsigned long long)arm_copy_bytes);
 }
 
-//Move to Coprocessor from Register
-static void arm_mcr() {
-    //No coprocessors used
+void arm_idle_stats() {
+    printf("Idle loops: %llu skips, %llu cycles skipped\n",
+        (unsigned long long)arm_idle_skips,
+        (unsigned long long)arm_idle_cycles);
 }
 
-static void arm_mcr2() {
-    //No coprocessors used
-}
+/*
+ * Thumb opcode pair profile
+ *
+ * Counts how often each handler runs right after another one on the
+ * next halfword, to find the pairs worth fusing into a single handler.
+ * Only opcodes run one at a time by the interpreter are seen.
+ */
 
-//Move to Coprocessor from Two Registers
-static void arm_mcrr() {
-    //No coprocessors used
-}
+#define T16_PAIR_ID(proc, op, mask)    proc##_id,
+#define T16_PAIR_NAME(proc, op, mask)  #proc,
+#define T16_PAIR_SET(proc, op, mask)   if (thumb_proc[i] == proc) t16_pair_id[i] = proc##_id;
+
+typedef enum {
+    THUMB_PROC(T16_PAIR_ID)
+    T16_PAIR_UND,
+    T16_PAIR_PROCS
+} t16_pair_id_e;
 
-static void arm_mcrr2() {
-    //No coprocessors used
-}
+static const char *const t16_pair_name[] = {
+    THUMB_PROC(T16_PAIR_NAME)
+    "arm_und"
+};
 
-//Multiply Add
-static void arm_mla() {
-    arm_mpy_add(arm_mpy_op());
-}
+#define T16_PAIR_TOP  32
 
-//Move
-static void arm_mov_imm12() {
-    arm_data_t op = arm_data_imm_op();
+static uint8_t  t16_pair_id[2048];
+static uint64_t t16_pair_hits[T16_PAIR_PROCS][T16_PAIR_PROCS];
+static uint64_t t16_pair_total;
 
-    arm_r.r[op.rd] = op.rhs;
+static uint8_t  t16_pair_last = T16_PAIR_PROCS;
+static uint32_t t16_pair_pc;
 
-    arm_logic_set(op, op.rhs);
+static void t16_pair_init() {
+    uint32_t i;
+
+    for (i = 0; i < 2048; i++) {
+        t16_pair_id[i] = T16_PAIR_UND;
+
+        THUMB_PROC(T16_PAIR_SET)
+    }
 }
 
-static void t16_mov_imm() {
-    uint8_t imm = (arm_op >> 0) & 0xff;
-    uint8_t rd  = (arm_op >> 8) & 0x7;
+//Called with the opcode about to run, before R15 moves past it
+static void t16_pair_count(uint16_t op) {
+    uint8_t id = t16_pair_id[op >> 5];
 
-    arm_r.r[rd] = imm;
+    //Only pairs on consecutive halfwords can be fused
+    if (t16_pair_last < T16_PAIR_PROCS && arm_r.r[15] == t16_pair_pc + 2) {
+        t16_pair_hits[t16_pair_last][id]++;
+        t16_pair_total++;
+    }
 
-    arm_setn(arm_r.r[rd]);
-    arm_setz(arm_r.r[rd]);
+    t16_pair_last = id;
+    t16_pair_pc   = arm_r.r[15];
 }
 
-static void t16_mov_rd4() {
-    uint8_t rm = (arm_op >> 3) & 0xf;
+void arm_pair_stats() {
+    bool shown[T16_PAIR_PROCS][T16_PAIR_PROCS] = { { false } };
 
-    uint8_t rd;
+    uint32_t n;
 
-    rd  = (arm_op >> 0) & 7;
-    rd |= (arm_op >> 4) & 8;
+    printf("Thumb opcode pairs: %llu counted, most frequent:\n",
+        (unsigned long long)t16_pair_total);
 
-    arm_r.r[rd] = arm_r.r[rm];
+    for (n = 0; n < T16_PAIR_TOP; n++) {
+        uint64_t best = 0;
+        uint8_t  fst  = 0;
+        uint8_t  snd  = 0;
+        uint8_t  i, j;
 
-    if (rd == 15) {
-        arm_r.r[rd] &= ~1;
+        for (i = 0; i < T16_PAIR_PROCS; i++) {
+            for (j = 0; j < T16_PAIR_PROCS; j++) {
+                if (!shown[i][j] && t16_pair_hits[i][j] > best) {
+                    best = t16_pair_hits[i][j];
+                    fst  = i;
+                    snd  = j;
+                }
+            }
+        }
 
-        arm_load_pipe();
+        if (best == 0) break;
+
+        shown[fst][snd] = true;
+
+        printf("%3u %-16s %-16s %12llu %6.2f%%\n", n + 1,
+            t16_pair_name[fst],
+            t16_pair_name[snd],
+            (unsigned long long)best,
+            (best * 100.0) / t16_pair_total);
     }
 }
 
-static void t16_mov_rd3() {
-    int8_t rd = (arm_op >> 0) & 7;
-    int8_t rm = (arm_op >> 3) & 7;
+void arm_init() {
+    wram   = malloc(0x40000);
+    iwram  = malloc(0x8000);
+    pram   = malloc(0x400);
+    vram   = malloc(0x18000);
+    oam    = malloc(0x400);
+    eeprom = malloc(0x2000);
+    sram   = malloc(0x10000);
+    flash  = malloc(0x20000);
 
-    arm_r.r[rd] = arm_r.r[rm];
+    arm_proc_init();
+    thumb_proc_init();
+    t16_pair_init();
 
-    arm_setn(arm_r.r[rd]);
-    arm_setz(arm_r.r[rd]);
-}
+    key_input.w = 0x3ff;
+    wait_cnt.w  = 0;
+    arm_r.cycles  = 0;
+    arm_blk_enb  = true;
+    arm_rom_enb  = true;
+    arm_fuse_enb = true;
+    arm_idle_enb = true;
+    arm_copy_enb = true;
 
-//Move to Register from Coprocessor
-static void arm_mrc() {
-    //No coprocessors used
+    update_ws();
 }
 
-static void arm_mrc2() {
-    //No coprocessors used
-}
+void arm_uninit() {
+    free(wram);
+    free(iwram);
+    free(pram);
+    free(vram);
+    free(oam);
+    free(eeprom);
+    free(sram);
+    free(flash);
 
-//Move to Two Registers from Coprocessor
-static void arm_mrrc() {
-    //No coprocessors used
-}
+    uint32_t page;
 
-static void arm_mrrc2() {
-    //No coprocessors used
+    for (page = 0; page < ARM_ROM_PAGES; page++) {
+        free(arm_rom_proc[0][page]);
+        free(arm_rom_proc[1][page]);
+    }
 }
 
-//Move to Register from Status
-static void arm_mrs() {
-    arm_psr_to_reg(arm_mrs_op());
-}
+#define ARM_COND_UNCOND  0b1111
 
-//Move to Status from Register (also NOP/SEV)
-static void arm_msr_imm() {
-    arm_reg_to_psr(arm_msr_imm_op());
+#ifndef ARM_THREADED
+static void t16_inc_r15() {
+    if (arm_r.pipe_reload)
+        arm_r.pipe_reload = false;
+    else
+        arm_r.r[15] += 2;
 }
 
-static void arm_msr_reg() {
-    arm_reg_to_psr(arm_msr_reg_op());
-}
+static void t16_step() {
+    arm_r.pipe[1] = arm_fetchh(SEQUENTIAL);
 
-//Multiply
-static void arm_mul() {
-    arm_mpy(arm_mpy_op());
-}
+    if (arm_pair_enb) t16_pair_count(arm_r.op);
 
-static void t16_mul() {
-    arm_mpy(t16_mpy_op());
-}
+    thumb_proc[arm_r.op >> 5]();
 
-//Move Not
-static void arm_mvn_imm() {
-    arm_logic(arm_data_imm_op(), MVN);
+    t16_inc_r15();
 }
 
-static void arm_mvn_regi() {
-    arm_logic(arm_data_regi_op(), MVN);
+static void arm_inc_r15() {
+    if (arm_r.pipe_reload)
+        arm_r.pipe_reload = false;
+    else
+        arm_r.r[15] += 4;
 }
 
-static void arm_mvn_regr() {
-    arm_logic(arm_data_regr_op(), MVN);
-}
+static void arm_step() {
+    arm_r.pipe[1] = arm_fetch(SEQUENTIAL);
 
-static void t16_mvn_rdn3() {
-    arm_logic(t16_data_rdn3_op(), MVN);
-}
+    uint32_t proc;
 
-//Or
-static void arm_orr_imm() {
-    arm_logic(arm_data_imm_op(), ORR);
-}
+    proc  = (arm_r.op >> 16) & 0xff0;
+    proc |= (arm_r.op >>  4) & 0x00f;
 
-static void arm_orr_regi() {
-    arm_logic(arm_data_regi_op(), ORR);
-}
+    int8_t cond = arm_r.op >> 28;
 
-static void arm_orr_regr() {
-    arm_logic(arm_data_regr_op(), ORR);
-}
+    if (cond == ARM_COND_UNCOND)
+        arm_proc[1][proc]();
+    else if (arm_cond(cond))
+        arm_proc[0][proc]();
 
-static void t16_orr_rdn3() {
-    arm_logic(t16_data_rdn3_op(), ORR);
+    arm_inc_r15();
 }
+#endif
 
-//Preload Data
-static void arm_pld_imm() {
-    //Performance oriented instruction, just ignore
-}
+/*
+ * Block cache
+ */
 
-static void arm_pld_reg() {
-    //Performance oriented instruction, just ignore
-}
+#define ARM_BLK_COUNT  4096
+#define ARM_BLK_LEN    32
 
-//Pop
-static void t16_pop() {
-    uint16_t regs;
+typedef struct {
+    void (*proc)();
+    int8_t cond;
+} arm_blk_op_t;
 
-    regs  = (arm_op >> 0) & 0x00ff;
-    regs |= (arm_op << 7) & 0x8000;
+typedef struct {
+    uint32_t pc; //R15 on entry, bit 0 set on Thumb
+    uint8_t  len;
+    bool     bios;
 
-    uint8_t i;
+    const uint8_t *cycles;
 
-    arm_r.r[13] &= ~3;
+    uint16_t page[2];
+    uint32_t gen[2];
 
-    for (i = 0; i < 16; i++) {
-        if (regs & (1 << i)) {
-            arm_r.r[i] = arm_read_s(arm_r.r[13]);
+    uint32_t     op[ARM_BLK_LEN + 2];
+    arm_blk_op_t proc[ARM_BLK_LEN];
+} arm_blk_t;
 
-            arm_r.r[13] += 4;
+static arm_blk_t arm_blk[ARM_BLK_COUNT];
+
+static const uint8_t arm_blk_cyc_one = 1;
+
+void arm_blk_inval(uint32_t page) {
+    arm_blk_map[page >> 5] &= ~(1 << (page & 31));
+
+    arm_blk_gen[page]++;
+
+    arm_blk_dirty = true;
+}
+
+//Drops every cached and compiled block, ROM ones included
+void arm_blk_flush() {
+    uint32_t page;
+
+    for (page = 0; page <= ARM_BLK_PAGES; page++) arm_blk_gen[page]++;
+
+    arm_blk_dirty = true;
+}
+
+bool arm_blk_end(uint32_t op, bool thumb) {
+    if (thumb) {
+        switch (op >> 11) {
+            case 0b11011: return ((op >> 8) & 0xf) == 0xf; //SVC
+            case 0b11100: return true; //B
+            case 0b11101: return true; //BLX (suffix)
+            case 0b11111: return true; //BL (suffix)
         }
+
+        //BX/BLX, MOV/ADD with PC as destination and POP {PC}
+        return (op & 0xfc87) == 0x4487 ||
+               (op & 0xff00) == 0x4700 ||
+               (op & 0xff00) == 0xbd00;
     }
 
-    if (regs & 0x8000) {
-        arm_r.r[15] &= ~1;
+    if ((op >> 28) < ARM_COND_AL) return false;
 
-        arm_load_pipe();
-    }
+    //B/BL/BLX, SVC, LDM with PC and anything with PC as destination
+    return (op & 0x0e000000) == 0x0a000000 ||
+           (op & 0x0f000000) == 0x0f000000 ||
+           (op & 0x0e108000) == 0x08108000 ||
+           (op & 0x0ffffff0) == 0x012fff10 ||
+           (op & 0x0000f000) == 0x0000f000;
 }
 
-//Push
-static void t16_push() {
-    uint16_t regs;
+static void arm_blk_build(arm_blk_t *blk, uint32_t pc) {
+    bool     thumb = pc & 1;
+    uint8_t  size  = thumb ? ARM_HWORD_SZ : ARM_WORD_SZ;
+    uint32_t addr  = (pc & ~1) - size * 2;
+    uint32_t page  = ARM_BLK_PAGES;
+    uint32_t mask;
+    uint8_t *mem;
 
-    regs  = (arm_op >> 0) & 0x00ff;
-    regs |= (arm_op << 6) & 0x4000;
+    blk->pc   = pc;
+    blk->len  = 0;
+    blk->bios = false;
 
-    uint32_t addr = arm_r.r[13] & ~3;
+    if ((addr >> 24) != (pc >> 24)) return;
 
-    uint8_t i;
+    switch (pc >> 24) {
+        case 0x0:
+            mem  = bios;
+            mask = 0x3fff;
 
-    for (i = 0; i < 16; i++) {
-        if (regs & (1 << i)) addr -= 4;
-    }
+            blk->cycles = &arm_blk_cyc_one;
+            blk->bios   = true;
+        break;
 
-    arm_r.r[13] = addr;
+        case 0x2:
+            mem  = wram;
+            mask = 0x3ffff;
+            page = 0;
 
-    for (i = 0; i < 16; i++) {
-        if (regs & (1 << i)) {
-            arm_write_s(addr, arm_memio_reg_get(i));
+            blk->cycles = &ws_wram_fetch[thumb ? 0 : 1];
+        break;
 
-            addr += 4;
-        }
-    }
-}
+        case 0x3:
+            mem  = iwram;
+            mask = 0x7fff;
+            page = ARM_BLK_WRAM_PAGES;
 
-//Saturating Add
-static void arm_qadd() {
-    arm_parith_qadd(arm_parith_op());
-}
+            blk->cycles = &arm_blk_cyc_one;
+        break;
 
-//Saturating Double and Add
-static void arm_qdadd() {
-    arm_parith_qdadd(arm_parith_op());
-}
+        case 0x8:
+        case 0x9:
+        case 0xa:
+        case 0xb:
+        case 0xc:
+        case 0xd:
+            mem  = rom;
+            mask = 0x1ffffff;
 
-//Saturating Double and Subtract
-static void arm_qdsub() {
-    arm_parith_qdsub(arm_parith_op());
-}
+            if (thumb)
+                blk->cycles = &ws_s_t16[(pc >> 25) & 3];
+            else
+                blk->cycles = &ws_s_arm[(pc >> 25) & 3];
+        break;
 
-//Saturating Subtract
-static void arm_qsub() {
-    arm_parith_qsub(arm_parith_op());
-}
+        default: return;
+    }
 
-//Rotate Right
-static void t16_ror() {
-    arm_ror(t16_data_rdn3_op());
-}
+    uint8_t i, n;
 
-//Reverse Subtract
-static void arm_rsb_imm() {
-    arm_arith_rsb(arm_data_imm_op());
-}
+    for (n = 0; n < ARM_BLK_LEN + 2; n++) {
+        uint32_t a = addr + n * size;
 
-static void arm_rsb_regi() {
-    arm_arith_rsb(arm_data_regi_op());
-}
+        if ((a >> 24) != (pc >> 24)) break;
 
-static void arm_rsb_regr() {
-    arm_arith_rsb(arm_data_regr_op());
-}
+        if (thumb)
+            blk->op[n] = *(uint16_t *)(mem + (a & mask));
+        else
+            blk->op[n] = *(uint32_t *)(mem + (a & mask));
+    }
 
-static void t16_rsb_rdn3() {
-    arm_arith_sub(t16_data_neg_op());
-}
+    for (i = 0; i + 2 < n; i++) {
+        uint32_t op = blk->op[i];
 
-//Reverse Subtract with Carry
-static void arm_rsc_imm() {
-    arm_arith_rsc(arm_data_imm_op());
-}
+        if (thumb) {
+            blk->proc[i].proc = thumb_proc[op >> 5];
+            blk->proc[i].cond = ARM_COND_AL;
+        } else {
+            uint32_t proc;
 
-static void arm_rsc_regi() {
-    arm_arith_rsc(arm_data_regi_op());
-}
+            proc  = (op >> 16) & 0xff0;
+            proc |= (op >>  4) & 0x00f;
 
-static void arm_rsc_regr() {
-    arm_arith_rsc(arm_data_regr_op());
-}
+            int8_t cond = op >> 28;
 
-//Subtract with Carry
-static void arm_sbc_imm() {
-    arm_arith_sbc(arm_data_imm_op());
-}
+            if (cond == ARM_COND_UNCOND) {
+                blk->proc[i].proc = arm_proc[1][proc];
+                blk->proc[i].cond = ARM_COND_AL;
+            } else {
+                blk->proc[i].proc = arm_proc[0][proc];
+                blk->proc[i].cond = cond;
+            }
+        }
 
-static void arm_sbc_regi() {
-    arm_arith_sbc(arm_data_regi_op());
-}
+        blk->len++;
 
-static void arm_sbc_regr() {
-    arm_arith_sbc(arm_data_regr_op());
-}
+        if (arm_blk_end(op, thumb)) break;
+    }
 
-static void t16_sbc_rdn3() {
-    arm_arith_sbc(t16_data_rdn3_op());
-}
+    if (thumb) {
+        for (i = 0; i + 1 < blk->len; i++)
+            blk->proc[i].proc = t16_fuse_get(blk->proc[i].proc, blk->proc[i + 1].proc);
+    }
 
-//Signed Multiply Accumulate
-static void arm_smla__() {
-    bool m = (arm_op >> 5) & 1;
-    bool n = (arm_op >> 6) & 1;
+    //Blocks are smaller than a page, so they can span at most 2 pages
+    blk->page[0] = page;
+    blk->page[1] = page;
 
-    arm_mpy_smla__(arm_mpy_op(), m, n);
-}
+    if (page < ARM_BLK_PAGES) {
+        blk->page[0] += ((addr                         ) & mask) >> ARM_BLK_PAGE_SHIFT;
+        blk->page[1] += ((addr + (blk->len + 1) * size) & mask) >> ARM_BLK_PAGE_SHIFT;
 
-//Signed Multiply Accumulate Long
-static void arm_smlal() {
-    arm_mpy_smlal(arm_mpy_op());
+        for (i = 0; i < 2; i++)
+            arm_blk_map[blk->page[i] >> 5] |= 1 << (blk->page[i] & 31);
+    }
+
+    blk->gen[0] = arm_blk_gen[blk->page[0]];
+    blk->gen[1] = arm_blk_gen[blk->page[1]];
 }
 
-//Signed Multiply Accumulate Long (Halfwords)
-static void arm_smlal__() {
-    bool m = (arm_op >> 5) & 1;
-    bool n = (arm_op >> 6) & 1;
+static arm_blk_t *arm_blk_get() {
+    uint32_t pc = arm_r.r[15] | arm_in_thumb();
 
-    arm_mpy_smlal__(arm_mpy_op(), m, n);
-}
+    arm_blk_t *blk = &arm_blk[(pc >> 1) & (ARM_BLK_COUNT - 1)];
 
-//Signed Multiply Accumulate Word by Halfword
-static void arm_smlaw_() {
-    arm_mpy_smlaw_(arm_mpy_op(), (arm_op >> 6) & 1);
-}
+    if (blk->pc != pc ||
+        blk->gen[0] != arm_blk_gen[blk->page[0]] ||
+        blk->gen[1] != arm_blk_gen[blk->page[1]])
+        arm_blk_build(blk, pc);
 
-//Signed Multiply
-static void arm_smul() {
-    bool m = (arm_op >> 5) & 1;
-    bool n = (arm_op >> 6) & 1;
+    //The pipeline may hold opcodes fetched before the memory was modified
+    if (blk->len == 0 ||
+        blk->op[0] != arm_r.pipe[0] ||
+        blk->op[1] != arm_r.pipe[1])
+        return NULL;
 
-    arm_mpy_smul(arm_mpy_op(), m, n);
+    return blk;
 }
 
-//Signed Multiply Long
-static void arm_smull() {
-    arm_mpy_smull(arm_mpy_op());
-}
+static void arm_blk_run(arm_blk_t *blk) {
+    uint8_t size = (blk->pc & 1) ? ARM_HWORD_SZ : ARM_WORD_SZ;
+    uint8_t i;
 
-//Signed Multiply Word by Halfword
-static void arm_smulw_() {
-    arm_mpy_smulw_(arm_mpy_op(), (arm_op >> 6) & 1);
-}
+    arm_blk_dirty = false;
 
-//Store Coprocessor
-static void arm_stc() {
-    //No coprocessors used
-}
+    for (i = 0; i < blk->len; i++) {
+        arm_r.cycles_step = arm_r.cycles;
 
-static void arm_stc2() {
-    //No coprocessors used
-}
+        arm_r.op      = arm_r.pipe[0];
+        arm_r.pipe[0] = arm_r.pipe[1];
+        arm_r.pipe[1] = blk->op[i + 2];
 
-//Store Multiple
-static void arm_stm() {
-    arm_memio_stm(arm_memio_mult_op());
-}
+        arm_r.cycles += *blk->cycles;
 
-static void arm_stm_usr() {
-    arm_memio_stm_usr(arm_memio_mult_op());
-}
+        if (blk->bios) bios_op = arm_r.pipe[1];
+
+        int8_t cond = blk->proc[i].cond;
+
+        if (cond == ARM_COND_AL || arm_cond(cond))
+            blk->proc[i].proc();
 
-static void t16_stm() {
-    arm_memio_stm(t16_memio_mult_op());
-}
+        if (t16_fused) {
+            t16_fused = false;
 
-//Store Register
-static void arm_str_imm() {
-    arm_memio_str(arm_memio_imm_op());
-}
+            i++;
+        }
 
-static void arm_str_reg() {
-    arm_memio_str(arm_memio_reg_op());
-}
+        bool branch = arm_r.pipe_reload;
 
-static void t16_str_imm5() {
-    arm_memio_str(t16_memio_imm5_op(ARM_WORD_SZ));
-}
+        if (arm_r.pipe_reload)
+            arm_r.pipe_reload = false;
+        else
+            arm_r.r[15] += size;
 
-static void t16_str_sp8() {
-    arm_memio_str(t16_memio_imm8sp_op());
-}
+        if (arm_r.int_halt) arm_r.cycles = arm_r.cycles_target;
 
-static void t16_str_reg() {
-    arm_memio_str(t16_memio_reg_op());
+        //Leave on branches, interrupts and writes to cached code
+        if (branch || arm_r.pipe_reload || arm_blk_dirty ||
+            arm_r.cycles >= arm_r.cycles_target) break;
+    }
 }
 
-//Store Register Byte
-static void arm_strb_imm() {
-    arm_memio_strb(arm_memio_imm_op());
+static uint32_t arm_rom_fetch(uint32_t address, bool thumb) {
+    if (thumb)
+        return *(uint16_t *)(rom + (address & 0x1ffffff));
+    else
+        return *(uint32_t *)(rom + (address & 0x1ffffff));
 }
 
-static void arm_strb_reg() {
-    arm_memio_strb(arm_memio_reg_op());
-}
+static bool arm_rom_run() {
+    uint8_t region = arm_r.r[15] >> 24;
 
-static void t16_strb_imm5() {
-    arm_memio_strb(t16_memio_imm5_op(ARM_BYTE_SZ));
-}
+    if (region < 0x8 || region > 0xd) return false;
 
-static void t16_strb_reg() {
-    arm_memio_strb(t16_memio_reg_op());
-}
+    bool     thumb = arm_in_thumb();
+    uint8_t  size  = thumb ? ARM_HWORD_SZ : ARM_WORD_SZ;
+    uint32_t addr  = arm_r.r[15] - size * 2;
 
-//Store Register Byte Unprivileged
-static void arm_strbt_imm() {
-    arm_memio_strbt(arm_memio_immt_op());
-}
+    //The pipeline may hold opcodes that were not fetched from ROM
+    if ((addr >> 24) != region ||
+        arm_rom_fetch(addr,        thumb) != arm_r.pipe[0] ||
+        arm_rom_fetch(addr + size, thumb) != arm_r.pipe[1]) {
+        arm_rom_misses++;
 
-static void arm_strbt_reg() {
-    arm_memio_strbt(arm_memio_regt_op());
-}
+        return false;
+    }
 
-//Store Register Dual
-static void arm_strd_imm() {
-    arm_memio_strd(arm_memio_immdh_op());
-}
+    const uint8_t *ws_s = thumb
+        ? &ws_s_t16[(region >> 1) & 3]
+        : &ws_s_arm[(region >> 1) & 3];
 
-static void arm_strd_reg() {
-    arm_memio_strd(arm_memio_regdh_op());
-}
+    //Only writes done from here on stop fused pairs
+    arm_blk_dirty = false;
 
-//Store Register Halfword
-static void arm_strh_imm() {
-    arm_memio_strh(arm_memio_immdh_op());
-}
+    while (true) {
+        uint32_t page = (addr & 0x1ffffff) >> ARM_ROM_PAGE_SHIFT;
 
-static void arm_strh_reg() {
-    arm_memio_strh(arm_memio_regdh_op());
-}
+        if (arm_rom_proc[thumb][page] == NULL) arm_rom_decode(page, thumb);
 
-static void t16_strh_imm5() {
-    arm_memio_strh(t16_memio_imm5_op(ARM_HWORD_SZ));
-}
+        void (*proc)() = arm_rom_proc[thumb][page][(addr & (ARM_ROM_PAGE_SIZE - 1)) / size];
 
-static void t16_strh_reg() {
-    arm_memio_strh(t16_memio_reg_op());
-}
+        arm_r.cycles_step = arm_r.cycles;
 
-//Subtract
-static void arm_sub_imm() {
-    arm_arith_sub(arm_data_imm_op());
-}
+        arm_r.op = arm_rom_fetch(addr, thumb);
 
-static void arm_sub_regi() {
-    arm_arith_sub(arm_data_regi_op());
-}
+        arm_pipe_lazy = true;
 
-static void arm_sub_regr() {
-    arm_arith_sub(arm_data_regr_op());
-}
+        arm_r.cycles += *ws_s;
 
-static void t16_sub_imm3() {
-    arm_arith_sub(t16_data_imm3_op());
-}
+        arm_rom_hits++;
 
-static void t16_sub_imm8() {
-    arm_arith_sub(t16_data_imm8_op());
-}
+        int8_t cond = arm_r.op >> 28;
 
-static void t16_sub_reg() {
-    arm_arith_sub(t16_data_reg_op());
-}
+        if (thumb || cond >= ARM_COND_AL || arm_cond(cond))
+            proc();
 
-static void t16_sub_sp7() {
-    arm_arith_sub(t16_data_imm7sp_op());
-}
+        if (t16_fused) {
+            t16_fused = false;
 
-//Supervisor Call
-static void arm_svc() {
-    arm_int(ARM_VEC_SVC, ARM_SVC);
-}
+            addr += size;
 
-static void t16_svc() {
-    arm_int(ARM_VEC_SVC, ARM_SVC);
-}
+            arm_rom_hits++;
+        }
 
-//Swap
-static void arm_swp() {
-    uint8_t rt2 = (arm_op >>  0) & 0xf;
-    uint8_t rt  = (arm_op >> 12) & 0xf;
-    uint8_t rn  = (arm_op >> 16) & 0xf;
-    bool    b   = (arm_op >> 22) & 0x1;
+        bool branch = arm_r.pipe_reload;
 
-    uint32_t val;
+        if (arm_r.pipe_reload)
+            arm_r.pipe_reload = false;
+        else
+            arm_r.r[15] += size;
 
-    if (b)
-        val = arm_readb_n(arm_r.r[rn]);
-    else
-        val = arm_read_n(arm_r.r[rn]);
+        if (arm_r.int_halt) arm_r.cycles = arm_r.cycles_target;
 
-    if (b)
-        arm_writeb_n(arm_r.r[rn], arm_r.r[rt2]);
-    else
-        arm_write_n(arm_r.r[rn], arm_r.r[rt2]);
+        if (branch || arm_r.pipe_reload || arm_r.cycles >= arm_r.cycles_target) break;
 
-    arm_r.r[rt] = val;
+        //Leaving the region changes the wait states
+        if ((arm_r.r[15] >> 24) != region) break;
 
-    arm_cycles++;
-}
+        addr += size;
+    }
 
-//Test Equivalence
-static void arm_teq_imm() {
-    arm_logic_teq(arm_data_imm_op());
-}
+    //R15 already moved past the last prefetch
+    if (arm_pipe_lazy) arm_pipe_fill(arm_r.r[15] - size);
 
-static void arm_teq_regi() {
-    arm_logic_teq(arm_data_regi_op());
+    return true;
 }
 
-static void arm_teq_regr() {
-    arm_logic_teq(arm_data_regr_op());
-}
+static void arm_idle_skip() {
+    arm_idle_hit = false;
 
-//Test
-static void arm_tst_imm() {
-    arm_logic_tst(arm_data_imm_op());
-}
+    //An interrupt was taken after the branch
+    if (arm_r.pipe_reload || arm_r.int_halt) return;
 
-static void arm_tst_regi() {
-    arm_logic_tst(arm_data_regi_op());
-}
+    //The target already stops at the next event, timer overflows included
+    uint32_t left = arm_r.cycles_target - arm_r.cycles;
 
-static void arm_tst_regr() {
-    arm_logic_tst(arm_data_regr_op());
-}
+    uint32_t skip = left;
 
-static void t16_tst_rdn3() {
-    arm_logic_tst(t16_data_rdn3_op());
-}
+    //Stop before the iteration that reaches the event
+    if (arm_idle_iter) skip = ((left - 1) / arm_idle_iter) * arm_idle_iter;
 
-//Unsigned Multiply Accumulate Long
-static void arm_umlal() {
-    arm_mpy_umlal(arm_mpy_op());
-}
+    if (skip == 0) return;
 
-//Unsigned Multiply Long
-static void arm_umull() {
-    arm_mpy_umull(arm_mpy_op());
-}
+    arm_r.cycles      += skip;
+    arm_idle.cycles += skip;
 
-//Undefined
-static void arm_und() {
-    arm_int(ARM_VEC_UND, ARM_UND);
+    arm_idle_skips++;
+    arm_idle_cycles += skip;
 }
 
+#ifdef ARM_THREADED
+
+#ifndef __GNUC__
+#error "The threaded interpreter needs GCC labels as values"
+#endif
+
 /*
- * Decode
+ * Threaded interpreter
+ *
+ * Every handler gets a label that runs it and dispatches the next opcode
+ * directly, so each one ends on its own indirect jump. The label tables
+ * are derived from arm_proc/thumb_proc, which are built from the same
+ * decode masks, so both cores always agree on what each opcode runs.
  */
 
-static void arm_proc_fill(void (**arr)(), void (*proc)(), int32_t size) {
-    int32_t i;
+#define ARM_THR_SKIP  (2 * 4096)
 
-    for (i = 0; i < size; i++) {
-        arr[i] = proc;
-    }
-}
+//Starts the next opcode and returns the index of its label
+static int32_t thr_start(bool thumb) {
+    arm_r.cycles_step = arm_r.cycles;
 
-static void arm_proc_set(void (**arr)(), void (*proc)(), uint32_t op, uint32_t mask, int32_t bits) {
-    //Bits you need on op needs to be set 1 on mask
-    int32_t i, j;
-    int32_t zbits = 0;
-    int32_t zpos[bits];
+    arm_r.op      = arm_r.pipe[0];
+    arm_r.pipe[0] = arm_r.pipe[1];
 
-    for (i = 0; i < bits; i++) {
-        if ((mask & (1 << i)) == 0) zpos[zbits++] = i;
+    if (thumb) {
+        arm_r.pipe[1] = arm_fetchh(SEQUENTIAL);
+
+        if (arm_pair_enb) t16_pair_count(arm_r.op);
+
+        return arm_r.op >> 5;
     }
 
-    for (i = 0; i < (1 << zbits); i++) {
-        op &= mask;
+    arm_r.pipe[1] = arm_fetch(SEQUENTIAL);
 
-        for (j = 0; j < zbits; j++) {
-            op |= ((i >> j) & 1) << zpos[j];
-        }
+    uint32_t proc;
 
-        arr[op] = proc;
-    }
+    proc  = (arm_r.op >> 16) & 0xff0;
+    proc |= (arm_r.op >>  4) & 0x00f;
+
+    int8_t cond = arm_r.op >> 28;
+
+    if (cond == ARM_COND_UNCOND)
+        return proc | 4096;
+    else if (arm_cond(cond))
+        return proc;
+    else
+        return ARM_THR_SKIP;
 }
 
-void (*arm_proc[2][4096])();
-void (*thumb_proc[2048])();
+/*
+ * Retires the opcode that just ran and starts the next one. Returns -1
+ * when the core has to go back to the top of the loop instead, that is
+ * on branches, interrupts and at the end of the slice.
+ */
+static int32_t thr_next(uint8_t size) {
+    bool branch = arm_r.pipe_reload;
 
-static void arm_proc_init() {
-    //Format 27:20,7:4
-    arm_proc_fill(arm_proc[0], arm_und, 4096);
-    arm_proc_fill(arm_proc[1], arm_und, 4096);
+    if (arm_r.pipe_reload)
+        arm_r.pipe_reload = false;
+    else
+        arm_r.r[15] += size;
 
-    //Conditional
-    arm_proc_set(arm_proc[0], arm_adc_imm,    0b001010100000, 0b111111100000, 12);
-    arm_proc_set(arm_proc[0], arm_adc_regi,   0b000010100000, 0b111111100001, 12);
-    arm_proc_set(arm_proc[0], arm_adc_regr,   0b000010100001, 0b111111101001, 12);
-    arm_proc_set(arm_proc[0], arm_add_imm,    0b001010000000, 0b111111100000, 12);
-    arm_proc_set(arm_proc[0], arm_add_regi,   0b000010000000, 0b111111100001, 12);
-    arm_proc_set(arm_proc[0], arm_add_regr,   0b000010000001, 0b111111101001, 12);
-    arm_proc_set(arm_proc[0], arm_and_imm,    0b001000000000, 0b111111100000, 12);
-    arm_proc_set(arm_proc[0], arm_and_regi,   0b000000000000, 0b111111100001, 12);
-    arm_proc_set(arm_proc[0], arm_and_regr,   0b000000000001, 0b111111101001, 12);
-    arm_proc_set(arm_proc[0], arm_shift_imm,  0b000110100000, 0b111111100001, 12);
-    arm_proc_set(arm_proc[0], arm_shift_reg,  0b000110100001, 0b111111101001, 12);
-    arm_proc_set(arm_proc[0], arm_b,          0b101000000000, 0b111100000000, 12);
-    arm_proc_set(arm_proc[0], arm_bic_imm,    0b001111000000, 0b111111100000, 12);
-    arm_proc_set(arm_proc[0], arm_bic_regi,   0b000111000000, 0b111111100001, 12);
-    arm_proc_set(arm_proc[0], arm_bic_regr,   0b000111000001, 0b111111101001, 12);
-    arm_proc_set(arm_proc[0], arm_bkpt,       0b000100100111, 0b111111111111, 12);
-    arm_proc_set(arm_proc[0], arm_bl,         0b101100000000, 0b111100000000, 12);
-    arm_proc_set(arm_proc[0], arm_blx_reg,    0b000100100011, 0b111111111111, 12);
-    arm_proc_set(arm_proc[0], arm_bx,         0b000100100001, 0b111111111111, 12);
-    arm_proc_set(arm_proc[0], arm_cdp,        0b111000000000, 0b111100000001, 12);
-    arm_proc_set(arm_proc[0], arm_clz,        0b000101100001, 0b111111111111, 12);
-    arm_proc_set(arm_proc[0], arm_cmn_imm,    0b001101110000, 0b111111110000, 12);
-    arm_proc_set(arm_proc[0], arm_cmn_regi,   0b000101110000, 0b111111110001, 12);
-    arm_proc_set(arm_proc[0], arm_cmn_regr,   0b000101110001, 0b111111111001, 12);
-    arm_proc_set(arm_proc[0], arm_cmp_imm,    0b001101010000, 0b111111110000, 12);
-    arm_proc_set(arm_proc[0], arm_cmp_regi,   0b000101010000, 0b111111110001, 12);
-    arm_proc_set(arm_proc[0], arm_cmp_regr,   0b000101010001, 0b111111111001, 12);
-    arm_proc_set(arm_proc[0], arm_eor_imm,    0b001000100000, 0b111111100000, 12);
-    arm_proc_set(arm_proc[0], arm_eor_regi,   0b000000100000, 0b111111100001, 12);
-    arm_proc_set(arm_proc[0], arm_eor_regr,   0b000000100001, 0b111111101001, 12);
-    arm_proc_set(arm_proc[0], arm_ldc,        0b110000010000, 0b111000010000, 12);
-    arm_proc_set(arm_proc[0], arm_ldm,        0b100000010000, 0b111001010000, 12);
-    arm_proc_set(arm_proc[0], arm_ldm_usr,    0b100001010000, 0b111001010000, 12);
-    arm_proc_set(arm_proc[0], arm_ldr_imm,    0b010000010000, 0b111001010000, 12);
-    arm_proc_set(arm_proc[0], arm_ldr_reg,    0b011000010000, 0b111001010001, 12);
-    arm_proc_set(arm_proc[0], arm_ldrb_imm,   0b010001010000, 0b111001010000, 12);
-    arm_proc_set(arm_proc[0], arm_ldrb_reg,   0b011001010000, 0b111001010001, 12);
-    arm_proc_set(arm_proc[0], arm_ldrbt_imm,  0b010001110000, 0b111101110000, 12);
-    arm_proc_set(arm_proc[0], arm_ldrbt_reg,  0b011001110000, 0b111101110001, 12);
-    arm_proc_set(arm_proc[0], arm_ldrd_imm,   0b000001001101, 0b111001011111, 12);
-    arm_proc_set(arm_proc[0], arm_ldrd_reg,   0b000000001101, 0b111001011111, 12);
-    arm_proc_set(arm_proc[0], arm_ldrh_imm,   0b000001011011, 0b111001011111, 12);
-    arm_proc_set(arm_proc[0], arm_ldrh_reg,   0b000000011011, 0b111001011111, 12);
-    arm_proc_set(arm_proc[0], arm_ldrsb_imm,  0b000001011101, 0b111001011111, 12);
-    arm_proc_set(arm_proc[0], arm_ldrsb_reg,  0b000000011101, 0b111001011111, 12);
-    arm_proc_set(arm_proc[0], arm_ldrsh_imm,  0b000001011111, 0b111001011111, 12);
-    arm_proc_set(arm_proc[0], arm_ldrsh_reg,  0b000000011111, 0b111001011111, 12);
-    arm_proc_set(arm_proc[0], arm_mcr,        0b111000000001, 0b111100010001, 12);
-    arm_proc_set(arm_proc[0], arm_mcrr,       0b110001000000, 0b111111110000, 12);
-    arm_proc_set(arm_proc[0], arm_mla,        0b000000101001, 0b111111101111, 12);
-    arm_proc_set(arm_proc[0], arm_mov_imm12,  0b001110100000, 0b111111100000, 12);
-    arm_proc_set(arm_proc[0], arm_mrc,        0b111000010001, 0b111100010001, 12);
-    arm_proc_set(arm_proc[0], arm_mrrc,       0b110001010000, 0b111111110000, 12);
-    arm_proc_set(arm_proc[0], arm_mrs,        0b000100000000, 0b111110111111, 12);
-    arm_proc_set(arm_proc[0], arm_msr_imm,    0b001100100000, 0b111111110000, 12);
-    arm_proc_set(arm_proc[0], arm_msr_reg,    0b000100100000, 0b111110111111, 12);
-    arm_proc_set(arm_proc[0], arm_mul,        0b000000001001, 0b111111101111, 12);
-    arm_proc_set(arm_proc[0], arm_mvn_imm,    0b001111100000, 0b111111100000, 12);
-    arm_proc_set(arm_proc[0], arm_mvn_regi,   0b000111100000, 0b111111100001, 12);
-    arm_proc_set(arm_proc[0], arm_mvn_regr,   0b000111100001, 0b111111101001, 12);
-    arm_proc_set(arm_proc[0], arm_orr_imm,    0b001110000000, 0b111111100000, 12);
-    arm_proc_set(arm_proc[0], arm_orr_regi,   0b000110000000, 0b111111100001, 12);
-    arm_proc_set(arm_proc[0], arm_orr_regr,   0b000110000001, 0b111111101001, 12);
-    arm_proc_set(arm_proc[0], arm_qadd,       0b000100000101, 0b111111111111, 12);
-    arm_proc_set(arm_proc[0], arm_qdadd,      0b000101000101, 0b111111111111, 12);
-    arm_proc_set(arm_proc[0], arm_qdsub,      0b000101100101, 0b111111111111, 12);
-    arm_proc_set(arm_proc[0], arm_qsub,       0b000100100101, 0b111111111111, 12);
-    arm_proc_set(arm_proc[0], arm_rsb_imm,    0b001001100000, 0b111111100000, 12);
-    arm_proc_set(arm_proc[0], arm_rsb_regi,   0b000001100000, 0b111111100001, 12);
-    arm_proc_set(arm_proc[0], arm_rsb_regr,   0b000001100001, 0b111111101001, 12);
-    arm_proc_set(arm_proc[0], arm_rsc_imm,    0b001011100000, 0b111111100000, 12);
-    arm_proc_set(arm_proc[0], arm_rsc_regi,   0b000011100000, 0b111111100001, 12);
-    arm_proc_set(arm_proc[0], arm_rsc_regr,   0b000011100001, 0b111111101001, 12);
-    arm_proc_set(arm_proc[0], arm_sbc_imm,    0b001011000000, 0b111111100000, 12);
-    arm_proc_set(arm_proc[0], arm_sbc_regi,   0b000011000000, 0b111111100001, 12);
-    arm_proc_set(arm_proc[0], arm_sbc_regr,   0b000011000001, 0b111111101001, 12);
-    arm_proc_set(arm_proc[0], arm_smla__,     0b000100001000, 0b111111111001, 12);
-    arm_proc_set(arm_proc[0], arm_smlal,      0b000011101001, 0b111111101111, 12);
-    arm_proc_set(arm_proc[0], arm_smlal__,    0b000101001000, 0b111111111001, 12);
-    arm_proc_set(arm_proc[0], arm_smlaw_,     0b000100101000, 0b111111111011, 12);
-    arm_proc_set(arm_proc[0], arm_smul,       0b000101101000, 0b111111111001, 12);
-    arm_proc_set(arm_proc[0], arm_smull,      0b000011001001, 0b111111101111, 12);
-    arm_proc_set(arm_proc[0], arm_smulw_,     0b000100101010, 0b111111111011, 12);
-    arm_proc_set(arm_proc[0], arm_stc,        0b110000000000, 0b111000010000, 12);
-    arm_proc_set(arm_proc[0], arm_stm,        0b100000000000, 0b111001010000, 12);
-    arm_proc_set(arm_proc[0], arm_stm_usr,    0b100001000000, 0b111001010000, 12);
-    arm_proc_set(arm_proc[0], arm_str_imm,    0b010000000000, 0b111001010000, 12);
-    arm_proc_set(arm_proc[0], arm_str_reg,    0b011000000000, 0b111001010001, 12);
-    arm_proc_set(arm_proc[0], arm_strb_imm,   0b010001000000, 0b111001010000, 12);
-    arm_proc_set(arm_proc[0], arm_strb_reg,   0b011001000000, 0b111001010001, 12);
-    arm_proc_set(arm_proc[0], arm_strbt_imm,  0b010001100000, 0b111101110000, 12);
-    arm_proc_set(arm_proc[0], arm_strbt_reg,  0b011001100000, 0b111101110001, 12);
-    arm_proc_set(arm_proc[0], arm_strd_imm,   0b000001001111, 0b111001011111, 12);
-    arm_proc_set(arm_proc[0], arm_strd_reg,   0b000000001111, 0b111001011111, 12);
-    arm_proc_set(arm_proc[0], arm_strh_imm,   0b000001001011, 0b111001011111, 12);
-    arm_proc_set(arm_proc[0], arm_strh_reg,   0b000000001011, 0b111001011111, 12);
-    arm_proc_set(arm_proc[0], arm_sub_imm,    0b001001000000, 0b111111100000, 12);
-    arm_proc_set(arm_proc[0], arm_sub_regi,   0b000001000000, 0b111111100001, 12);
-    arm_proc_set(arm_proc[0], arm_sub_regr,   0b000001000001, 0b111111101001, 12);
-    arm_proc_set(arm_proc[0], arm_svc,        0b111100000000, 0b111100000000, 12);
-    arm_proc_set(arm_proc[0], arm_swp,        0b000100001001, 0b111110111111, 12);
-    arm_proc_set(arm_proc[0], arm_teq_imm,    0b001100110000, 0b111111110000, 12);
-    arm_proc_set(arm_proc[0], arm_teq_regi,   0b000100110000, 0b111111110001, 12);
-    arm_proc_set(arm_proc[0], arm_teq_regr,   0b000100110001, 0b111111111001, 12);
-    arm_proc_set(arm_proc[0], arm_tst_imm,    0b001100010000, 0b111111110000, 12);
-    arm_proc_set(arm_proc[0], arm_tst_regi,   0b000100010000, 0b111111110001, 12);
-    arm_proc_set(arm_proc[0], arm_tst_regr,   0b000100010001, 0b111111111001, 12);
-    arm_proc_set(arm_proc[0], arm_umlal,      0b000010101001, 0b111111101111, 12);
-    arm_proc_set(arm_proc[0], arm_umull,      0b000010001001, 0b111111101111, 12);
+    if (arm_r.int_halt) arm_r.cycles = arm_r.cycles_target;
 
-    //Unconditional
-    arm_proc_set(arm_proc[1], arm_blx_imm,    0b101000000000, 0b111000000000, 12);
-    arm_proc_set(arm_proc[1], arm_cdp2,       0b111000000000, 0b111100000001, 12);
-    arm_proc_set(arm_proc[1], arm_ldc2,       0b110000010000, 0b111000010000, 12);
-    arm_proc_set(arm_proc[1], arm_mcr2,       0b111000000001, 0b111100010001, 12);
-    arm_proc_set(arm_proc[1], arm_mcrr2,      0b110001000000, 0b111111110000, 12);
-    arm_proc_set(arm_proc[1], arm_mrc2,       0b111000010001, 0b111100010001, 12);
-    arm_proc_set(arm_proc[1], arm_mrrc2,      0b110001010000, 0b111111110000, 12);
-    arm_proc_set(arm_proc[1], arm_pld_imm,    0b010101010000, 0b111101110000, 12);
-    arm_proc_set(arm_proc[1], arm_pld_reg,    0b011101010000, 0b111101110000, 12);
-    arm_proc_set(arm_proc[1], arm_stc2,       0b110000000000, 0b111000010000, 12);
+    if (branch || arm_r.pipe_reload || arm_r.cycles >= arm_r.cycles_target) return -1;
+
+    return thr_start(size == ARM_HWORD_SZ);
 }
 
-static void thumb_proc_init() {
-    //Format 15:5
-    arm_proc_fill(thumb_proc, arm_und, 2048);
+#define THR_NEXT(size, lbl)           \
+    if ((next = thr_next(size)) < 0)  \
+        goto thr_top;                 \
+                                      \
+    goto *lbl[next];
 
-    arm_proc_set(thumb_proc, t16_adc_rdn3,   0b01000001010, 0b11111111110, 11);
-    arm_proc_set(thumb_proc, t16_add_imm3,   0b00011100000, 0b11111110000, 11);
-    arm_proc_set(thumb_proc, t16_add_imm8,   0b00110000000, 0b11111000000, 11);
-    arm_proc_set(thumb_proc, t16_add_reg,    0b00011000000, 0b11111110000, 11);
-    arm_proc_set(thumb_proc, t16_add_rdn4,   0b01000100000, 0b11111111000, 11);
-    arm_proc_set(thumb_proc, t16_add_sp7,    0b10110000000, 0b11111000000, 11);
-    arm_proc_set(thumb_proc, t16_add_sp8,    0b10101000000, 0b11111000000, 11);
-    arm_proc_set(thumb_proc, t16_adr,        0b10100000000, 0b11111000000, 11);
-    arm_proc_set(thumb_proc, t16_and_rdn3,   0b01000000000, 0b11111111110, 11);
-    arm_proc_set(thumb_proc, t16_asr_imm5,   0b00010000000, 0b11111000000, 11);
-    arm_proc_set(thumb_proc, t16_asr_rdn3,   0b01000001000, 0b11111111110, 11);
-    arm_proc_set(thumb_proc, t16_b_imm8,     0b11010000000, 0b11110000000, 11);
-    arm_proc_set(thumb_proc, t16_b_imm11,    0b11100000000, 0b11111000000, 11);
-    arm_proc_set(thumb_proc, t16_bic_rdn3,   0b01000011100, 0b11111111110, 11);
-    arm_proc_set(thumb_proc, t16_bkpt,       0b10111110000, 0b11111111000, 11);
-    arm_proc_set(thumb_proc, t16_blx,        0b01000111100, 0b11111111100, 11);
-    arm_proc_set(thumb_proc, t16_blx_h1,     0b11101000000, 0b11111000000, 11);
-    arm_proc_set(thumb_proc, t16_blx_h2,     0b11110000000, 0b11111000000, 11);
-    arm_proc_set(thumb_proc, t16_blx_h3,     0b11111000000, 0b11111000000, 11);
-    arm_proc_set(thumb_proc, t16_bx,         0b01000111000, 0b11111111100, 11);
-    arm_proc_set(thumb_proc, t16_cmn_rdn3,   0b01000010110, 0b11111111110, 11);
-    arm_proc_set(thumb_proc, t16_cmp_imm8,   0b00101000000, 0b11111000000, 11);
-    arm_proc_set(thumb_proc, t16_cmp_rdn3,   0b01000010100, 0b11111111110, 11);
-    arm_proc_set(thumb_proc, t16_cmp_rdn4,   0b01000101000, 0b11111111000, 11);
-    arm_proc_set(thumb_proc, t16_eor_rdn3,   0b01000000010, 0b11111111110, 11);
-    arm_proc_set(thumb_proc, t16_ldm,        0b11001000000, 0b11111000000, 11);
-    arm_proc_set(thumb_proc, t16_ldr_imm5,   0b01101000000, 0b11111000000, 11);
-    arm_proc_set(thumb_proc, t16_ldr_sp8,    0b10011000000, 0b11111000000, 11);
-    arm_proc_set(thumb_proc, t16_ldr_pc8,    0b01001000000, 0b11111000000, 11);
-    arm_proc_set(thumb_proc, t16_ldr_reg,    0b01011000000, 0b11111110000, 11);
-    arm_proc_set(thumb_proc, t16_ldrb_imm5,  0b01111000000, 0b11111000000, 11);
-    arm_proc_set(thumb_proc, t16_ldrb_reg,   0b01011100000, 0b11111110000, 11);
-    arm_proc_set(thumb_proc, t16_ldrh_imm5,  0b10001000000, 0b11111000000, 11);
-    arm_proc_set(thumb_proc, t16_ldrh_reg,   0b01011010000, 0b11111110000, 11);
-    arm_proc_set(thumb_proc, t16_ldrsb_reg,  0b01010110000, 0b11111110000, 11);
-    arm_proc_set(thumb_proc, t16_ldrsh_reg,  0b01011110000, 0b11111110000, 11);
-    arm_proc_set(thumb_proc, t16_lsl_imm5,   0b00000000000, 0b11111000000, 11);
-    arm_proc_set(thumb_proc, t16_lsl_rdn3,   0b01000000100, 0b11111111110, 11);
-    arm_proc_set(thumb_proc, t16_lsr_imm5,   0b00001000000, 0b11111000000, 11);
-    arm_proc_set(thumb_proc, t16_lsr_rdn3,   0b01000000110, 0b11111111110, 11);
-    arm_proc_set(thumb_proc, t16_mov_imm,    0b00100000000, 0b11111000000, 11);
-    arm_proc_set(thumb_proc, t16_mov_rd4,    0b01000110000, 0b11111111000, 11);
-    arm_proc_set(thumb_proc, t16_mov_rd3,    0b00000000000, 0b11111111110, 11);
-    arm_proc_set(thumb_proc, t16_mul,        0b01000011010, 0b11111111110, 11);
-    arm_proc_set(thumb_proc, t16_mvn_rdn3,   0b01000011110, 0b11111111110, 11);
-    arm_proc_set(thumb_proc, t16_orr_rdn3,   0b01000011000, 0b11111111110, 11);
-    arm_proc_set(thumb_proc, t16_pop,        0b10111100000, 0b11111110000, 11);
-    arm_proc_set(thumb_proc, t16_push,       0b10110100000, 0b11111110000, 11);
-    arm_proc_set(thumb_proc, t16_ror,        0b01000001110, 0b11111111110, 11);
-    arm_proc_set(thumb_proc, t16_rsb_rdn3,   0b01000010010, 0b11111111110, 11);
-    arm_proc_set(thumb_proc, t16_sbc_rdn3,   0b01000001100, 0b11111111110, 11);
-    arm_proc_set(thumb_proc, t16_stm,        0b11000000000, 0b11111000000, 11);
-    arm_proc_set(thumb_proc, t16_str_imm5,   0b01100000000, 0b11111000000, 11);
-    arm_proc_set(thumb_proc, t16_str_sp8,    0b10010000000, 0b11111000000, 11);
-    arm_proc_set(thumb_proc, t16_str_reg,    0b01010000000, 0b11111110000, 11);
-    arm_proc_set(thumb_proc, t16_strb_imm5,  0b01110000000, 0b11111000000, 11);
-    arm_proc_set(thumb_proc, t16_strb_reg,   0b01010100000, 0b11111110000, 11);
-    arm_proc_set(thumb_proc, t16_strh_imm5,  0b10000000000, 0b11111000000, 11);
-    arm_proc_set(thumb_proc, t16_strh_reg,   0b01010010000, 0b11111110000, 11);
-    arm_proc_set(thumb_proc, t16_sub_imm3,   0b00011110000, 0b11111110000, 11);
-    arm_proc_set(thumb_proc, t16_sub_imm8,   0b00111000000, 0b11111000000, 11);
-    arm_proc_set(thumb_proc, t16_sub_reg,    0b00011010000, 0b11111110000, 11);
-    arm_proc_set(thumb_proc, t16_sub_sp7,    0b10110000100, 0b11111111100, 11);
-    arm_proc_set(thumb_proc, t16_svc,        0b11011111100, 0b11111111000, 11);
-    arm_proc_set(thumb_proc, t16_tst_rdn3,   0b01000010000, 0b11111111110, 11);
-}
+#define THR_LBL_COND(p, op, mask)    if (arm_proc[0][i] == p) arm_lbl[i]        = &&thr_##p;
+#define THR_LBL_UNCOND(p, op, mask)  if (arm_proc[1][i] == p) arm_lbl[i | 4096] = &&thr_##p;
+#define THR_LBL_T16(p, op, mask)     if (thumb_proc[i]  == p) thumb_lbl[i]      = &&thr_##p;
 
-void arm_init() {
-    bios   = malloc(0x4000);
-    wram   = malloc(0x40000);
-    iwram  = malloc(0x8000);
-    pram   = malloc(0x400);
-    vram   = malloc(0x18000);
-    oam    = malloc(0x400);
-    rom    = malloc(0x2000000);
-    eeprom = malloc(0x2000);
-    sram   = malloc(0x10000);
-    flash  = malloc(0x20000);
+#define THR_ARM(p, op, mask)  thr_##p: p(); THR_NEXT(ARM_WORD_SZ,  arm_lbl)
+#define THR_T16(p, op, mask)  thr_##p: p(); THR_NEXT(ARM_HWORD_SZ, thumb_lbl)
 
-    arm_proc_init();
-    thumb_proc_init();
+static void arm_exec_threaded() {
+    static void *arm_lbl[ARM_THR_SKIP + 1];
+    static void *thumb_lbl[2048];
 
-    key_input.w = 0x3ff;
-    wait_cnt.w  = 0;
-    arm_cycles  = 0;
+    static bool lbl_init;
 
-    update_ws();
-}
+    int32_t next;
+    int32_t i;
 
-void arm_uninit() {
-    free(bios);
-    free(wram);
-    free(iwram);
-    free(pram);
-    free(vram);
-    free(oam);
-    free(rom);
-    free(eeprom);
-    free(sram);
-    free(flash);
-}
+    if (!lbl_init) {
+        for (i = 0; i < 4096; i++) {
+            arm_lbl[i]        = &&thr_arm_und_arm;
+            arm_lbl[i | 4096] = &&thr_arm_und_arm;
 
-#define ARM_COND_UNCOND  0b1111
+            ARM_PROC_COND(THR_LBL_COND)
+            ARM_PROC_UNCOND(THR_LBL_UNCOND)
+        }
 
-static void t16_inc_r15() {
-    if (pipe_reload)
-        pipe_reload = false;
-    else
-        arm_r.r[15] += 2;
-}
+        for (i = 0; i < 2048; i++) {
+            thumb_lbl[i] = &&thr_arm_und_t16;
 
-static void t16_step() {
-    arm_pipe[1] = arm_fetchh(SEQUENTIAL);
+            THUMB_PROC(THR_LBL_T16)
+        }
 
-    thumb_proc[arm_op >> 5]();
+        arm_lbl[ARM_THR_SKIP] = &&thr_arm_skip;
 
-    t16_inc_r15();
-}
+        lbl_init = true;
+    }
 
-static void arm_inc_r15() {
-    if (pipe_reload)
-        pipe_reload = false;
-    else
-        arm_r.r[15] += 4;
-}
+thr_top:
+    while (arm_r.cycles < arm_r.cycles_target) {
+        if (arm_idle_hit) {
+            arm_idle_skip();
 
-static void arm_step() {
-    arm_pipe[1] = arm_fetch(SEQUENTIAL);
+            continue;
+        }
 
-    uint32_t proc;
+        if (arm_jit_enb && !arm_r.pipe_reload && arm_jit_run())
+            continue;
 
-    proc  = (arm_op >> 16) & 0xff0;
-    proc |= (arm_op >>  4) & 0x00f;
+        if (arm_rom_enb && !arm_r.pipe_reload && arm_rom_run())
+            continue;
 
-    int8_t cond = arm_op >> 28;
+        if (arm_blk_enb && !arm_r.pipe_reload) {
+            arm_blk_t *blk = arm_blk_get();
 
-    if (cond == ARM_COND_UNCOND)
-        arm_proc[1][proc]();
-    else if (arm_cond(cond))
-        arm_proc[0][proc]();
+            if (blk != NULL) {
+                arm_blk_run(blk);
 
-    arm_inc_r15();
+                continue;
+            }
+        }
+
+        if (arm_in_thumb())
+            goto *thumb_lbl[thr_start(true)];
+        else
+            goto *arm_lbl[thr_start(false)];
+    }
+
+    return;
+
+    ARM_PROC_COND(THR_ARM)
+    ARM_PROC_UNCOND(THR_ARM)
+    THUMB_PROC(THR_T16)
+
+thr_arm_und_arm: arm_und(); THR_NEXT(ARM_WORD_SZ,  arm_lbl)
+thr_arm_und_t16: arm_und(); THR_NEXT(ARM_HWORD_SZ, thumb_lbl)
+
+    //Condition failed, the opcode is skipped
+thr_arm_skip: THR_NEXT(ARM_WORD_SZ, arm_lbl)
 }
 
+#endif
+
 void arm_exec(uint32_t target_cycles) {
-    if (int_halt) {
-        timers_clock(target_cycles);
+    arm_r.cycles_target = target_cycles;
+
+    //Halted, the timers catch up on their own when they are next looked at
+    if (arm_r.int_halt) {
+        arm_r.cycles_step = arm_r.cycles;
 
         return;
     }
 
-    while (arm_cycles < target_cycles) {
-        uint32_t cycles = arm_cycles;
+#ifdef ARM_THREADED
+    arm_exec_threaded();
+#else
+    while (arm_r.cycles < arm_r.cycles_target) {
+        if (arm_idle_hit) {
+            arm_idle_skip();
+
+            continue;
+        }
+
+        if (arm_jit_enb && !arm_r.pipe_reload && arm_jit_run())
+            continue;
 
-        arm_op      = arm_pipe[0];
-        arm_pipe[0] = arm_pipe[1];
+        if (arm_rom_enb && !arm_r.pipe_reload && arm_rom_run())
+            continue;
+
+        if (arm_blk_enb && !arm_r.pipe_reload) {
+            arm_blk_t *blk = arm_blk_get();
+
+            if (blk != NULL) {
+                arm_blk_run(blk);
+
+                continue;
+            }
+        }
+
+        arm_r.cycles_step = arm_r.cycles;
+
+        arm_r.op      = arm_r.pipe[0];
+        arm_r.pipe[0] = arm_r.pipe[1];
 
         if (arm_in_thumb())
             t16_step();
         else
             arm_step();
 
-        if (int_halt) arm_cycles = target_cycles;
-
-        if (tmr_enb) timers_clock(arm_cycles - cycles);
+        if (arm_r.int_halt) arm_r.cycles = arm_r.cycles_target;
     }
+#endif
 
-    arm_cycles -= target_cycles;
+    //Cycles restart from zero on the next slice
+    arm_idle_hit   = false;
+    arm_idle.valid = false;
+
+    arm_copy_last.valid = false;
+
+    arm_r.cycles     -= arm_r.cycles_target;
+    arm_r.cycles_step = arm_r.cycles;
 }
 
 void arm_int(uint32_t address, int8_t mode) {
+    arm_flags_sync();
+
+    //The handler runs in the middle of the iteration being timed
+    arm_copy_last.valid = false;
+
     uint32_t cpsr = arm_r.cpsr;
 
     arm_mode_set(mode);
@@ -3262,6 +4540,8 @@ void arm_int(uint32_t address, int8_t mode) {
     arm_r.r[14] = arm_r.r[15];
     arm_r.r[15] = address;
 
+    //The refill is on the master timestamp, so the timers count it too, even
+    //when the IRQ is raised by an event between instructions
     arm_load_pipe();
 }
 
@@ -3274,4 +4554,32 @@ void arm_check_irq() {
 
 void arm_reset() {
     arm_int(ARM_VEC_RESET, ARM_SVC);
+}
+
+//Starts on the cartridge with the state the BIOS leaves after the intro
+void arm_direct_boot() {
+    arm_mode_set(ARM_IRQ);
+    arm_r.r[13] = 0x03007fa0;
+
+    arm_mode_set(ARM_SVC);
+    arm_r.r[13] = 0x03007fe0;
+
+    arm_mode_set(ARM_SYS);
+    arm_r.r[13] = 0x03007f00;
+
+    post_boot  = 1;
+    snd_bias.w = 0x200;
+    wait_cnt.w = 0;
+
+    update_ws();
+
+    //Last opcode the BIOS fetched, seen when reading it afterwards
+    bios_op = 0xe129f000;
+
+    arm_r.r[15] = 0x08000000;
+
+    arm_load_pipe();
+
+    //Nothing branched here, the first opcode has to advance R15
+    arm_r.pipe_reload = false;
 }
\ No newline at end of file
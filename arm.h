@@ -56,58 +56,92 @@ typedef union {
     } b;
 } arm_word;
 
+//Register banks, indexes on the banked register arrays
+#define ARM_BANK_NONE  0 //Invalid modes
+#define ARM_BANK_USR   1 //User and System
+#define ARM_BANK_FIQ   2
+#define ARM_BANK_IRQ   3
+#define ARM_BANK_SVC   4
+#define ARM_BANK_MON   5
+#define ARM_BANK_ABT   6
+#define ARM_BANK_UND   7
+#define ARM_BANKS      8
+
+#ifdef __GNUC__
+#define ARM_ALIGN(n)  __attribute__((aligned(n)))
+#else
+#define ARM_ALIGN(n)
+#endif
+
+/*
+ * Everything read or written on every instruction, kept together on two
+ * cache lines. r holds the registers of the current mode.
+ */
 typedef struct {
     uint32_t r[16];
 
-    uint32_t r8_usr;
-    uint32_t r9_usr;
-    uint32_t r10_usr;
-    uint32_t r11_usr;
-    uint32_t r12_usr;
-    uint32_t r13_usr;
-    uint32_t r14_usr;
+    uint32_t cpsr;
+
+    uint32_t op;
+    uint32_t pipe[2];
+    uint32_t cycles;
+    uint32_t cycles_step;   //cycles when the current instruction started
+    uint32_t cycles_target; //Next event, pulled in if an earlier one is scheduled
 
-    uint32_t r8_fiq;
-    uint32_t r9_fiq;
-    uint32_t r10_fiq;
-    uint32_t r11_fiq;
-    uint32_t r12_fiq;
-    uint32_t r13_fiq;
-    uint32_t r14_fiq;
+    bool int_halt;
+    bool pipe_reload;
+} ARM_ALIGN(64) arm_regs_t;
 
-    uint32_t r13_irq;
-    uint32_t r14_irq;
+arm_regs_t arm_r;
 
-    uint32_t r13_svc;
-    uint32_t r14_svc;
+//Banked copies of the other modes, only touched on mode switches
+typedef struct {
+    uint32_t r8_r12[2][5]; //[1] on FIQ mode, [0] on the others
 
-    uint32_t r13_mon;
-    uint32_t r14_mon;
+    uint32_t r13[ARM_BANKS];
+    uint32_t r14[ARM_BANKS];
 
-    uint32_t r13_abt;
-    uint32_t r14_abt;
+    uint32_t spsr[ARM_BANKS];
+} arm_bank_t;
 
-    uint32_t r13_und;
-    uint32_t r14_und;
+arm_bank_t arm_bank;
 
-    uint32_t cpsr;
+void (*arm_proc[2][4096])();
+void (*thumb_proc[2048])();
 
-    uint32_t spsr_fiq;
-    uint32_t spsr_irq;
-    uint32_t spsr_svc;
-    uint32_t spsr_abt;
-    uint32_t spsr_und;
-    uint32_t spsr_mon;
-} arm_regs_t;
+//Block cache
+#define ARM_BLK_PAGE_SHIFT   8
+#define ARM_BLK_WRAM_PAGES   (0x40000 >> ARM_BLK_PAGE_SHIFT)
+#define ARM_BLK_IWRAM_PAGES  (0x8000  >> ARM_BLK_PAGE_SHIFT)
+#define ARM_BLK_PAGES        (ARM_BLK_WRAM_PAGES + ARM_BLK_IWRAM_PAGES)
 
-arm_regs_t arm_r;
+uint32_t arm_blk_map[ARM_BLK_PAGES >> 5];
+uint32_t arm_blk_gen[ARM_BLK_PAGES + 1];
+
+bool arm_blk_dirty;
+
+bool arm_blk_enb;
+
+//ROM pre-decode
+bool arm_rom_enb;
+
+//Thumb superinstructions
+bool arm_fuse_enb;
+
+//Idle loop detection
+bool arm_idle_enb;
+
+uint32_t arm_idle_addr;   //Loop forced as idle by the user, 0 if none
+uint32_t arm_idle_writes; //Bumped by writes and reads with side effects
 
-uint32_t arm_op;
-uint32_t arm_pipe[2];
-uint32_t arm_cycles;
+//Copy loops
+bool arm_copy_enb;
 
-bool int_halt;
-bool pipe_reload;
+//Approximate timing, fixed costs instead of the wait states
+bool arm_fast_enb;
+
+//Thumb opcode pair profile
+bool arm_pair_enb;
 
 void arm_init();
 void arm_uninit();
@@ -118,4 +152,28 @@ void arm_int(uint32_t address, int8_t mode);
 
 void arm_check_irq();
 
-void arm_reset();
\ No newline at end of file
+void arm_flags_sync();
+
+void arm_fetch_inval();
+
+void arm_pipe_sync();
+
+void arm_op_repeat();
+
+void arm_blk_inval(uint32_t page);
+void arm_blk_flush();
+
+bool arm_blk_end(uint32_t op, bool thumb);
+
+void arm_rom_decode_all();
+void arm_rom_stats();
+
+void arm_idle_stats();
+
+void arm_copy_stats();
+
+void arm_pair_stats();
+
+void arm_reset();
+
+void arm_direct_boot();
\ No newline at end of file
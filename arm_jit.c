@@ -0,0 +1,1606 @@
+#define _DEFAULT_SOURCE
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "arm.h"
+#include "arm_jit.h"
+#include "arm_mem.h"
+
+#include "io.h"
+
+/*
+ * Dynamic recompiler
+ *
+ * Translates hot blocks of ARM/Thumb code running from work RAM or cartridge
+ * ROM into x86-64 code. Simple data processing and loads/stores to RAM (and
+ * loads from ROM) are emitted inline, with the guest registers most used
+ * by the block kept on host registers. Everything else calls the interpreter
+ * handler for that instruction, so the generated code never does less than
+ * arm_exec would. Cycles are counted exactly the same way, and the block
+ * exits once arm_r.cycles_target is reached, so no event is ever missed.
+ *
+ * Host registers:
+ * RBX = &arm_r, EBP = arm_r.cycles, R12D-R15D = cached guest registers.
+ */
+
+#if defined(__x86_64__) && !defined(_WIN32)
+
+#include <sys/mman.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS  MAP_ANON
+#endif
+
+#define ARM_JIT_COUNT    4096
+#define ARM_JIT_LEN      32
+#define ARM_JIT_HOT      16
+#define ARM_JIT_CODE_SZ  0x800000
+#define ARM_JIT_BLK_SZ   0x4000
+#define ARM_JIT_OPS      0x10000
+#define ARM_JIT_FIXUPS   256
+
+typedef struct {
+    void (*proc)();
+    uint32_t op;
+    uint32_t pipe[2];
+    uint32_t pc;
+    uint8_t  size;
+
+    const uint8_t *cycles;
+} arm_jit_op_t;
+
+typedef struct {
+    uint32_t pc; //R15 on entry, bit 0 set on Thumb
+    uint16_t hits;
+    bool     fail;
+
+    uint16_t page[2];
+    uint32_t gen[2];
+    uint32_t op[2];
+
+    void (*code)(uint32_t limit);
+} arm_jit_blk_t;
+
+static arm_jit_blk_t arm_jit_blk[ARM_JIT_COUNT];
+
+static arm_jit_op_t arm_jit_ops[ARM_JIT_OPS];
+static uint32_t     arm_jit_ops_cnt;
+
+static uint8_t *arm_jit_buf;
+static uint8_t *jit_ptr;
+
+static const uint8_t arm_jit_cyc_one = 1;
+
+//Statistics
+static uint32_t arm_jit_blocks;
+static uint32_t arm_jit_flushes;
+static uint32_t arm_jit_inlined;
+static uint32_t arm_jit_calls;
+
+/*
+ * x86-64 emitter
+ */
+
+#define X_AX   0
+#define X_CX   1
+#define X_DX   2
+#define X_BX   3
+#define X_SP   4
+#define X_BP   5
+#define X_SI   6
+#define X_DI   7
+#define X_R8   8
+#define X_R9   9
+#define X_R10  10
+#define X_R11  11
+#define X_R12  12
+
+//Condition codes
+#define X_CC_O   0x0
+#define X_CC_C   0x2
+#define X_CC_NC  0x3
+#define X_CC_Z   0x4
+#define X_CC_BE  0x6
+#define X_CC_S   0x8
+
+//Group 1 (op r/m32, imm)
+#define X_ADD  0
+#define X_OR   1
+#define X_AND  4
+#define X_SUB  5
+#define X_XOR  6
+#define X_CMP  7
+
+//Group 1 (op r/m32, r32)
+#define X_ADD_RR   0x01
+#define X_OR_RR    0x09
+#define X_AND_RR   0x21
+#define X_SUB_RR   0x29
+#define X_XOR_RR   0x31
+#define X_TEST_RR  0x85
+#define X_MOV_RR   0x89
+
+//Group 2 (shifts)
+#define X_ROR  1
+#define X_SHL  4
+#define X_SHR  5
+#define X_SAR  7
+
+static void x_byte(uint8_t value) {
+    *jit_ptr++ = value;
+}
+
+static void x_dword(uint32_t value) {
+    memcpy(jit_ptr, &value, 4);
+
+    jit_ptr += 4;
+}
+
+static void x_qword(uint64_t value) {
+    memcpy(jit_ptr, &value, 8);
+
+    jit_ptr += 8;
+}
+
+static void x_rex(bool w, uint8_t r, uint8_t x, uint8_t b) {
+    uint8_t rex = 0x40 | (w << 3) | ((r >> 3) << 2) | ((x >> 3) << 1) | (b >> 3);
+
+    if (rex != 0x40) x_byte(rex);
+}
+
+static void x_modrm(uint8_t mod, uint8_t reg, uint8_t rm) {
+    x_byte((mod << 6) | ((reg & 7) << 3) | (rm & 7));
+}
+
+//[base + disp]
+static void x_mem(uint8_t reg, uint8_t base, int32_t disp) {
+    bool d8 = disp == (int8_t)disp;
+
+    x_modrm(d8 ? 1 : 2, reg, base);
+
+    if ((base & 7) == X_SP) x_byte(0x24);
+
+    if (d8)
+        x_byte(disp);
+    else
+        x_dword(disp);
+}
+
+//[base + index]
+static void x_mem_idx(uint8_t reg, uint8_t base, uint8_t index) {
+    x_modrm(1, reg, X_SP);
+    x_byte(((index & 7) << 3) | (base & 7));
+    x_byte(0);
+}
+
+static void x_rr(uint8_t opc, uint8_t dst, uint8_t src) {
+    x_rex(false, src, 0, dst);
+    x_byte(opc);
+    x_modrm(3, src, dst);
+}
+
+static void x_ri(uint8_t ext, uint8_t dst, uint32_t imm) {
+    x_rex(false, 0, 0, dst);
+
+    if ((int32_t)imm == (int8_t)imm) {
+        x_byte(0x83);
+        x_modrm(3, ext, dst);
+        x_byte(imm);
+    } else {
+        x_byte(0x81);
+        x_modrm(3, ext, dst);
+        x_dword(imm);
+    }
+}
+
+//op r32, [base + disp] (0x8b MOV, 0x03 ADD, 0x3b CMP) or op [base + disp], r32 (0x89 MOV)
+static void x_rm(uint8_t opc, uint8_t reg, uint8_t base, int32_t disp) {
+    x_rex(false, reg, 0, base);
+    x_byte(opc);
+    x_mem(reg, base, disp);
+}
+
+static void x_mov_ri(uint8_t dst, uint32_t imm) {
+    x_rex(false, 0, 0, dst);
+    x_byte(0xb8 + (dst & 7));
+    x_dword(imm);
+}
+
+static void x_mov_ri64(uint8_t dst, const void *ptr) {
+    x_rex(true, 0, 0, dst);
+    x_byte(0xb8 + (dst & 7));
+    x_qword((uintptr_t)ptr);
+}
+
+static void x_load_idx(uint8_t size, uint8_t dst, uint8_t base, uint8_t index) {
+    x_rex(false, dst, index, base);
+
+    switch (size) {
+        case 1: x_byte(0x0f); x_byte(0xb6); break;
+        case 2: x_byte(0x0f); x_byte(0xb7); break;
+        case 4: x_byte(0x8b); break;
+    }
+
+    x_mem_idx(dst, base, index);
+}
+
+static void x_store_idx(uint8_t size, uint8_t src, uint8_t base, uint8_t index) {
+    if (size == 2) x_byte(0x66);
+
+    x_rex(false, src, index, base);
+    x_byte(size == 1 ? 0x88 : 0x89);
+    x_mem_idx(src, base, index);
+}
+
+static void x_movzx8(uint8_t dst, uint8_t src) {
+    x_rex(false, dst, 0, src);
+    x_byte(0x0f);
+    x_byte(0xb6);
+    x_modrm(3, dst, src);
+}
+
+//MOVZX r32, BYTE [base]
+static void x_movzx8_mem(uint8_t dst, uint8_t base) {
+    x_rex(false, dst, 0, base);
+    x_byte(0x0f);
+    x_byte(0xb6);
+    x_mem(dst, base, 0);
+}
+
+static void x_setcc(uint8_t cc, uint8_t dst) {
+    x_rex(false, 0, 0, dst);
+    x_byte(0x0f);
+    x_byte(0x90 | cc);
+    x_modrm(3, 0, dst);
+}
+
+static void x_shift(uint8_t ext, uint8_t dst, uint8_t imm) {
+    x_rex(false, 0, 0, dst);
+    x_byte(0xc1);
+    x_modrm(3, ext, dst);
+    x_byte(imm);
+}
+
+static void x_shift_cl(uint8_t ext, uint8_t dst) {
+    x_rex(false, 0, 0, dst);
+    x_byte(0xd3);
+    x_modrm(3, ext, dst);
+}
+
+static void x_not(uint8_t dst) {
+    x_rex(false, 0, 0, dst);
+    x_byte(0xf7);
+    x_modrm(3, 2, dst);
+}
+
+static void x_bt_ri(uint8_t dst, uint8_t bit) {
+    x_rex(false, 0, 0, dst);
+    x_byte(0x0f);
+    x_byte(0xba);
+    x_modrm(3, 4, dst);
+    x_byte(bit);
+}
+
+static void x_bt_rr(uint8_t dst, uint8_t bit) {
+    x_rex(false, bit, 0, dst);
+    x_byte(0x0f);
+    x_byte(0xa3);
+    x_modrm(3, bit, dst);
+}
+
+//BT [base], bit (bit string, any offset)
+static void x_bt_mr(uint8_t base, uint8_t bit) {
+    x_rex(false, bit, 0, base);
+    x_byte(0x0f);
+    x_byte(0xa3);
+    x_mem(bit, base, 0);
+}
+
+static void x_push(uint8_t reg) {
+    x_rex(false, 0, 0, reg);
+    x_byte(0x50 + (reg & 7));
+}
+
+static void x_pop(uint8_t reg) {
+    x_rex(false, 0, 0, reg);
+    x_byte(0x58 + (reg & 7));
+}
+
+static uint8_t *x_jcc(uint8_t cc) {
+    x_byte(0x0f);
+    x_byte(0x80 | cc);
+    x_dword(0);
+
+    return jit_ptr - 4;
+}
+
+static uint8_t *x_jmp() {
+    x_byte(0xe9);
+    x_dword(0);
+
+    return jit_ptr - 4;
+}
+
+static void x_patch(uint8_t *at, uint8_t *target) {
+    int32_t rel = target - (at + 4);
+
+    memcpy(at, &rel, 4);
+}
+
+static void x_call(const void *fn) {
+    x_mov_ri64(X_AX, fn);
+    x_byte(0xff);
+    x_byte(0xd0);
+}
+
+/*
+ * Translation
+ */
+
+//Stack frame
+#define JIT_LIMIT  0
+#define JIT_COST   4
+#define JIT_NADJ   8
+#define JIT_FRAME  24
+
+#define JIT_R(n)   (offsetof(arm_regs_t, r) + (n) * 4)
+#define JIT_CPSR   offsetof(arm_regs_t, cpsr)
+
+//Carry flag source for jit_flags
+#define JIT_C_KEEP  0
+#define JIT_C_R8    1
+#define JIT_C_CLR   2
+#define JIT_C_SET   3
+
+typedef enum {
+    JIT_CALL,
+
+    //Thumb
+    T16_SHIFT,
+    T16_MOV_RD3,
+    T16_ADDSUB,
+    T16_IMM8,
+    T16_ALU,
+    T16_HI,
+    T16_LDR_PC,
+    T16_MEM_REG,
+    T16_MEM_IMM,
+    T16_MEM_SP,
+    T16_ADR,
+    T16_ADD_SP8,
+    T16_SP7,
+    T16_BL_H2,
+
+    //ARM
+    ARM_DP_IMM,
+    ARM_DP_REGI,
+    ARM_MEM_IMM
+} jit_class_e;
+
+static bool     jit_rom;
+static uint8_t  jit_size;
+static uint32_t jit_pc;
+static uint8_t  jit_cost;
+static uint8_t  jit_host[16];
+
+static const uint8_t *jit_cycles;
+static const uint8_t *jit_cost_s;
+static const uint8_t *jit_cost_n;
+
+static uint8_t *jit_exit_fix[ARM_JIT_FIXUPS];
+static uint8_t  jit_exit_idx[ARM_JIT_FIXUPS];
+static uint32_t jit_exit_cnt;
+
+static uint8_t *jit_raw_fix[ARM_JIT_FIXUPS];
+static uint32_t jit_raw_cnt;
+
+//Runs one instruction through the interpreter, returns the new cycle limit or 0 to leave the block
+static uint32_t arm_jit_step(arm_jit_op_t *op) {
+    arm_r.cycles_step = arm_r.cycles;
+
+    arm_r.op      = op->op;
+    arm_r.pipe[0] = op->pipe[0];
+    arm_r.pipe[1] = op->pipe[1];
+    arm_r.r[15] = op->pc;
+    arm_r.cycles += *op->cycles;
+
+    op->proc();
+
+    //Compiled code reads and writes NZCV on the CPSR directly
+    arm_flags_sync();
+
+    bool branch = arm_r.pipe_reload;
+
+    if (arm_r.pipe_reload)
+        arm_r.pipe_reload = false;
+    else
+        arm_r.r[15] += op->size;
+
+    if (arm_r.int_halt) arm_r.cycles = arm_r.cycles_target;
+
+    if (branch || arm_r.pipe_reload || arm_blk_dirty) return 0;
+
+    //Handlers may schedule an earlier event (e.g. starting a timer)
+    return arm_r.cycles_target;
+}
+
+static void jit_exit_add(uint8_t *at, uint8_t idx) {
+    jit_exit_fix[jit_exit_cnt] = at;
+    jit_exit_idx[jit_exit_cnt] = idx;
+
+    jit_exit_cnt++;
+}
+
+static void jit_raw_add(uint8_t *at) {
+    jit_raw_fix[jit_raw_cnt++] = at;
+}
+
+static void jit_get(uint8_t dst, uint8_t reg) {
+    if (reg == 15)
+        x_mov_ri(dst, jit_pc);
+    else if (jit_host[reg])
+        x_rr(X_MOV_RR, dst, jit_host[reg]);
+    else
+        x_rm(0x8b, dst, X_BX, JIT_R(reg));
+}
+
+static void jit_put(uint8_t reg, uint8_t src) {
+    if (jit_host[reg])
+        x_rr(X_MOV_RR, jit_host[reg], src);
+    else
+        x_rm(0x89, src, X_BX, JIT_R(reg));
+}
+
+static void jit_regs_store() {
+    uint8_t reg;
+
+    for (reg = 0; reg < 15; reg++) {
+        if (jit_host[reg]) x_rm(0x89, jit_host[reg], X_BX, JIT_R(reg));
+    }
+}
+
+static void jit_regs_load() {
+    uint8_t reg;
+
+    for (reg = 0; reg < 15; reg++) {
+        if (jit_host[reg]) x_rm(0x8b, jit_host[reg], X_BX, JIT_R(reg));
+    }
+}
+
+//Wait states can change on any I/O write, so ROM fetch costs are reloaded after calls
+static void jit_cost_load() {
+    if (!jit_rom) return;
+
+    x_mov_ri64(X_DX, jit_cost_s);
+    x_movzx8_mem(X_CX, X_DX);
+    x_rm(0x89, X_CX, X_SP, JIT_COST);
+    x_mov_ri64(X_DX, jit_cost_n);
+    x_movzx8_mem(X_SI, X_DX);
+    x_rr(X_SUB_RR, X_SI, X_CX);
+    x_rm(0x89, X_SI, X_SP, JIT_NADJ);
+}
+
+static void jit_add_cost() {
+    if (jit_rom)
+        x_rm(0x03, X_BP, X_SP, JIT_COST);
+    else
+        x_ri(X_ADD, X_BP, jit_cost);
+}
+
+//Loads and stores outside the CPU bus are N cycles when code runs from ROM
+static void jit_add_nadj() {
+    if (jit_rom) x_rm(0x03, X_BP, X_SP, JIT_NADJ);
+}
+
+static void jit_call(arm_jit_op_t *op) {
+    jit_regs_store();
+
+    x_mov_ri64(X_DX, &arm_r.cycles);
+    x_rm(0x89, X_BP, X_DX, 0);
+    x_mov_ri64(X_DI, op);
+    x_call(arm_jit_step);
+    x_rm(0x89, X_AX, X_SP, JIT_LIMIT);
+    x_mov_ri64(X_DX, &arm_r.cycles);
+    x_rm(0x8b, X_BP, X_DX, 0);
+
+    jit_regs_load();
+    jit_cost_load();
+
+    x_rr(0x39, X_AX, X_BP); //CMP EAX, EBP
+    jit_raw_add(x_jcc(X_CC_BE));
+
+    arm_jit_calls++;
+}
+
+static void jit_flag_or(uint8_t reg, uint8_t bit) {
+    x_movzx8(reg, reg);
+    x_shift(X_SHL, reg, bit);
+    x_rr(X_OR_RR, X_DX, reg);
+}
+
+//Sets N and Z from EAX, C as selected and V from R9B
+static void jit_flags(uint8_t c, bool v) {
+    uint32_t keep = ~(ARM_N | ARM_Z);
+
+    if (c != JIT_C_KEEP) keep &= ~ARM_C;
+    if (v)               keep &= ~ARM_V;
+
+    x_rr(X_TEST_RR, X_AX, X_AX);
+    x_setcc(X_CC_S, X_R10);
+    x_setcc(X_CC_Z, X_R11);
+    x_rm(0x8b, X_DX, X_BX, JIT_CPSR);
+    x_ri(X_AND, X_DX, keep);
+
+    if (c == JIT_C_SET) x_ri(X_OR, X_DX, ARM_C);
+
+    jit_flag_or(X_R10, 31);
+    jit_flag_or(X_R11, 30);
+
+    if (c == JIT_C_R8) jit_flag_or(X_R8, 29);
+    if (v)             jit_flag_or(X_R9, 28);
+
+    x_rm(0x89, X_DX, X_BX, JIT_CPSR);
+}
+
+//EAX = EAX +/- ECX, with the ARM carry on R8B and overflow on R9B
+static void jit_arith(bool sub) {
+    x_rr(sub ? X_SUB_RR : X_ADD_RR, X_AX, X_CX);
+    x_setcc(sub ? X_CC_NC : X_CC_C, X_R8);
+    x_setcc(X_CC_O, X_R9);
+}
+
+//Shifts by an immediate the same way as arm_data_regi, except RRX
+static uint8_t jit_shift_imm(uint8_t reg, uint8_t type, uint8_t sh) {
+    if (type == 0 && sh == 0) return JIT_C_KEEP;
+
+    if ((type == 1 || type == 2) && sh == 0) sh = 32;
+
+    x_bt_ri(reg, type == 0 ? 32 - sh : sh - 1);
+    x_setcc(X_CC_C, X_R8);
+
+    switch (type) {
+        case 0: x_shift(X_SHL, reg, sh); break;
+        case 2: x_shift(X_SAR, reg, sh == 32 ? 31 : sh); break;
+        case 3: x_shift(X_ROR, reg, sh); break;
+
+        case 1:
+            if (sh == 32)
+                x_rr(X_XOR_RR, reg, reg);
+            else
+                x_shift(X_SHR, reg, sh);
+        break;
+    }
+
+    return JIT_C_R8;
+}
+
+//Evaluates arm_cond for all 16 NZCV combinations
+static uint16_t jit_cond_mask(uint8_t cond) {
+    uint16_t mask = 0;
+    uint8_t nzcv;
+
+    for (nzcv = 0; nzcv < 16; nzcv++) {
+        bool n = nzcv & 8;
+        bool z = nzcv & 4;
+        bool c = nzcv & 2;
+        bool v = nzcv & 1;
+        bool res;
+
+        switch (cond >> 1) {
+            case 0: res = z; break;
+            case 1: res = c; break;
+            case 2: res = n; break;
+            case 3: res = v; break;
+            case 4: res = c && !z; break;
+            case 5: res = n == v; break;
+            case 6: res = !z && n == v; break;
+            default: res = true; break;
+        }
+
+        if (cond & 1) res = !res;
+
+        if (res) mask |= 1 << nzcv;
+    }
+
+    return mask;
+}
+
+static uint8_t *jit_cond(uint8_t cond) {
+    x_rm(0x8b, X_AX, X_BX, JIT_CPSR);
+    x_shift(X_SHR, X_AX, 28);
+    x_mov_ri(X_DX, jit_cond_mask(cond));
+    x_bt_rr(X_DX, X_AX);
+
+    return x_jcc(X_CC_NC);
+}
+
+//RSI = base, EAX = offset, cycles for the access itself
+static uint8_t *jit_mem_ram(uint8_t *base, uint32_t mask, uint32_t page, uint8_t cycles, bool load) {
+    uint8_t *slow = NULL;
+
+    x_mov_ri64(X_SI, base);
+    x_rr(X_MOV_RR, X_AX, X_CX);
+    x_ri(X_AND, X_AX, mask);
+
+    if (load) {
+        x_mov_ri64(X_DX, &io_open_bus);
+        x_byte(0xc6);
+        x_mem(0, X_DX, 0);
+        x_byte(0);
+
+        cycles++;
+    } else {
+        //Stores to pages holding translated code go through arm_write to invalidate them
+        x_rr(X_MOV_RR, X_DX, X_AX);
+        x_shift(X_SHR, X_DX, ARM_BLK_PAGE_SHIFT);
+
+        if (page) x_ri(X_ADD, X_DX, page);
+
+        x_mov_ri64(X_DI, arm_blk_map);
+        x_bt_mr(X_DI, X_DX);
+
+        slow = x_jcc(X_CC_C);
+    }
+
+    x_ri(X_ADD, X_BP, cycles);
+
+    return slow;
+}
+
+//Adds 1 + ws[idx] for the access at ECX + offset
+//Cost of a non sequential access to the address on ECX, wait states can change at run time
+static void jit_mem_ws(uint8_t size) {
+    x_rr(X_MOV_RR, X_DX, X_CX);
+    x_shift(X_SHR, X_DX, 24);
+    x_ri(X_AND, X_DX, 0xf);
+    x_mov_ri64(X_DI, ws_cost[size >> 1][NON_SEQ]);
+    x_load_idx(1, X_DX, X_DI, X_DX);
+    x_rr(X_ADD_RR, X_BP, X_DX);
+}
+
+/*
+ * Load/store with the address on ECX and the base to write back (if any) on R8D.
+ * Work RAM is accessed directly, and so is ROM for loads, anything else runs the
+ * whole instruction through the interpreter.
+ */
+static void jit_mem(arm_jit_op_t *call, uint8_t size, bool load, uint8_t rt, int8_t wb) {
+    uint32_t align = ~(size - 1);
+    uint8_t *slow[4], *go[3], *fix_ew, *fix_iw, *fix_rom = NULL;
+    uint8_t n_slow = 0, n_go = 0, i;
+
+    x_rr(X_MOV_RR, X_DX, X_CX);
+    x_shift(X_SHR, X_DX, 24);
+    x_ri(X_CMP, X_DX, 2);
+    fix_ew = x_jcc(X_CC_Z);
+    x_ri(X_CMP, X_DX, 3);
+    fix_iw = x_jcc(X_CC_Z);
+
+    if (load) {
+        x_ri(X_SUB, X_DX, 8);
+        x_ri(X_CMP, X_DX, 3);
+        fix_rom = x_jcc(X_CC_BE);
+    }
+
+    slow[n_slow++] = x_jmp();
+
+    x_patch(fix_ew, jit_ptr);
+
+    if ((slow[n_slow] = jit_mem_ram(wram, 0x3ffff & align, 0, ws_cost[size >> 1][NON_SEQ][0x2], load)))
+        n_slow++;
+
+    go[n_go++] = x_jmp();
+
+    x_patch(fix_iw, jit_ptr);
+
+    if ((slow[n_slow] = jit_mem_ram(iwram, 0x7fff & align, ARM_BLK_WRAM_PAGES, ws_cost[size >> 1][NON_SEQ][0x3], load)))
+        n_slow++;
+
+    if (load) {
+        go[n_go++] = x_jmp();
+
+        x_patch(fix_rom, jit_ptr);
+
+        x_mov_ri64(X_SI, rom);
+        x_rr(X_MOV_RR, X_AX, X_CX);
+        x_ri(X_AND, X_AX, cart_rom_mask & align);
+
+        jit_mem_ws(size);
+
+        x_ri(X_ADD, X_BP, 1);
+    }
+
+    for (i = 0; i < n_go; i++) x_patch(go[i], jit_ptr);
+
+    jit_add_cost();
+    jit_add_nadj();
+
+    //Stores use the value from before the write back, Rn may be Rd
+    if (!load) jit_get(X_DX, rt);
+
+    if (wb >= 0) jit_put(wb, X_R8);
+
+    if (load) {
+        x_load_idx(size, X_DX, X_SI, X_AX);
+
+        //Unaligned loads are rotated
+        if (size > 1) {
+            x_ri(X_AND, X_CX, size - 1);
+            x_shift(X_SHL, X_CX, 3);
+            x_shift_cl(X_ROR, X_DX);
+        }
+
+        jit_put(rt, X_DX);
+    } else {
+        x_store_idx(size, X_DX, X_SI, X_AX);
+
+        //inc dword [arm_idle_writes]
+        x_mov_ri64(X_DI, &arm_idle_writes);
+        x_byte(0xff);
+        x_mem(0, X_DI, 0);
+    }
+
+    uint8_t *done = x_jmp();
+
+    for (i = 0; i < n_slow; i++) x_patch(slow[i], jit_ptr);
+
+    jit_call(call);
+
+    x_patch(done, jit_ptr);
+}
+
+//Load/store to an address known at translation time (PC relative)
+static void jit_mem_const(arm_jit_op_t *call, uint32_t addr, uint8_t size, bool load, uint8_t rt) {
+    uint8_t region = addr >> 24;
+
+    if (load && size == 4 && region >= 0x8 && region <= 0xb && !(addr & 3)) {
+        uint32_t value = 0;
+        uint8_t i;
+
+        for (i = 0; i < 4; i++)
+            value |= rom[(addr | i) & cart_rom_mask] << (i * 8);
+
+        x_mov_ri(X_CX, addr);
+        jit_mem_ws(size);
+        x_ri(X_ADD, X_BP, 1);
+
+        jit_add_cost();
+        jit_add_nadj();
+
+        x_mov_ri(X_DX, value);
+        jit_put(rt, X_DX);
+    } else {
+        x_mov_ri(X_CX, addr);
+        jit_mem(call, size, load, rt, -1);
+    }
+}
+
+/*
+ * Instruction selection
+ *
+ * Instructions are identified by their interpreter handler, so encodings the
+ * decode tables map somewhere unusual are never emitted inline by mistake.
+ */
+
+#define JIT_COND_AL      0b1110
+#define JIT_COND_UNCOND  0b1111
+
+#define T16_IS(canon)  (proc == thumb_proc[(canon) >> 5])
+#define ARM_IS(canon)  (proc == arm_proc[0][arm_jit_idx(canon)])
+
+static uint32_t arm_jit_idx(uint32_t op) {
+    return ((op >> 16) & 0xff0) | ((op >> 4) & 0xf);
+}
+
+static jit_class_e jit_t16_class(uint32_t op) {
+    void (*proc)() = thumb_proc[op >> 5];
+
+    if (T16_IS(0x0000)) return T16_MOV_RD3;
+
+    if (T16_IS(0x0040) || T16_IS(0x0800) || T16_IS(0x1000)) return T16_SHIFT;
+
+    if (T16_IS(0x1800) || T16_IS(0x1a00) ||
+        T16_IS(0x1c00) || T16_IS(0x1e00)) return T16_ADDSUB;
+
+    if (T16_IS(0x2000) || T16_IS(0x2800) ||
+        T16_IS(0x3000) || T16_IS(0x3800)) return T16_IMM8;
+
+    if (T16_IS(0x4000) || T16_IS(0x4040) || T16_IS(0x4200) ||
+        T16_IS(0x4240) || T16_IS(0x4280) || T16_IS(0x42c0) ||
+        T16_IS(0x4300) || T16_IS(0x4380) || T16_IS(0x43c0)) return T16_ALU;
+
+    uint8_t rd = (op & 7) | ((op >> 4) & 8);
+
+    if (T16_IS(0x4500) || ((T16_IS(0x4400) || T16_IS(0x4600)) && rd != 15))
+        return T16_HI;
+
+    if (T16_IS(0x4800)) return T16_LDR_PC;
+
+    if (T16_IS(0x5000) || T16_IS(0x5200) || T16_IS(0x5400) ||
+        T16_IS(0x5800) || T16_IS(0x5a00) || T16_IS(0x5c00)) return T16_MEM_REG;
+
+    if (T16_IS(0x6000) || T16_IS(0x6800) || T16_IS(0x7000) ||
+        T16_IS(0x7800) || T16_IS(0x8000) || T16_IS(0x8800)) return T16_MEM_IMM;
+
+    if (T16_IS(0x9000) || T16_IS(0x9800)) return T16_MEM_SP;
+    if (T16_IS(0xa000)) return T16_ADR;
+    if (T16_IS(0xa800)) return T16_ADD_SP8;
+    if (T16_IS(0xb000) || T16_IS(0xb080)) return T16_SP7;
+    if (T16_IS(0xf000)) return T16_BL_H2;
+
+    return JIT_CALL;
+}
+
+static jit_class_e jit_arm_class(uint32_t op) {
+    if ((op >> 28) == JIT_COND_UNCOND) return JIT_CALL;
+
+    void (*proc)() = arm_proc[0][arm_jit_idx(op)];
+
+    uint8_t  opc = (op >> 21) & 0xf;
+    uint8_t  rd  = (op >> 12) & 0xf;
+    uint8_t  rn  = (op >> 16) & 0xf;
+    uint32_t s   = (opc >= 8 && opc <= 11) ? 1 << 20 : op & (1 << 20);
+
+    //ADC, SBC and RSC are left to the interpreter
+    if ((opc < 5 || opc > 7) && rd != 15) {
+        if (ARM_IS(0x02000000 | (opc << 21) | s)) return ARM_DP_IMM;
+
+        //RRX is left to the interpreter
+        if (ARM_IS(0x00000000 | (opc << 21) | s | (op & 0x60)) &&
+            (op & 0xfe0) != 0x060)
+            return ARM_DP_REGI;
+    }
+
+    uint32_t canon = 0x05800000 | (op & 0x00500000);
+
+    if ((op & 0x0e000000) == 0x04000000 && ARM_IS(canon) && rd != 15) {
+        bool w = (op >> 21) & 1;
+        bool p = (op >> 24) & 1;
+
+        if (rn != 15 || (p && !w)) return ARM_MEM_IMM;
+    }
+
+    return JIT_CALL;
+}
+
+//Guest register usage, to pick the ones kept on host registers
+static void jit_count(uint32_t op, jit_class_e cls, uint8_t *cnt) {
+    switch (cls) {
+        case T16_ADDSUB:
+            if (!(op & 0x400)) cnt[(op >> 6) & 7]++;
+        case T16_SHIFT:
+        case T16_MOV_RD3:
+        case T16_ALU:
+        case T16_MEM_IMM:
+            cnt[(op >> 0) & 7]++;
+            cnt[(op >> 3) & 7]++;
+        break;
+
+        case T16_MEM_REG:
+            cnt[(op >> 0) & 7]++;
+            cnt[(op >> 3) & 7]++;
+            cnt[(op >> 6) & 7]++;
+        break;
+
+        case T16_MEM_SP:
+        case T16_ADD_SP8:
+            cnt[13]++;
+        case T16_IMM8:
+        case T16_LDR_PC:
+        case T16_ADR:
+            cnt[(op >> 8) & 7]++;
+        break;
+
+        case T16_SP7:   cnt[13]++; break;
+        case T16_BL_H2: cnt[14]++; break;
+
+        case T16_HI:
+            cnt[(op & 7) | ((op >> 4) & 8)]++;
+            cnt[(op >> 3) & 0xf]++;
+        break;
+
+        case ARM_DP_REGI:
+            cnt[op & 0xf]++;
+        case ARM_DP_IMM:
+        case ARM_MEM_IMM:
+            cnt[(op >> 12) & 0xf]++;
+            cnt[(op >> 16) & 0xf]++;
+        break;
+
+        case JIT_CALL: break;
+    }
+}
+
+static void jit_t16(uint32_t op, jit_class_e cls, arm_jit_op_t *call) {
+    void (*proc)() = thumb_proc[op >> 5];
+
+    uint8_t  rd   = (op >> 0) & 7;
+    uint8_t  rn   = (op >> 3) & 7;
+    uint8_t  rm   = (op >> 6) & 7;
+    uint8_t  ri   = (op >> 8) & 7;
+    uint32_t imm8 = (op >> 0) & 0xff;
+
+    switch (cls) {
+        case T16_MOV_RD3:
+            jit_add_cost();
+            jit_get(X_AX, rn);
+            jit_put(rd, X_AX);
+            jit_flags(JIT_C_KEEP, false);
+        break;
+
+        case T16_SHIFT:
+            jit_add_cost();
+            jit_get(X_AX, rn);
+            jit_shift_imm(X_AX, (op >> 11) & 3, (op >> 6) & 0x1f);
+            jit_put(rd, X_AX);
+            jit_flags(JIT_C_R8, false);
+        break;
+
+        case T16_ADDSUB:
+            jit_add_cost();
+            jit_get(X_AX, rn);
+
+            if (op & 0x400)
+                x_mov_ri(X_CX, rm);
+            else
+                jit_get(X_CX, rm);
+
+            jit_arith(op & 0x200);
+            jit_put(rd, X_AX);
+            jit_flags(JIT_C_R8, true);
+        break;
+
+        case T16_IMM8: {
+            uint8_t kind = (op >> 11) & 3;
+
+            jit_add_cost();
+
+            if (kind == 0) { //MOV
+                x_mov_ri(X_AX, imm8);
+                jit_put(ri, X_AX);
+                jit_flags(JIT_C_KEEP, false);
+            } else {
+                jit_get(X_AX, ri);
+                x_mov_ri(X_CX, imm8);
+                jit_arith(kind != 2);
+
+                if (kind != 1) jit_put(ri, X_AX);
+
+                jit_flags(JIT_C_R8, true);
+            }
+        }
+        break;
+
+        case T16_ALU: {
+            uint8_t kind = (op >> 6) & 0xf;
+
+            jit_add_cost();
+
+            switch (kind) {
+                case 0x9: //NEG
+                    x_rr(X_XOR_RR, X_AX, X_AX);
+                    jit_get(X_CX, rn);
+                    jit_arith(true);
+                    jit_put(rd, X_AX);
+                    jit_flags(JIT_C_R8, true);
+                break;
+
+                case 0xa: //CMP
+                case 0xb: //CMN
+                    jit_get(X_AX, rd);
+                    jit_get(X_CX, rn);
+                    jit_arith(kind == 0xa);
+                    jit_flags(JIT_C_R8, true);
+                break;
+
+                case 0xf: //MVN
+                    jit_get(X_AX, rn);
+                    x_not(X_AX);
+                    jit_put(rd, X_AX);
+                    jit_flags(JIT_C_CLR, false);
+                break;
+
+                default: //AND, EOR, TST, ORR, BIC
+                    jit_get(X_AX, rd);
+                    jit_get(X_CX, rn);
+
+                    switch (kind) {
+                        case 0x1: x_rr(X_XOR_RR, X_AX, X_CX); break;
+                        case 0xc: x_rr(X_OR_RR,  X_AX, X_CX); break;
+
+                        case 0xe: x_not(X_CX);
+                        default:  x_rr(X_AND_RR, X_AX, X_CX); break;
+                    }
+
+                    if (kind != 0x8) jit_put(rd, X_AX);
+
+                    //Thumb logical operations clear the carry (no shifter output)
+                    jit_flags(JIT_C_CLR, false);
+                break;
+            }
+        }
+        break;
+
+        case T16_HI: {
+            uint8_t rdh = (op & 7) | ((op >> 4) & 8);
+            uint8_t rmh = (op >> 3) & 0xf;
+
+            jit_add_cost();
+
+            switch ((op >> 8) & 3) {
+                case 0: //ADD
+                    jit_get(X_AX, rdh);
+                    jit_get(X_CX, rmh);
+                    x_rr(X_ADD_RR, X_AX, X_CX);
+                    jit_put(rdh, X_AX);
+                break;
+
+                case 1: //CMP
+                    jit_get(X_AX, rdh);
+                    jit_get(X_CX, rmh);
+                    jit_arith(true);
+                    jit_flags(JIT_C_R8, true);
+                break;
+
+                case 2: //MOV
+                    jit_get(X_AX, rmh);
+                    jit_put(rdh, X_AX);
+                break;
+            }
+        }
+        break;
+
+        case T16_LDR_PC:
+            jit_mem_const(call, (jit_pc & ~3) + imm8 * 4, 4, true, ri);
+        break;
+
+        case T16_MEM_REG: {
+            static const uint8_t size_lut[8] = { 4, 2, 1, 0, 4, 2, 1, 0 };
+
+            uint8_t kind = (op >> 9) & 7;
+
+            jit_get(X_CX, rn);
+            jit_get(X_DX, rm);
+            x_rr(X_ADD_RR, X_CX, X_DX);
+            jit_mem(call, size_lut[kind], kind & 4, rd, -1);
+        }
+        break;
+
+        case T16_MEM_IMM: {
+            uint8_t kind = op >> 11;
+            uint8_t size = kind < 0xe ? 4 : (kind < 0x10 ? 1 : 2);
+            uint32_t imm = ((op >> 6) & 0x1f) * size;
+
+            jit_get(X_CX, rn);
+
+            if (imm) x_ri(X_ADD, X_CX, imm);
+
+            jit_mem(call, size, kind & 1, rd, -1);
+        }
+        break;
+
+        case T16_MEM_SP:
+            jit_get(X_CX, 13);
+
+            if (imm8) x_ri(X_ADD, X_CX, imm8 * 4);
+
+            jit_mem(call, 4, op & 0x800, ri, -1);
+        break;
+
+        case T16_ADR:
+            jit_add_cost();
+            x_mov_ri(X_AX, (jit_pc & ~3) + imm8 * 4);
+            jit_put(ri, X_AX);
+        break;
+
+        case T16_ADD_SP8:
+            jit_add_cost();
+            jit_get(X_AX, 13);
+
+            if (imm8) x_ri(X_ADD, X_AX, imm8 * 4);
+
+            jit_put(ri, X_AX);
+        break;
+
+        case T16_SP7:
+            jit_add_cost();
+            jit_get(X_AX, 13);
+            x_mov_ri(X_CX, (op & 0x7f) << 2);
+            jit_arith(T16_IS(0xb080));
+            jit_put(13, X_AX);
+            jit_flags(JIT_C_R8, true);
+        break;
+
+        case T16_BL_H2: {
+            int32_t imm = op;
+
+            imm <<= 21;
+            imm >>= 9;
+
+            jit_add_cost();
+            x_mov_ri(X_AX, jit_pc + imm);
+            jit_put(14, X_AX);
+        }
+        break;
+
+        default: break;
+    }
+}
+
+static void jit_arm(uint32_t op, jit_class_e cls, arm_jit_op_t *call) {
+    uint8_t rm  = (op >>  0) & 0xf;
+    uint8_t rd  = (op >> 12) & 0xf;
+    uint8_t rn  = (op >> 16) & 0xf;
+    uint8_t opc = (op >> 21) & 0xf;
+    bool    s   = (op >> 20) & 1;
+
+    if (cls == ARM_MEM_IMM) {
+        bool b = (op >> 22) & 1;
+        bool w = (op >> 21) & 1;
+        bool u = (op >> 23) & 1;
+        bool p = (op >> 24) & 1;
+
+        int32_t disp = u ? (op & 0xfff) : -(op & 0xfff);
+
+        if (rn == 15) {
+            jit_mem_const(call, (jit_pc & ~3) + disp, b ? 1 : 4, s, rd);
+
+            return;
+        }
+
+        jit_get(X_CX, rn);
+
+        if (!p || w) {
+            x_rr(X_MOV_RR, X_R8, X_CX);
+
+            if (disp) x_ri(X_ADD, X_R8, disp);
+        }
+
+        if (p && disp) x_ri(X_ADD, X_CX, disp);
+
+        jit_mem(call, b ? 1 : 4, s, rd, (!p || w) ? rn : -1);
+
+        return;
+    }
+
+    uint8_t c;
+
+    jit_add_cost();
+
+    if (cls == ARM_DP_IMM) {
+        uint32_t imm = op & 0xff;
+        uint8_t  rot = (op >> 7) & 0x1e;
+
+        if (rot) imm = ROR(imm, rot);
+
+        x_mov_ri(X_CX, imm);
+
+        c = (imm & 0x80000000) ? JIT_C_SET : JIT_C_CLR;
+    } else {
+        jit_get(X_CX, rm);
+
+        c = jit_shift_imm(X_CX, (op >> 5) & 3, (op >> 7) & 0x1f);
+    }
+
+    if (opc != 0xd && opc != 0xf) jit_get(X_AX, rn);
+
+    switch (opc) {
+        case 0x0: //AND
+        case 0x8: //TST
+            x_rr(X_AND_RR, X_AX, X_CX);
+        break;
+
+        case 0x1: //EOR
+        case 0x9: //TEQ
+            x_rr(X_XOR_RR, X_AX, X_CX);
+        break;
+
+        case 0x2: //SUB
+        case 0xa: //CMP
+            jit_arith(true);
+        break;
+
+        case 0x3: //RSB
+            x_rr(X_MOV_RR, X_DX, X_AX);
+            x_rr(X_MOV_RR, X_AX, X_CX);
+            x_rr(X_MOV_RR, X_CX, X_DX);
+            jit_arith(true);
+        break;
+
+        case 0x4: //ADD
+        case 0xb: //CMN
+            jit_arith(false);
+        break;
+
+        case 0xc: x_rr(X_OR_RR,  X_AX, X_CX); break;
+        case 0xd: x_rr(X_MOV_RR, X_AX, X_CX); break;
+
+        case 0xe: //BIC
+            x_not(X_CX);
+            x_rr(X_AND_RR, X_AX, X_CX);
+        break;
+
+        case 0xf: //MVN
+            x_rr(X_MOV_RR, X_AX, X_CX);
+            x_not(X_AX);
+        break;
+    }
+
+    if (opc < 8 || opc > 11) jit_put(rd, X_AX);
+
+    if (s) {
+        if (opc == 0x2 || opc == 0x3 || opc == 0x4 || opc == 0xa || opc == 0xb)
+            jit_flags(JIT_C_R8, true);
+        else
+            jit_flags(c, false);
+    }
+}
+
+/*
+ * Blocks
+ */
+
+static void arm_jit_flush() {
+    uint32_t i;
+
+    for (i = 0; i < ARM_JIT_COUNT; i++) {
+        arm_jit_blk[i].code = NULL;
+        arm_jit_blk[i].hits = 0;
+    }
+
+    jit_ptr = arm_jit_buf;
+
+    arm_jit_ops_cnt = 0;
+
+    arm_jit_flushes++;
+}
+
+static void jit_exit_stub(uint32_t *ops, uint8_t idx) {
+    x_rex(false, 0, 0, X_BX);
+    x_byte(0xc7);
+    x_mem(0, X_BX, JIT_R(15));
+    x_dword(jit_pc + jit_size);
+
+    x_mov_ri64(X_DX, arm_r.pipe);
+    x_byte(0xc7);
+    x_mem(0, X_DX, 0);
+    x_dword(ops[idx + 1]);
+    x_byte(0xc7);
+    x_mem(0, X_DX, 4);
+    x_dword(ops[idx + 2]);
+
+    x_mov_ri64(X_DX, &arm_r.op);
+    x_byte(0xc7);
+    x_mem(0, X_DX, 0);
+    x_dword(ops[idx]);
+
+    jit_raw_add(x_jmp());
+}
+
+static void arm_jit_compile(arm_jit_blk_t *blk) {
+    bool     thumb = blk->pc & 1;
+    uint8_t  size  = thumb ? ARM_HWORD_SZ : ARM_WORD_SZ;
+    uint32_t pc    = blk->pc & ~1;
+    uint32_t addr  = pc - size * 2;
+    uint32_t page  = ARM_BLK_PAGES;
+    uint32_t mask;
+    uint8_t *mem;
+
+    blk->fail = true;
+
+    if ((addr >> 24) != (pc >> 24)) return;
+
+    jit_rom = false;
+
+    switch (pc >> 24) {
+        case 0x2:
+            mem  = wram;
+            mask = 0x3ffff;
+            page = 0;
+
+            jit_cycles = &ws_wram_fetch[thumb ? 0 : 1];
+        break;
+
+        case 0x3:
+            mem  = iwram;
+            mask = 0x7fff;
+            page = ARM_BLK_WRAM_PAGES;
+
+            jit_cycles = &arm_jit_cyc_one;
+        break;
+
+        case 0x8:
+        case 0x9:
+        case 0xa:
+        case 0xb:
+        case 0xc:
+        case 0xd:
+            mem  = rom;
+            mask = 0x1ffffff;
+
+            jit_rom = true;
+
+            if (thumb) {
+                jit_cost_s = &ws_s_t16[(pc >> 25) & 3];
+                jit_cost_n = &ws_n_t16[(pc >> 25) & 3];
+            } else {
+                jit_cost_s = &ws_s_arm[(pc >> 25) & 3];
+                jit_cost_n = &ws_n_arm[(pc >> 25) & 3];
+            }
+
+            jit_cycles = jit_cost_s;
+        break;
+
+        default: return;
+    }
+
+    jit_cost = *jit_cycles;
+
+    uint32_t    ops[ARM_JIT_LEN + 2];
+    jit_class_e cls[ARM_JIT_LEN];
+    uint8_t     cnt[16] = { 0 };
+    uint8_t     i, n, len = 0, inlined = 0;
+
+    for (n = 0; n < ARM_JIT_LEN + 2; n++) {
+        uint32_t a = addr + n * size;
+
+        if ((a >> 24) != (pc >> 24)) break;
+
+        if (thumb)
+            ops[n] = *(uint16_t *)(mem + (a & mask));
+        else
+            ops[n] = *(uint32_t *)(mem + (a & mask));
+    }
+
+    while (len + 2 < n) {
+        uint32_t op = ops[len];
+
+        cls[len] = thumb ? jit_t16_class(op) : jit_arm_class(op);
+
+        if (cls[len] != JIT_CALL) inlined++;
+
+        jit_count(op, cls[len], cnt);
+
+        if (arm_blk_end(ops[len++], thumb)) break;
+    }
+
+    //Blocks are smaller than a page, so they can span at most 2 pages
+    blk->page[0] = page;
+    blk->page[1] = page;
+
+    if (page < ARM_BLK_PAGES) {
+        blk->page[0] += ((addr                    ) & mask) >> ARM_BLK_PAGE_SHIFT;
+        blk->page[1] += ((addr + (len + 1) * size) & mask) >> ARM_BLK_PAGE_SHIFT;
+
+        for (i = 0; i < 2; i++)
+            arm_blk_map[blk->page[i] >> 5] |= 1 << (blk->page[i] & 31);
+    }
+
+    blk->gen[0] = arm_blk_gen[blk->page[0]];
+    blk->gen[1] = arm_blk_gen[blk->page[1]];
+
+    //Not worth it if everything goes through the interpreter anyway
+    if (inlined == 0) return;
+
+    if (jit_ptr + ARM_JIT_BLK_SZ > arm_jit_buf + ARM_JIT_CODE_SZ ||
+        arm_jit_ops_cnt + ARM_JIT_LEN > ARM_JIT_OPS)
+        arm_jit_flush();
+
+    //Keep the 4 most used guest registers on R12D-R15D
+    memset(jit_host, 0, sizeof(jit_host));
+
+    for (i = 0; i < 4; i++) {
+        uint8_t reg, best = 15;
+
+        for (reg = 0; reg < 15; reg++) {
+            if (!jit_host[reg] && cnt[reg] >= 2 && (best == 15 || cnt[reg] > cnt[best]))
+                best = reg;
+        }
+
+        if (best == 15) break;
+
+        jit_host[best] = X_R12 + i;
+    }
+
+    jit_size     = size;
+    jit_exit_cnt = 0;
+    jit_raw_cnt  = 0;
+
+    uint8_t *code = jit_ptr;
+
+    //Prologue
+    x_push(X_BX);
+    x_push(X_BP);
+    x_push(X_R12 + 0);
+    x_push(X_R12 + 1);
+    x_push(X_R12 + 2);
+    x_push(X_R12 + 3);
+    x_byte(0x48); x_byte(0x83); x_modrm(3, X_SUB, X_SP); x_byte(JIT_FRAME);
+    x_rm(0x89, X_DI, X_SP, JIT_LIMIT);
+    x_mov_ri64(X_BX, &arm_r);
+    x_mov_ri64(X_DX, &arm_r.cycles);
+    x_rm(0x8b, X_BP, X_DX, 0);
+
+    jit_regs_load();
+    jit_cost_load();
+
+    for (i = 0; i < len; i++) {
+        uint32_t op = ops[i];
+
+        jit_pc = addr + i * size + size * 2;
+
+        arm_jit_op_t *call = &arm_jit_ops[arm_jit_ops_cnt++];
+
+        call->op      = op;
+        call->pipe[0] = ops[i + 1];
+        call->pipe[1] = ops[i + 2];
+        call->pc      = jit_pc;
+        call->size    = size;
+        call->cycles  = jit_cycles;
+
+        uint8_t *skip = NULL;
+
+        if (thumb) {
+            call->proc = thumb_proc[op >> 5];
+        } else {
+            uint8_t cond = op >> 28;
+
+            call->proc = arm_proc[cond == JIT_COND_UNCOND][arm_jit_idx(op)];
+
+            if (cond < JIT_COND_AL) skip = jit_cond(cond);
+        }
+
+        if (cls[i] == JIT_CALL)
+            jit_call(call);
+        else if (thumb)
+            jit_t16(op, cls[i], call);
+        else
+            jit_arm(op, cls[i], call);
+
+        if (skip) {
+            uint8_t *done = x_jmp();
+
+            x_patch(skip, jit_ptr);
+            jit_add_cost();
+            x_patch(done, jit_ptr);
+        }
+
+        if (i + 1 < len) {
+            x_rm(0x3b, X_BP, X_SP, JIT_LIMIT);
+            jit_exit_add(x_jcc(X_CC_NC), i);
+        } else {
+            jit_exit_add(x_jmp(), i);
+        }
+    }
+
+    //Exits, with R15 and the pipeline as if the interpreter ran up to there
+    uint8_t *stub[ARM_JIT_LEN] = { NULL };
+
+    for (i = 0; i < jit_exit_cnt; i++) {
+        uint8_t idx = jit_exit_idx[i];
+
+        if (stub[idx] == NULL) {
+            stub[idx] = jit_ptr;
+
+            jit_pc = addr + idx * size + size * 2;
+
+            jit_exit_stub(ops, idx);
+        }
+
+        x_patch(jit_exit_fix[i], stub[idx]);
+    }
+
+    for (i = 0; i < jit_raw_cnt; i++) x_patch(jit_raw_fix[i], jit_ptr);
+
+    //Epilogue
+    jit_regs_store();
+    x_mov_ri64(X_DX, &arm_r.cycles);
+    x_rm(0x89, X_BP, X_DX, 0);
+    x_byte(0x48); x_byte(0x83); x_modrm(3, X_ADD, X_SP); x_byte(JIT_FRAME);
+    x_pop(X_R12 + 3);
+    x_pop(X_R12 + 2);
+    x_pop(X_R12 + 1);
+    x_pop(X_R12 + 0);
+    x_pop(X_BP);
+    x_pop(X_BX);
+    x_byte(0xc3);
+
+    blk->op[0]  = ops[0];
+    blk->op[1]  = ops[1];
+    blk->code   = (void (*)(uint32_t))code;
+    blk->fail   = false;
+
+    arm_jit_blocks++;
+    arm_jit_inlined += inlined;
+}
+
+bool arm_jit_init() {
+    arm_jit_buf = mmap(NULL, ARM_JIT_CODE_SZ,
+        PROT_READ | PROT_WRITE | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (arm_jit_buf == MAP_FAILED) {
+        arm_jit_buf = NULL;
+
+        return false;
+    }
+
+    arm_jit_flush();
+
+    arm_jit_flushes = 0;
+
+    return true;
+}
+
+void arm_jit_uninit() {
+    if (arm_jit_buf) munmap(arm_jit_buf, ARM_JIT_CODE_SZ);
+
+    arm_jit_buf = NULL;
+}
+
+bool arm_jit_run() {
+    uint32_t pc = arm_r.r[15] | ((arm_r.cpsr & ARM_T) ? 1 : 0);
+
+    arm_jit_blk_t *blk = &arm_jit_blk[(pc >> 1) & (ARM_JIT_COUNT - 1)];
+
+    if (blk->pc != pc ||
+        blk->gen[0] != arm_blk_gen[blk->page[0]] ||
+        blk->gen[1] != arm_blk_gen[blk->page[1]]) {
+        blk->pc   = pc;
+        blk->hits = 0;
+        blk->fail = false;
+        blk->code = NULL;
+
+        blk->page[0] = ARM_BLK_PAGES;
+        blk->page[1] = ARM_BLK_PAGES;
+        blk->gen[0]  = arm_blk_gen[ARM_BLK_PAGES];
+        blk->gen[1]  = arm_blk_gen[ARM_BLK_PAGES];
+    }
+
+    if (blk->code == NULL) {
+        if (blk->fail || ++blk->hits < ARM_JIT_HOT) return false;
+
+        arm_jit_compile(blk);
+
+        if (blk->code == NULL) return false;
+    }
+
+    //The pipeline may hold opcodes fetched before the memory was modified
+    if (blk->op[0] != arm_r.pipe[0] ||
+        blk->op[1] != arm_r.pipe[1])
+        return false;
+
+    arm_blk_dirty = false;
+
+    arm_flags_sync();
+
+    blk->code(arm_r.cycles_target);
+
+    return true;
+}
+
+void arm_jit_stats() {
+    printf("JIT: %u blocks, %u ops inline, %u interpreter call sites, %u flushes, %u KiB of code\n",
+        arm_jit_blocks,
+        arm_jit_inlined,
+        arm_jit_calls,
+        arm_jit_flushes,
+        (uint32_t)((jit_ptr - arm_jit_buf) >> 10));
+}
+
+#else
+
+bool arm_jit_init() {
+    return false;
+}
+
+void arm_jit_uninit() { }
+
+bool arm_jit_run() {
+    return false;
+}
+
+void arm_jit_stats() { }
+
+#endif
@@ -0,0 +1,11 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+bool arm_jit_enb;
+
+bool arm_jit_init();
+void arm_jit_uninit();
+
+bool arm_jit_run();
+
+void arm_jit_stats();
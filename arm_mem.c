@@ -1,7 +1,11 @@
+#include <stdlib.h>
+#include <string.h>
+
 #include "arm.h"
 #include "arm_mem.h"
 
 #include "io.h"
+#include "save.h"
 
 #define EEPROM_WRITE  2
 #define EEPROM_READ   3
@@ -29,33 +33,111 @@ uint32_t eeprom_addr_read = 0;
 
 uint8_t eeprom_buff[0x100];
 
-static const uint8_t bus_size_lut[16]  = { 4, 4, 2, 4, 4, 2, 2, 4, 2, 2, 2, 2, 2, 2, 1, 1 };
+/*
+ * Page tables
+ *
+ * The first 256MB of the address space is split into 32KB pages, each one
+ * with the host memory behind it and the mask applied to the address to
+ * find the byte, which takes care of the mirrors. Pages without host memory
+ * (BIOS, I/O, EEPROM, save memory, open bus and palette writes) go through
+ * the byte handlers below.
+ */
+
+#define ARM_MAP_SHIFT  15
+#define ARM_MAP_PAGES  (0x10000000 >> ARM_MAP_SHIFT)
+
+typedef struct {
+    uint8_t *ptr;
+    uint32_t mask;
+    uint32_t blk; //First code cache page, ARM_BLK_PAGES when there's none
+} arm_page_t;
+
+static arm_page_t arm_read_map[ARM_MAP_PAGES];
+static arm_page_t arm_write_map[ARM_MAP_PAGES];
+
+static void arm_map_region(
+    arm_page_t *map,
+    uint8_t region,
+    uint8_t *mem,
+    uint32_t mask,
+    uint32_t blk) {
+    uint32_t page = region << (24 - ARM_MAP_SHIFT);
+    uint32_t last = page + (1 << (24 - ARM_MAP_SHIFT));
+
+    for (; page < last; page++) {
+        map[page].ptr  = mem;
+        map[page].mask = mask;
+        map[page].blk  = blk;
+    }
+}
+
+static void arm_map_vram(arm_page_t *map) {
+    uint32_t page = 0x06000000 >> ARM_MAP_SHIFT;
+    uint32_t last = 0x07000000 >> ARM_MAP_SHIFT;
+
+    for (; page < last; page++) {
+        //128KB mirrors, with the last 32KB mirroring the 32KB before it
+        uint32_t offs = (page << ARM_MAP_SHIFT) & 0x1ffff;
 
-static void arm_access(uint32_t address, access_type_e at) {
-    uint8_t cycles = 1;
+        if (offs == 0x18000) offs = 0x10000;
 
-    if (address & 0x08000000) {
-        if (at == NON_SEQ)
-            cycles += ws_n[(address >> 25) & 3];
-        else
-            cycles += ws_s[(address >> 25) & 3];
-    } else if ((address >> 24) == 2) {
-        cycles += 2;
+        map[page].ptr  = vram + offs;
+        map[page].mask = (1 << ARM_MAP_SHIFT) - 1;
+        map[page].blk  = ARM_BLK_PAGES;
     }
+}
+
+void arm_mem_map() {
+    uint32_t rom_mask = cart_rom_mask & 0x1ffffff;
+    uint32_t page;
+
+    memset(arm_read_map,  0, sizeof(arm_read_map));
+    memset(arm_write_map, 0, sizeof(arm_write_map));
+
+    arm_map_region(arm_read_map,  0x2, wram,  0x3ffff, 0);
+    arm_map_region(arm_read_map,  0x3, iwram, 0x7fff,  ARM_BLK_WRAM_PAGES);
+    arm_map_region(arm_read_map,  0x5, pram,  0x3ff,   ARM_BLK_PAGES);
+    arm_map_region(arm_read_map,  0x7, oam,   0x3ff,   ARM_BLK_PAGES);
 
-    arm_cycles += cycles;
+    arm_map_region(arm_write_map, 0x2, wram,  0x3ffff, 0);
+    arm_map_region(arm_write_map, 0x3, iwram, 0x7fff,  ARM_BLK_WRAM_PAGES);
+    arm_map_region(arm_write_map, 0x7, oam,   0x3ff,   ARM_BLK_PAGES);
+
+    arm_map_vram(arm_read_map);
+    arm_map_vram(arm_write_map);
+
+    for (page = 0x8; page < 0xe; page++)
+        arm_map_region(arm_read_map, page, rom, rom_mask, ARM_BLK_PAGES);
+
+    //EEPROM is on the whole 0xd region, or its last 256 bytes on big ROMs
+    if (cart_rom_size > 0x1000000)
+        arm_read_map[0x0dffff00 >> ARM_MAP_SHIFT].ptr = NULL;
+    else
+        arm_map_region(arm_read_map, 0xd, NULL, 0, ARM_BLK_PAGES);
 }
 
+static arm_page_t *arm_read_page(uint32_t address) {
+    arm_page_t *pg = &arm_read_map[(address >> ARM_MAP_SHIFT) & (ARM_MAP_PAGES - 1)];
+
+    return (address >> 28) || pg->ptr == NULL ? NULL : pg;
+}
+
+static arm_page_t *arm_write_page(uint32_t address) {
+    arm_page_t *pg = &arm_write_map[(address >> ARM_MAP_SHIFT) & (ARM_MAP_PAGES - 1)];
+
+    return (address >> 28) || pg->ptr == NULL ? NULL : pg;
+}
+
+//Fast timing keeps this path and only gets a table of 1 cycle costs, so
+//class costs come out of the accesses an opcode makes (LDR 3, STR 2, LDM
+//n+2). Compiling the lookup out made no measurable difference.
 static void arm_access_bus(uint32_t address, uint8_t size, access_type_e at) {
-    uint8_t lut_idx = (address >> 24) & 0xf;
-    uint8_t bus_sz = bus_size_lut[lut_idx];
+    uint8_t region = (address >> 24) & 0xf;
 
-    if (bus_sz < size) {
-        arm_access(address + 0, at);
-        arm_access(address + 2, SEQUENTIAL);
-    } else {
-        arm_access(address, at);
-    }
+    //Only the real work RAM region has wait states, not its open bus mirrors
+    if (region == 2 && (address >> 28)) region = WS_OPEN_BUS;
+
+    arm_r.cycles += ws_cost[size >> 1][at][region];
 }
 
 //Memory read
@@ -111,6 +193,8 @@ static uint8_t rom_eep_read(uint32_t address, uint8_t offset) {
 
                     eeprom_idx++;
 
+                    arm_idle_writes++;
+
                     return value;
                  }
              }
@@ -171,13 +255,24 @@ static uint8_t arm_read_(uint32_t address, uint8_t offset) {
 #define IS_OPEN_BUS(a)  (((a) >> 28) || ((a) >= 0x00004000 && (a) < 0x02000000))
 
 uint8_t arm_readb(uint32_t address) {
+    arm_page_t *pg = arm_read_page(address);
+
+    if (pg != NULL) {
+        if (!(address & 0x08000000)) io_open_bus = false;
+
+        return pg->ptr[address & pg->mask];
+    }
+
     uint8_t value = arm_read_(address, 0);
 
     if (!(address & 0x08000000)) {
         io_open_bus &= ((address >> 24) == 4);
 
-        if (IS_OPEN_BUS(address) || io_open_bus)
-            value = arm_pipe[1];
+        if (IS_OPEN_BUS(address) || io_open_bus) {
+            arm_pipe_sync();
+
+            value = arm_r.pipe[1];
+        }
     }
 
     return value;
@@ -187,6 +282,16 @@ uint32_t arm_readh(uint32_t address) {
     uint32_t a = address & ~1;
     uint8_t  s = address &  1;
 
+    arm_page_t *pg = arm_read_page(a);
+
+    if (pg != NULL) {
+        if (!(a & 0x08000000)) io_open_bus = false;
+
+        uint32_t value = *(uint16_t *)(pg->ptr + (a & pg->mask));
+
+        return ROR(value, s << 3);
+    }
+
     uint32_t value =
         arm_read_(a | 0, 0) << 0 |
         arm_read_(a | 1, 1) << 8;
@@ -194,10 +299,13 @@ uint32_t arm_readh(uint32_t address) {
     if (!(a & 0x08000000)) {
         io_open_bus &= ((a >> 24) == 4);
 
-        if (a < 0x4000 && arm_r.r[15] >= 0x4000)
+        if (a < 0x4000 && arm_r.r[15] >= 0x4000) {
             value = bios_op     & 0xffff;
-        else if (IS_OPEN_BUS(a) || io_open_bus)
-            value = arm_pipe[1] & 0xffff;
+        } else if (IS_OPEN_BUS(a) || io_open_bus) {
+            arm_pipe_sync();
+
+            value = arm_r.pipe[1] & 0xffff;
+        }
     }
 
     return ROR(value, s << 3);
@@ -207,6 +315,14 @@ uint32_t arm_read(uint32_t address) {
     uint32_t a = address & ~3;
     uint8_t  s = address &  3;
 
+    arm_page_t *pg = arm_read_page(a);
+
+    if (pg != NULL) {
+        if (!(a & 0x08000000)) io_open_bus = false;
+
+        return ROR(*(uint32_t *)(pg->ptr + (a & pg->mask)), s << 3);
+    }
+
     uint32_t value =
         arm_read_(a | 0, 0) <<  0 |
         arm_read_(a | 1, 1) <<  8 |
@@ -216,10 +332,13 @@ uint32_t arm_read(uint32_t address) {
     if (!(a & 0x08000000)) {
         io_open_bus &= ((a >> 24) == 4);
 
-        if (a < 0x4000 && arm_r.r[15] >= 0x4000)
+        if (a < 0x4000 && arm_r.r[15] >= 0x4000) {
             value = bios_op;
-        else if (IS_OPEN_BUS(a) || io_open_bus)
-            value = arm_pipe[1];
+        } else if (IS_OPEN_BUS(a) || io_open_bus) {
+            arm_pipe_sync();
+
+            value = arm_r.pipe[1];
+        }
     }
 
     return ROR(value, s << 3);
@@ -262,12 +381,162 @@ uint32_t arm_read_s(uint32_t address) {
 }
 
 //Memory write
+static void arm_blk_write(uint32_t page) {
+    if (arm_blk_map[page >> 5] & (1 << (page & 31)))
+        arm_blk_inval(page);
+}
+
+//Invalidates cached blocks on the pages of a range, page is the first one
+static void arm_blk_write_range(uint32_t page, uint32_t address, uint32_t size) {
+    uint32_t last = page + (((address + size - 1) >> ARM_BLK_PAGE_SHIFT) -
+                            ((address           ) >> ARM_BLK_PAGE_SHIFT));
+
+    for (; page <= last; page++) arm_blk_write(page);
+}
+
+/*
+ * Block transfers
+ *
+ * LDM/STM and PUSH/POP on work RAM, which is nearly every one of them,
+ * check the whole range once and access the host memory directly. The
+ * timing is the same as doing one sequential word access at a time.
+ */
+
+static uint32_t *arm_ram_words(uint32_t address, uint8_t count, uint32_t *page) {
+    uint32_t offs;
+
+    if (count == 0 || (address & 3)) return NULL;
+
+    switch (address >> 24) {
+        case 0x2:
+            offs = address & 0x3ffff;
+
+            if (offs + count * 4 > 0x40000) return NULL;
+
+            //16 bits bus, 2 accesses per word
+            arm_r.cycles += count * ws_cost[2][SEQUENTIAL][0x2];
+
+            *page = offs >> ARM_BLK_PAGE_SHIFT;
+
+            return (uint32_t *)(wram + offs);
+
+        case 0x3:
+            offs = address & 0x7fff;
+
+            if (offs + count * 4 > 0x8000) return NULL;
+
+            arm_r.cycles += count * ws_cost[2][SEQUENTIAL][0x3];
+
+            *page = ARM_BLK_WRAM_PAGES + (offs >> ARM_BLK_PAGE_SHIFT);
+
+            return (uint32_t *)(iwram + offs);
+    }
+
+    return NULL;
+}
+
+//Words to load, NULL when the slow path has to be used
+uint32_t *arm_read_words_s(uint32_t address, uint8_t count) {
+    uint32_t page;
+
+    uint32_t *words = arm_ram_words(address, count, &page);
+
+    if (words != NULL) io_open_bus = false;
+
+    return words;
+}
+
+//Words to store into, NULL when the slow path has to be used
+uint32_t *arm_write_words_s(uint32_t address, uint8_t count) {
+    uint32_t page;
+
+    uint32_t *words = arm_ram_words(address, count, &page);
+
+    if (words != NULL) {
+        arm_blk_write_range(page, address, count * 4);
+
+        arm_idle_writes += count * 4;
+    }
+
+    return words;
+}
+
+/*
+ * Host memory behind a range of plain memory, for the HLE BIOS. NULL when
+ * the range is empty, wraps around a mirror or touches anything with side
+ * effects on access (I/O, palette, save memory, EEPROM).
+ */
+uint8_t *arm_mem_ptr(uint32_t address, uint32_t size, bool write) {
+    uint32_t page = ARM_BLK_PAGES;
+    uint32_t offs;
+    uint8_t *mem;
+
+    if (size == 0) return NULL;
+
+    switch (address >> 24) {
+        case 0x2:
+            offs = address & 0x3ffff;
+            mem  = wram + offs;
+            page = offs >> ARM_BLK_PAGE_SHIFT;
+
+            if (offs + size > 0x40000) return NULL;
+        break;
+
+        case 0x3:
+            offs = address & 0x7fff;
+            mem  = iwram + offs;
+            page = ARM_BLK_WRAM_PAGES + (offs >> ARM_BLK_PAGE_SHIFT);
+
+            if (offs + size > 0x8000) return NULL;
+        break;
+
+        case 0x6:
+            offs = address & 0x1ffff;
+            mem  = vram + offs;
+
+            if (offs + size > 0x18000) return NULL;
+        break;
+
+        case 0x7:
+            offs = address & 0x3ff;
+            mem  = oam + offs;
+
+            if (offs + size > 0x400) return NULL;
+        break;
+
+        case 0x8:
+        case 0x9:
+        case 0xa:
+        case 0xb:
+        case 0xc:
+            offs = address & 0x1ffffff;
+            mem  = rom + offs;
+
+            if (write || offs + size > cart_rom_size) return NULL;
+        break;
+
+        default: return NULL;
+    }
+
+    if (write) {
+        if (page < ARM_BLK_PAGES) arm_blk_write_range(page, address, size);
+
+        arm_idle_writes += size;
+    }
+
+    return mem;
+}
+
 static void wram_write(uint32_t address, uint8_t value) {
     wram[address & 0x3ffff] = value;
+
+    arm_blk_write((address & 0x3ffff) >> ARM_BLK_PAGE_SHIFT);
 }
 
 static void iwram_write(uint32_t address, uint8_t value) {
     iwram[address & 0x7fff] = value;
+
+    arm_blk_write(ARM_BLK_WRAM_PAGES + ((address & 0x7fff) >> ARM_BLK_PAGE_SHIFT));
 }
 
 static void pram_write(uint32_t address, uint8_t value) {
@@ -339,6 +608,8 @@ static void eeprom_write(uint32_t address, uint8_t offset, uint8_t value) {
                     uint64_t value = *(uint64_t *)(eeprom_buff + buff_addr);
 
                     *(uint64_t *)(eeprom + eeprom_addr) = value;
+
+                    save_dirty(SAVE_EEPROM, eeprom_addr, 8);
                 } else {
                     eeprom_addr_read = eeprom_addr;
                 }
@@ -353,7 +624,14 @@ static void eeprom_write(uint32_t address, uint8_t offset, uint8_t value) {
 
 static void flash_write(uint32_t address, uint8_t value) {
     if (flash_mode == WRITE) {
-        flash[flash_bank | (address & 0xffff)] = value;
+        uint32_t offs = flash_bank | (address & 0xffff);
+
+        bool changed = flash[offs] != value;
+
+        //Marked after the store, so the save thread can't miss the new value
+        flash[offs] = value;
+
+        if (changed) save_dirty(SAVE_FLASH, offs, 1);
 
         flash_mode = IDLE;
     } else if (flash_mode == BANK_SWITCH && address == 0x0e000000) {
@@ -373,6 +651,8 @@ static void flash_write(uint32_t address, uint8_t value) {
                             flash[idx] = 0xff;
                         }
 
+                        save_dirty(SAVE_FLASH, 0, 0x20000);
+
                         flash_mode = IDLE;
                     }
                 break;
@@ -398,14 +678,38 @@ static void flash_write(uint32_t address, uint8_t value) {
                 flash[flash_bank | idx] = 0xff;
             }
 
+            save_dirty(SAVE_FLASH, flash_bank | bank_s, 0x1000);
+
             flash_mode = IDLE;
         }
     }
 
+    //Rewriting the same value doesn't need a flush
+    bool changed = sram[address & 0xffff] != value;
+
     sram[address & 0xffff] = value;
+
+    if (changed) save_dirty(SAVE_SRAM, address & 0xffff, 1);
+}
+
+//Host memory to store into, NULL when the byte handlers have to be used
+static uint8_t *arm_write_ptr(uint32_t address, uint8_t size) {
+    arm_page_t *pg = arm_write_page(address);
+
+    if (pg == NULL) return NULL;
+
+    uint32_t offs = address & pg->mask;
+
+    if (pg->blk < ARM_BLK_PAGES) arm_blk_write(pg->blk + (offs >> ARM_BLK_PAGE_SHIFT));
+
+    arm_idle_writes += size;
+
+    return pg->ptr + offs;
 }
 
 static void arm_write_(uint32_t address, uint8_t offset, uint8_t value) {
+    arm_idle_writes++;
+
     switch (address >> 24) {
         case 0x2: wram_write(address, value); break;
         case 0x3: iwram_write(address, value); break;
@@ -427,6 +731,16 @@ static void arm_write_(uint32_t address, uint8_t offset, uint8_t value) {
 void arm_writeb(uint32_t address, uint8_t value) {
     uint8_t ah = address >> 24;
 
+    if (ah < 5) {
+        uint8_t *ptr = arm_write_ptr(address, ARM_BYTE_SZ);
+
+        if (ptr != NULL) {
+            *ptr = value;
+
+            return;
+        }
+    }
+
     if (ah == 7) return; //OAM doesn't supposrt 8 bits writes
 
     if (ah > 4 && ah < 8) {
@@ -440,6 +754,14 @@ void arm_writeb(uint32_t address, uint8_t value) {
 void arm_writeh(uint32_t address, uint16_t value) {
     uint32_t a = address & ~1;
 
+    uint8_t *ptr = arm_write_ptr(a, ARM_HWORD_SZ);
+
+    if (ptr != NULL) {
+        *(uint16_t *)ptr = value;
+
+        return;
+    }
+
     arm_write_(a | 0, 0, (uint8_t)(value >> 0));
     arm_write_(a | 1, 1, (uint8_t)(value >> 8));
 }
@@ -447,6 +769,14 @@ void arm_writeh(uint32_t address, uint16_t value) {
 void arm_write(uint32_t address, uint32_t value) {
     uint32_t a = address & ~3;
 
+    uint8_t *ptr = arm_write_ptr(a, ARM_WORD_SZ);
+
+    if (ptr != NULL) {
+        *(uint32_t *)ptr = value;
+
+        return;
+    }
+
     arm_write_(a | 0, 0, (uint8_t)(value >>  0));
     arm_write_(a | 1, 1, (uint8_t)(value >>  8));
     arm_write_(a | 2, 2, (uint8_t)(value >> 16));
@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <stdbool.h>
 
 uint8_t *bios;
 uint8_t *wram;
@@ -20,6 +21,9 @@ uint32_t cart_rom_mask;
 
 uint16_t eeprom_idx;
 
+bool flash_used;
+bool eeprom_used;
+
 typedef enum {
     NON_SEQ,
     SEQUENTIAL
@@ -43,4 +47,11 @@ void arm_writeh_n(uint32_t address, uint16_t value);
 void arm_write_n(uint32_t address, uint32_t value);
 void arm_writeb_s(uint32_t address, uint8_t value);
 void arm_writeh_s(uint32_t address, uint16_t value);
-void arm_write_s(uint32_t address, uint32_t value);
\ No newline at end of file
+void arm_write_s(uint32_t address, uint32_t value);
+
+uint32_t *arm_read_words_s(uint32_t address, uint8_t count);
+uint32_t *arm_write_words_s(uint32_t address, uint8_t count);
+
+uint8_t *arm_mem_ptr(uint32_t address, uint32_t size, bool write);
+
+void arm_mem_map();
\ No newline at end of file
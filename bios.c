@@ -0,0 +1,697 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arm.h"
+#include "arm_mem.h"
+
+#include "bios.h"
+#include "io.h"
+
+/*
+ * HLE BIOS
+ *
+ * The math, copy and decompression calls run as native code. Memory is
+ * accessed through the host buffers when the whole range is plain memory,
+ * and through the bus otherwise. The cycles charged are rough estimates
+ * of what the BIOS code takes, not exact timings.
+ *
+ * The waits halt the CPU instead of spinning on the BIOS loop, so the
+ * scheduler skips straight to the next event.
+ *
+ * Without a BIOS image the other calls do nothing, each one is reported
+ * once so a game that needs them doesn't just break silently.
+ */
+
+#define SWI_REGISTER_RAM_RESET  0x01
+#define SWI_HALT                0x02
+#define SWI_STOP                0x03
+#define SWI_INTR_WAIT           0x04
+#define SWI_VBLANK_INTR_WAIT    0x05
+#define SWI_DIV                 0x06
+#define SWI_DIV_ARM             0x07
+#define SWI_SQRT                0x08
+#define SWI_ARCTAN              0x09
+#define SWI_ARCTAN2             0x0a
+#define SWI_CPU_SET             0x0b
+#define SWI_CPU_FAST_SET        0x0c
+#define SWI_BG_AFFINE_SET       0x0e
+#define SWI_OBJ_AFFINE_SET      0x0f
+#define SWI_BIT_UNPACK          0x10
+#define SWI_LZ77_UNCOMP_WRAM    0x11
+#define SWI_LZ77_UNCOMP_VRAM    0x12
+#define SWI_HUFF_UNCOMP         0x13
+#define SWI_RL_UNCOMP_WRAM      0x14
+#define SWI_RL_UNCOMP_VRAM      0x15
+
+#define BIOS_IF  0x03007ff8 //Flags the game IRQ handler sets for IntrWait
+
+#define CPU_SET_FILL  (1 << 24)
+#define CPU_SET_32    (1 << 26)
+
+#define BIT_UNPACK_ZERO  (1 << 31) //Offset is also added to zero units
+
+static bool bios_stubbed = false;
+
+static uint32_t bios_missing[8]; //Calls reported as missing, one bit each
+
+//Copies a buffer to guest memory, unit is the write size the BIOS uses
+static void bios_write_buf(uint32_t address, uint8_t *buff, uint32_t size, uint8_t unit) {
+    uint8_t *dst;
+    uint32_t i;
+
+    if (unit == 2) size &= ~1;
+
+    dst = arm_mem_ptr(address, size, true);
+
+    //VRAM and OAM ignore byte writes, the bus version handles those
+    if (dst != NULL && (unit == 2 || (address >> 24) < 0x6)) {
+        memcpy(dst, buff, size);
+
+        return;
+    }
+
+    for (i = 0; i < size; i += unit) {
+        if (unit == 2)
+            arm_writeh(address + i, buff[i] | (buff[i + 1] << 8));
+        else
+            arm_writeb(address + i, buff[i]);
+    }
+}
+
+//Waits
+static uint32_t bios_wait_pc; //R15 of the wait that halted, 0 if none
+
+static void bios_halt() {
+    arm_writeb(0x04000301, 0);
+}
+
+/*
+ * While none of the flags is set on BIOS_IF, the CPU halts and the call
+ * runs again when the IRQ handler returns to it. The old flags are only
+ * discarded on the first run.
+ */
+static void bios_intr_wait(bool discard, uint16_t flags) {
+    uint16_t bios_if = arm_readh(BIOS_IF);
+
+    bool again = arm_r.r[15] == bios_wait_pc;
+
+    bios_wait_pc = 0;
+
+    arm_r.cycles += 40;
+
+    if (discard && !again) {
+        arm_writeh(BIOS_IF, bios_if & ~flags);
+    } else if (bios_if & flags) {
+        arm_writeh(BIOS_IF, bios_if & ~flags);
+
+        return;
+    }
+
+    bios_wait_pc = arm_r.r[15];
+
+    arm_op_repeat();
+
+    //IME, a request already pending is taken right away
+    arm_writeh(0x04000208, 1);
+
+    if (!(int_enb.w & int_ack.w)) bios_halt();
+}
+
+static void bios_vblank_intr_wait() {
+    arm_r.r[0] = 1;
+    arm_r.r[1] = VBLK_FLAG;
+
+    bios_intr_wait(true, VBLK_FLAG);
+}
+
+//Math
+static void bios_div(int32_t num, int32_t den) {
+    if (den == 0) {
+        //The BIOS never returns, this at least keeps the game going
+        arm_r.r[0] = num < 0 ? -1 : 1;
+        arm_r.r[1] = num;
+        arm_r.r[3] = 1;
+    } else if (den == -1 && num == INT32_MIN) {
+        arm_r.r[0] = INT32_MIN;
+        arm_r.r[1] = 0;
+        arm_r.r[3] = INT32_MIN;
+    } else {
+        int32_t quot = num / den;
+
+        arm_r.r[0] = quot;
+        arm_r.r[1] = num % den;
+        arm_r.r[3] = quot < 0 ? -quot : quot;
+    }
+
+    arm_r.cycles += 60;
+}
+
+static void bios_sqrt() {
+    uint32_t val = arm_r.r[0];
+    uint32_t res = 0;
+    uint32_t bit = 1 << 30;
+
+    while (bit > val) bit >>= 2;
+
+    while (bit) {
+        if (val >= res + bit) {
+            val -= res + bit;
+            res  = (res >> 1) + bit;
+        } else {
+            res >>= 1;
+        }
+
+        bit >>= 2;
+    }
+
+    arm_r.r[0] = res;
+
+    arm_r.cycles += 100;
+}
+
+//Same polynomial as the BIOS, 1.14 fixed point in and out
+static int32_t bios_arctan_(int32_t x) {
+    int32_t a = -((x * x) >> 14);
+    int32_t b = ((0xa9 * a) >> 14) + 0x390;
+
+    b = ((b * a) >> 14) + 0x91c;
+    b = ((b * a) >> 14) + 0xfb6;
+    b = ((b * a) >> 14) + 0x16aa;
+    b = ((b * a) >> 14) + 0x2081;
+    b = ((b * a) >> 14) + 0x3651;
+    b = ((b * a) >> 14) + 0xa2f9;
+
+    return (x * b) >> 16;
+}
+
+static void bios_arctan() {
+    arm_r.r[0] = bios_arctan_(arm_r.r[0]);
+
+    arm_r.cycles += 40;
+}
+
+static void bios_arctan2() {
+    int32_t x = arm_r.r[0];
+    int32_t y = arm_r.r[1];
+    int32_t res;
+
+    if (y == 0) {
+        res = x >= 0 ? 0 : 0x8000;
+    } else if (x == 0) {
+        res = y >= 0 ? 0x4000 : 0xc000;
+    } else if (y >= 0) {
+        if (x >= 0 && x >= y)
+            res = bios_arctan_((y << 14) / x);
+        else if (x < 0 && -x >= y)
+            res = bios_arctan_((y << 14) / x) + 0x8000;
+        else
+            res = 0x4000 - bios_arctan_((x << 14) / y);
+    } else {
+        if (x <= 0 && -x > -y)
+            res = bios_arctan_((y << 14) / x) + 0x8000;
+        else if (x > 0 && x >= -y)
+            res = bios_arctan_((y << 14) / x) + 0x10000;
+        else
+            res = 0xc000 - bios_arctan_((x << 14) / y);
+    }
+
+    arm_r.r[0] = res & 0xffff;
+
+    arm_r.cycles += 60;
+}
+
+//Quarter of a sine wave in 256 steps per turn, 1.14 fixed point
+static const int16_t sin_lut[65] = {
+    0x0000, 0x0192, 0x0324, 0x04b5, 0x0646, 0x07d6, 0x0964, 0x0af1,
+    0x0c7c, 0x0e06, 0x0f8d, 0x1112, 0x1294, 0x1413, 0x1590, 0x1709,
+    0x187e, 0x19ef, 0x1b5d, 0x1cc6, 0x1e2b, 0x1f8c, 0x20e7, 0x223d,
+    0x238e, 0x24da, 0x2620, 0x2760, 0x289a, 0x29ce, 0x2afb, 0x2c21,
+    0x2d41, 0x2e5a, 0x2f6c, 0x3076, 0x3179, 0x3274, 0x3368, 0x3453,
+    0x3537, 0x3612, 0x36e5, 0x37b0, 0x3871, 0x392b, 0x39db, 0x3a82,
+    0x3b21, 0x3bb6, 0x3c42, 0x3cc5, 0x3d3f, 0x3daf, 0x3e15, 0x3e72,
+    0x3ec5, 0x3f0f, 0x3f4f, 0x3f85, 0x3fb1, 0x3fd4, 0x3fec, 0x3ffb,
+    0x4000
+};
+
+static int32_t bios_sin(uint8_t angle) {
+    uint8_t step = angle & 0x3f;
+
+    switch (angle >> 6) {
+        case 0:  return  sin_lut[step];
+        case 1:  return  sin_lut[64 - step];
+        case 2:  return -sin_lut[step];
+        default: return -sin_lut[64 - step];
+    }
+}
+
+//Affine matrices, the angle uses the upper 8 bits of a full turn
+static void bios_affine(uint16_t angle, int16_t sx, int16_t sy, int16_t *m) {
+    int32_t s = bios_sin(angle >> 8);
+    int32_t c = bios_sin((angle >> 8) + 64);
+
+    m[0] = ( c * sx) >> 14;
+    m[1] = (-s * sx) >> 14;
+    m[2] = ( s * sy) >> 14;
+    m[3] = ( c * sy) >> 14;
+}
+
+static void bios_bg_affine_set() {
+    uint32_t src = arm_r.r[0];
+    uint32_t dst = arm_r.r[1];
+    uint32_t cnt = arm_r.r[2];
+
+    while (cnt--) {
+        int32_t  ox    = arm_read(src +  0);
+        int32_t  oy    = arm_read(src +  4);
+        int16_t  cx    = arm_readh(src +  8);
+        int16_t  cy    = arm_readh(src + 10);
+        int16_t  sx    = arm_readh(src + 12);
+        int16_t  sy    = arm_readh(src + 14);
+        uint16_t angle = arm_readh(src + 16);
+
+        int16_t m[4];
+
+        bios_affine(angle, sx, sy, m);
+
+        arm_writeh(dst + 0, m[0]);
+        arm_writeh(dst + 2, m[1]);
+        arm_writeh(dst + 4, m[2]);
+        arm_writeh(dst + 6, m[3]);
+
+        arm_write(dst +  8, ox - (m[0] * cx + m[1] * cy));
+        arm_write(dst + 12, oy - (m[2] * cx + m[3] * cy));
+
+        src += 20;
+        dst += 16;
+
+        arm_r.cycles += 100;
+    }
+}
+
+static void bios_obj_affine_set() {
+    uint32_t src  = arm_r.r[0];
+    uint32_t dst  = arm_r.r[1];
+    uint32_t cnt  = arm_r.r[2];
+    uint32_t diff = arm_r.r[3];
+
+    while (cnt--) {
+        int16_t  sx    = arm_readh(src + 0);
+        int16_t  sy    = arm_readh(src + 2);
+        uint16_t angle = arm_readh(src + 4);
+
+        int16_t m[4];
+
+        bios_affine(angle, sx, sy, m);
+
+        arm_writeh(dst + diff * 0, m[0]);
+        arm_writeh(dst + diff * 1, m[1]);
+        arm_writeh(dst + diff * 2, m[2]);
+        arm_writeh(dst + diff * 3, m[3]);
+
+        src += 8;
+        dst += diff * 4;
+
+        arm_r.cycles += 80;
+    }
+}
+
+//Copies
+static void bios_cpu_set_(uint32_t src, uint32_t dst, uint32_t cnt, bool fill, uint8_t unit) {
+    uint32_t size = cnt * unit;
+
+    uint8_t *s = arm_mem_ptr(src, fill ? unit : size, false);
+    uint8_t *d = arm_mem_ptr(dst, size, true);
+
+    uint32_t i;
+
+    if (s != NULL && d != NULL) {
+        if (fill) {
+            for (i = 0; i < size; i += unit) memcpy(d + i, s, unit);
+        } else if (d + size <= s || s + size <= d) {
+            memcpy(d, s, size);
+        } else {
+            //Overlapping copies repeat the data like the BIOS loop does
+            for (i = 0; i < size; i++) d[i] = s[i];
+        }
+
+        return;
+    }
+
+    for (i = 0; i < cnt; i++) {
+        uint32_t s_addr = fill ? src : src + i * unit;
+
+        if (unit == 4)
+            arm_write(dst + i * 4, arm_read(s_addr));
+        else
+            arm_writeh(dst + i * 2, arm_readh(s_addr));
+    }
+}
+
+static void bios_cpu_set() {
+    uint32_t ctrl = arm_r.r[2];
+    uint32_t cnt  = ctrl & 0x1fffff;
+    uint8_t  unit = (ctrl & CPU_SET_32) ? 4 : 2;
+
+    uint32_t src = arm_r.r[0] & ~(unit - 1);
+    uint32_t dst = arm_r.r[1] & ~(unit - 1);
+
+    //The BIOS refuses to read itself
+    if ((src >> 24) == 0) return;
+
+    bios_cpu_set_(src, dst, cnt, ctrl & CPU_SET_FILL, unit);
+
+    arm_r.cycles += 40 + cnt * 8;
+}
+
+static void bios_cpu_fast_set() {
+    uint32_t ctrl = arm_r.r[2];
+    uint32_t cnt  = ((ctrl & 0x1fffff) + 7) & ~7;
+
+    uint32_t src = arm_r.r[0] & ~3;
+    uint32_t dst = arm_r.r[1] & ~3;
+
+    if ((src >> 24) == 0) return;
+
+    bios_cpu_set_(src, dst, cnt, ctrl & CPU_SET_FILL, 4);
+
+    arm_r.cycles += 40 + cnt * 2;
+}
+
+//Unpacks src_w bits wide units into dst_w bits wide ones, written as words
+static void bios_bit_unpack() {
+    uint32_t src  = arm_r.r[0];
+    uint32_t dst  = arm_r.r[1];
+    uint32_t info = arm_r.r[2];
+
+    uint16_t len   = arm_readh(info);
+    uint8_t  src_w = arm_readb(info + 2);
+    uint8_t  dst_w = arm_readb(info + 3);
+    uint32_t offs  = arm_read(info + 4);
+
+    if ((src >> 24) == 0) return;
+
+    //Only 1, 2, 4 or 8 bits sources and up to 32 bits destinations are valid
+    if (src_w == 0 || src_w > 8  || (src_w & (src_w - 1)) ||
+        dst_w == 0 || dst_w > 32 || (dst_w & (dst_w - 1)))
+        return;
+
+    uint32_t size = ((uint32_t)len * (8 / src_w) * dst_w / 8) & ~3;
+
+    if (size == 0) return;
+
+    uint8_t *buff = malloc(size);
+
+    uint32_t word = 0;
+    uint32_t out  = 0;
+    uint8_t  fill = 0;
+    uint32_t i;
+
+    for (i = 0; i < len && out < size; i++) {
+        uint8_t byte = arm_readb(src + i);
+        uint8_t bit;
+
+        for (bit = 0; bit < 8 && out < size; bit += src_w) {
+            uint32_t unit = (byte >> bit) & ((1 << src_w) - 1);
+
+            if (unit || (offs & BIT_UNPACK_ZERO)) unit += offs & ~BIT_UNPACK_ZERO;
+
+            word |= unit << fill;
+            fill += dst_w;
+
+            if (fill == 32) {
+                memcpy(buff + out, &word, 4);
+
+                out += 4;
+
+                word = 0;
+                fill = 0;
+            }
+        }
+    }
+
+    bios_write_buf(dst, buff, size, 2);
+
+    free(buff);
+
+    arm_r.cycles += 40 + len * (8 / src_w) * 12;
+}
+
+//Decompression, into a host buffer that is then written out in one go
+static uint8_t *bios_uncomp_buf(uint32_t src, uint32_t *size) {
+    if ((src >> 24) == 0) return NULL;
+
+    *size = arm_read(src) >> 8;
+
+    if (*size == 0) return NULL;
+
+    return malloc(*size);
+}
+
+static void bios_lz77_uncomp(uint8_t unit) {
+    uint32_t src = arm_r.r[0];
+    uint32_t dst = arm_r.r[1];
+    uint32_t size;
+    uint32_t out = 0;
+
+    uint8_t *buff = bios_uncomp_buf(src, &size);
+
+    if (buff == NULL) return;
+
+    src += 4;
+
+    while (out < size) {
+        uint8_t flags = arm_readb(src++);
+        uint8_t i;
+
+        for (i = 0; i < 8 && out < size; i++, flags <<= 1) {
+            if (flags & 0x80) {
+                uint8_t b0 = arm_readb(src++);
+                uint8_t b1 = arm_readb(src++);
+
+                uint32_t len  = (b0 >> 4) + 3;
+                uint32_t disp = (((b0 & 0xf) << 8) | b1) + 1;
+
+                //Corrupt data pointing before the start, the BIOS reads garbage
+                if (disp > out) disp = out ? out : 1;
+
+                while (len-- && out < size) {
+                    buff[out] = out >= disp ? buff[out - disp] : 0;
+
+                    out++;
+                }
+            } else {
+                buff[out++] = arm_readb(src++);
+            }
+        }
+    }
+
+    bios_write_buf(dst, buff, size, unit);
+
+    free(buff);
+
+    arm_r.cycles += 40 + size * (unit == 2 ? 19 : 14);
+}
+
+static void bios_rl_uncomp(uint8_t unit) {
+    uint32_t src = arm_r.r[0];
+    uint32_t dst = arm_r.r[1];
+    uint32_t size;
+    uint32_t out = 0;
+
+    uint8_t *buff = bios_uncomp_buf(src, &size);
+
+    if (buff == NULL) return;
+
+    src += 4;
+
+    while (out < size) {
+        uint8_t  flag = arm_readb(src++);
+        uint32_t len;
+
+        if (flag & 0x80) {
+            uint8_t value = arm_readb(src++);
+
+            for (len = (flag & 0x7f) + 3; len && out < size; len--)
+                buff[out++] = value;
+        } else {
+            for (len = (flag & 0x7f) + 1; len && out < size; len--)
+                buff[out++] = arm_readb(src++);
+        }
+    }
+
+    bios_write_buf(dst, buff, size, unit);
+
+    free(buff);
+
+    arm_r.cycles += 40 + size * (unit == 2 ? 14 : 10);
+}
+
+static void bios_huff_uncomp() {
+    uint32_t src = arm_r.r[0];
+    uint32_t dst = arm_r.r[1];
+    uint32_t size;
+    uint32_t out = 0;
+
+    uint8_t *buff = bios_uncomp_buf(src, &size);
+
+    if (buff == NULL) return;
+
+    uint8_t bits = arm_readb(src) & 0xf;
+
+    if (bits != 4 && bits != 8) bits = 8;
+
+    //The tree starts with its size, the root node comes right after
+    uint32_t tree   = src + 5;
+    uint32_t stream = src + 4 + ((arm_readb(src + 4) + 1) << 1);
+
+    uint32_t node_addr = tree;
+    uint8_t  node      = arm_readb(tree);
+
+    uint32_t word = 0;
+    uint8_t  fill = 0;
+
+    size &= ~3;
+
+    while (out < size) {
+        uint32_t bitstream = arm_read(stream);
+        uint8_t  i;
+
+        stream += 4;
+
+        for (i = 0; i < 32 && out < size; i++, bitstream <<= 1) {
+            uint32_t next = (node_addr & ~1) + (node & 0x3f) * 2 + 2;
+            bool     right = bitstream >> 31;
+            bool     leaf  = node & (right ? 0x40 : 0x80);
+
+            node_addr = next + right;
+            node      = arm_readb(node_addr);
+
+            if (!leaf) continue;
+
+            word |= (uint32_t)(node & ((1 << bits) - 1)) << fill;
+            fill += bits;
+
+            node_addr = tree;
+            node      = arm_readb(tree);
+
+            if (fill == 32) {
+                memcpy(buff + out, &word, 4);
+
+                out += 4;
+
+                word = 0;
+                fill = 0;
+            }
+        }
+    }
+
+    bios_write_buf(dst, buff, size, 2);
+
+    free(buff);
+
+    arm_r.cycles += 40 + size * 30;
+}
+
+//Only the memory parts, the register resets are left to the game
+static void bios_register_ram_reset() {
+    uint8_t  flags = arm_r.r[0];
+    uint32_t i;
+
+    if (flags & 0x01) memset(arm_mem_ptr(0x02000000, 0x40000, true), 0, 0x40000);
+    if (flags & 0x02) memset(arm_mem_ptr(0x03000000, 0x7e00,  true), 0, 0x7e00);
+    if (flags & 0x08) memset(arm_mem_ptr(0x06000000, 0x18000, true), 0, 0x18000);
+    if (flags & 0x10) memset(arm_mem_ptr(0x07000000, 0x400,   true), 0, 0x400);
+
+    //Palette writes also update the converted colors
+    if (flags & 0x04) {
+        for (i = 0; i < 0x400; i += 2) arm_writeh(0x05000000 + i, 0);
+    }
+
+    arm_r.cycles += 1000;
+}
+
+bool bios_swi(uint8_t num) {
+    switch (num) {
+        case SWI_REGISTER_RAM_RESET: bios_register_ram_reset();              break;
+        case SWI_HALT:               bios_halt();                            break;
+        case SWI_STOP:               bios_halt();                            break;
+        case SWI_INTR_WAIT:          bios_intr_wait(arm_r.r[0], arm_r.r[1]); break;
+        case SWI_VBLANK_INTR_WAIT:   bios_vblank_intr_wait();                break;
+        case SWI_DIV:                bios_div(arm_r.r[0], arm_r.r[1]);       break;
+        case SWI_DIV_ARM:            bios_div(arm_r.r[1], arm_r.r[0]);       break;
+        case SWI_SQRT:               bios_sqrt();                            break;
+        case SWI_ARCTAN:             bios_arctan();                          break;
+        case SWI_ARCTAN2:            bios_arctan2();                         break;
+        case SWI_CPU_SET:            bios_cpu_set();                         break;
+        case SWI_CPU_FAST_SET:       bios_cpu_fast_set();                    break;
+        case SWI_BG_AFFINE_SET:      bios_bg_affine_set();                   break;
+        case SWI_OBJ_AFFINE_SET:     bios_obj_affine_set();                  break;
+        case SWI_BIT_UNPACK:         bios_bit_unpack();                      break;
+        case SWI_LZ77_UNCOMP_WRAM:   bios_lz77_uncomp(1);                    break;
+        case SWI_LZ77_UNCOMP_VRAM:   bios_lz77_uncomp(2);                    break;
+        case SWI_HUFF_UNCOMP:        bios_huff_uncomp();                     break;
+        case SWI_RL_UNCOMP_WRAM:     bios_rl_uncomp(1);                      break;
+        case SWI_RL_UNCOMP_VRAM:     bios_rl_uncomp(2);                      break;
+
+        default:
+            if (bios_stubbed && !(bios_missing[num >> 5] & (1u << (num & 31)))) {
+                bios_missing[num >> 5] |= 1u << (num & 31);
+
+                printf("Warning: BIOS call 0x%02x isn't supported without the BIOS, ignored.\n", num);
+            }
+
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Stand-in for the BIOS image when there is none. It sets up the stacks
+ * and jumps to the cartridge on reset, calls the game IRQ handler like
+ * the BIOS does, and returns right away from calls HLE doesn't cover.
+ */
+static const uint32_t bios_stub_reset[] = {
+    0xe3a000d2, //mov r0, #0xd2 (IRQ mode)
+    0xe129f000, //msr cpsr_fc, r0
+    0xe3a0d403, //mov sp, #0x03000000
+    0xe28ddc7f, //add sp, sp, #0x7f00
+    0xe28dd0a0, //add sp, sp, #0xa0
+    0xe3a000d3, //mov r0, #0xd3 (SVC mode)
+    0xe129f000, //msr cpsr_fc, r0
+    0xe3a0d403, //mov sp, #0x03000000
+    0xe28ddc7f, //add sp, sp, #0x7f00
+    0xe28dd0e0, //add sp, sp, #0xe0
+    0xe3a0001f, //mov r0, #0x1f (System mode)
+    0xe129f000, //msr cpsr_fc, r0
+    0xe3a0d403, //mov sp, #0x03000000
+    0xe28ddc7f, //add sp, sp, #0x7f00
+    0xe3a0e302, //mov lr, #0x08000000
+    0xe3a00000, //mov r0, #0
+    0xe12fff1e  //bx lr
+};
+
+static const uint32_t bios_stub_irq[] = {
+    0xe92d500f, //stmfd sp!, {r0-r3, r12, lr}
+    0xe3a00301, //mov r0, #0x04000000
+    0xe28fe000, //add lr, pc, #0
+    0xe510f004, //ldr pc, [r0, #-4]
+    0xe8bd500f, //ldmfd sp!, {r0-r3, r12, lr}
+    0xe25ef004  //subs pc, lr, #4
+};
+
+void bios_stub() {
+    uint32_t *words = (uint32_t *)bios;
+
+    memset(bios, 0, 0x4000);
+
+    bios_stubbed = true;
+
+    words[0x00 >> 2] = 0xea00007e; //b 0x200
+    words[0x08 >> 2] = 0xe1b0f00e; //movs pc, lr
+    words[0x18 >> 2] = 0xea000042; //b 0x128
+
+    memcpy(bios + 0x200, bios_stub_reset, sizeof(bios_stub_reset));
+    memcpy(bios + 0x128, bios_stub_irq,   sizeof(bios_stub_irq));
+}
@@ -0,0 +1,9 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+//BIOS calls serviced natively instead of running the BIOS code
+bool bios_hle;
+
+bool bios_swi(uint8_t num);
+
+void bios_stub();
@@ -0,0 +1,365 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS  MAP_ANON
+#endif
+#endif
+
+#include "arm_mem.h"
+#include "image.h"
+
+#define IMAGE_ROM_SZ   0x2000000
+#define IMAGE_BIOS_SZ  0x4000
+
+/*
+ * ROM and BIOS images
+ *
+ * The whole 32MB cartridge space is reserved as zero filled memory and the
+ * ROM file is mapped over its start, so pages are only read from the disk
+ * (or shared from the page cache) when the game touches them. Reads past
+ * the end of the file give zeros, and mirroring is still done by masking
+ * with cart_rom_mask. The BIOS is mapped the same way.
+ *
+ * Mappings are read only, so a stray write faults instead of silently
+ * changing the image. They are private, so a load time patch only needs
+ * to mprotect the pages it touches, and only those would stop being
+ * shared with other instances.
+ *
+ * Shared images hold the BIOS and ROM in a single file, meant to be on a
+ * tmpfs like /dev/shm. The first instance builds it, the ones after that
+ * just map it, so all of them use the same physical pages no matter where
+ * the original files live. The image is only used when the hash of the
+ * whole ROM file matches, hacks and revisions often keep the header. The
+ * hash is skipped when the ROM is the same file, with the same size and
+ * modification time, that the image was built from.
+ */
+
+#define IMAGE_MAGIC      0x33474d49 //IMG3
+#define IMAGE_BIOS_OFFS  0x4000
+#define IMAGE_ROM_OFFS   0x8000
+
+typedef struct {
+    uint32_t magic;
+    uint32_t bios_size; //0 when there was no BIOS to put in
+    uint32_t rom_size;
+    uint32_t reserved;
+    uint64_t rom_hash;
+    uint64_t rom_dev;   //ROM file the image was built from
+    uint64_t rom_ino;
+    int64_t  rom_mtime;
+} image_header_t;
+
+static int image_fd = -1;
+
+static image_header_t image_hdr;
+
+static bool bios_mapped = false;
+
+//Size of the ROM file as loaded, capped to the cartridge space
+static int64_t image_rom_size(FILE *file) {
+    fseek(file, 0, SEEK_END);
+
+    int64_t size = ftell(file);
+
+    fseek(file, 0, SEEK_SET);
+
+    return size > IMAGE_ROM_SZ ? IMAGE_ROM_SZ : size;
+}
+
+#ifndef _WIN32
+
+static bool image_rom_id(FILE *file, image_header_t *hdr) {
+    struct stat st;
+
+    if (fstat(fileno(file), &st) < 0) return false;
+
+    hdr->rom_dev   = st.st_dev;
+    hdr->rom_ino   = st.st_ino;
+    hdr->rom_mtime = st.st_mtime;
+
+    return true;
+}
+
+//FNV-1a
+static uint64_t image_hash(uint64_t hash, const uint8_t *data, int64_t size) {
+    while (size--) {
+        hash ^= *data++;
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+//Hash of the ROM as it would be loaded, 0 when it can't be read
+static uint64_t image_rom_hash(FILE *file, int64_t size) {
+    uint8_t buff[0x10000];
+
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    while (size > 0) {
+        int64_t len = size < (int64_t)sizeof(buff) ? size : (int64_t)sizeof(buff);
+
+        if (fread(buff, len, 1, file) != 1) return 0;
+
+        hash  = image_hash(hash, buff, len);
+        size -= len;
+    }
+
+    return hash;
+}
+
+static bool image_build(const char *path, const char *rom_file, const char *bios_file) {
+    FILE *in = fopen(rom_file, "rb");
+
+    if (in == NULL) return false;
+
+    int64_t size = image_rom_size(in);
+
+    uint8_t *data = calloc(IMAGE_ROM_OFFS + size, 1);
+
+    bool ok = size > 0 && fread(data + IMAGE_ROM_OFFS, size, 1, in) == 1;
+
+    image_header_t *hdr = (image_header_t *)data;
+
+    image_rom_id(in, hdr);
+
+    fclose(in);
+
+    hdr->magic    = IMAGE_MAGIC;
+    hdr->rom_size = size;
+    hdr->rom_hash = image_hash(0xcbf29ce484222325ULL, data + IMAGE_ROM_OFFS, size);
+
+    in = fopen(bios_file, "rb");
+
+    if (in != NULL) {
+        if (fread(data + IMAGE_BIOS_OFFS, IMAGE_BIOS_SZ, 1, in) == 1)
+            hdr->bios_size = IMAGE_BIOS_SZ;
+
+        fclose(in);
+    }
+
+    //Built on the side and renamed, so nobody ever maps a half written image
+    char tmp[4096];
+
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+
+    FILE *out = ok ? fopen(tmp, "wb") : NULL;
+
+    if (out != NULL) {
+        ok = fwrite(data, IMAGE_ROM_OFFS + size, 1, out) == 1;
+        ok = !fclose(out) && ok;
+        ok = ok && !rename(tmp, path);
+
+        if (!ok) remove(tmp);
+    } else {
+        ok = false;
+    }
+
+    free(data);
+
+    return ok;
+}
+
+//Tells if the image was built from the same ROM, images are never rebuilt
+static bool image_matches(int fd, const char *rom_file) {
+    struct stat st;
+
+    if (fstat(fd, &st) < 0 ||
+        pread(fd, &image_hdr, sizeof(image_hdr), 0) != sizeof(image_hdr) ||
+        image_hdr.magic != IMAGE_MAGIC ||
+        st.st_size < IMAGE_ROM_OFFS + (int64_t)image_hdr.rom_size)
+        return false;
+
+    FILE *in = fopen(rom_file, "rb");
+
+    if (in == NULL) return false;
+
+    int64_t size = image_rom_size(in);
+
+    image_header_t id = { 0 };
+
+    //Reading the whole ROM would undo the lazy paging, only hash another file
+    bool same = image_rom_id(in, &id) &&
+        size         == image_hdr.rom_size &&
+        id.rom_dev   == image_hdr.rom_dev &&
+        id.rom_ino   == image_hdr.rom_ino &&
+        id.rom_mtime == image_hdr.rom_mtime;
+
+    if (!same)
+        same = size == image_hdr.rom_size && image_rom_hash(in, size) == image_hdr.rom_hash;
+
+    fclose(in);
+
+    return same;
+}
+
+bool image_share(const char *path, const char *rom_file, const char *bios_file) {
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        if (!image_build(path, rom_file, bios_file)) return false;
+
+        fd = open(path, O_RDONLY);
+
+        if (fd < 0) return false;
+    }
+
+    if (!image_matches(fd, rom_file)) {
+        close(fd);
+
+        return false;
+    }
+
+    image_fd = fd;
+
+    return true;
+}
+
+//Maps size bytes of a file at the start of a zero filled space
+static uint8_t *image_map(int fd, off_t offs, int64_t size, int64_t space, bool populate) {
+    uint8_t *mem = mmap(NULL, space, PROT_READ,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (mem == MAP_FAILED) return NULL;
+
+    int flags = MAP_PRIVATE | MAP_FIXED;
+
+#ifdef MAP_POPULATE
+    if (populate) flags |= MAP_POPULATE;
+#endif
+
+    if (mmap(mem, size, PROT_READ, flags, fd, offs) == MAP_FAILED) {
+        munmap(mem, space);
+
+        return NULL;
+    }
+
+#ifndef MAP_POPULATE
+    if (populate) madvise(mem, size, MADV_WILLNEED);
+#endif
+
+    return mem;
+}
+
+bool image_bios_load(const char *file) {
+    if (image_fd >= 0) {
+        if (image_hdr.bios_size)
+            bios = image_map(image_fd, IMAGE_BIOS_OFFS, IMAGE_BIOS_SZ, IMAGE_BIOS_SZ, false);
+    } else {
+        int fd = open(file, O_RDONLY);
+
+        struct stat st;
+
+        if (fd >= 0) {
+            if (fstat(fd, &st) == 0 && st.st_size >= IMAGE_BIOS_SZ)
+                bios = image_map(fd, 0, IMAGE_BIOS_SZ, IMAGE_BIOS_SZ, false);
+
+            close(fd);
+        }
+    }
+
+    bios_mapped = bios != NULL;
+
+    //Left for the stub when there's no BIOS
+    if (!bios_mapped) bios = calloc(IMAGE_BIOS_SZ, 1);
+
+    return bios_mapped;
+}
+
+bool image_rom_load(const char *file, bool populate) {
+    if (image_fd >= 0) {
+        cart_rom_size = image_hdr.rom_size;
+
+        rom = image_map(image_fd, IMAGE_ROM_OFFS, cart_rom_size, IMAGE_ROM_SZ, populate);
+    } else {
+        int fd = open(file, O_RDONLY);
+
+        if (fd < 0) return false;
+
+        struct stat st;
+
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            cart_rom_size = st.st_size;
+
+            if (cart_rom_size > IMAGE_ROM_SZ) cart_rom_size = IMAGE_ROM_SZ;
+
+            rom = image_map(fd, 0, cart_rom_size, IMAGE_ROM_SZ, populate);
+        }
+
+        close(fd);
+    }
+
+    return rom != NULL;
+}
+
+void image_unload() {
+    if (bios_mapped)
+        munmap(bios, IMAGE_BIOS_SZ);
+    else
+        free(bios);
+
+    if (rom) munmap(rom, IMAGE_ROM_SZ);
+
+    if (image_fd >= 0) close(image_fd);
+
+    bios = NULL;
+    rom  = NULL;
+
+    image_fd = -1;
+}
+
+#else
+
+bool image_share(const char *path, const char *rom_file, const char *bios_file) {
+    return false;
+}
+
+bool image_bios_load(const char *file) {
+    FILE *image = fopen(file, "rb");
+
+    bios = calloc(IMAGE_BIOS_SZ, 1);
+
+    if (image == NULL) return false;
+
+    fread(bios, IMAGE_BIOS_SZ, 1, image);
+
+    fclose(image);
+
+    return true;
+}
+
+bool image_rom_load(const char *file, bool populate) {
+    FILE *image = fopen(file, "rb");
+
+    if (image == NULL) return false;
+
+    cart_rom_size = image_rom_size(image);
+
+    rom = calloc(IMAGE_ROM_SZ, 1);
+
+    fread(rom, cart_rom_size, 1, image);
+
+    fclose(image);
+
+    return true;
+}
+
+void image_unload() {
+    free(bios);
+    free(rom);
+
+    bios = NULL;
+    rom  = NULL;
+}
+
+#endif
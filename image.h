@@ -0,0 +1,8 @@
+#include <stdbool.h>
+
+bool image_share(const char *path, const char *rom_file, const char *bios_file);
+
+bool image_bios_load(const char *file);
+bool image_rom_load(const char *file, bool populate);
+
+void image_unload();
@@ -1,4 +1,5 @@
 #include "arm.h"
+#include "arm_mem.h"
 
 #include "dma.h"
 #include "io.h"
@@ -8,6 +9,13 @@
 uint8_t io_read(uint32_t address) {
     io_open_bus = false;
 
+    //Timer counters change while a loop polls them
+    if ((address & ~0xf) == 0x04000100) {
+        arm_idle_writes++;
+
+        timers_sync();
+    }
+
     switch (address) {
         case 0x04000000: return disp_cnt.b.b0        & 0xff;
         case 0x04000001: return disp_cnt.b.b1        & 0xff;
@@ -173,7 +181,7 @@ uint8_t io_read(uint32_t address) {
         case 0x0400020b: return int_enb_m.b.b3       & 0x00;
 
         case 0x04000300: return post_boot            & 0x01;
-        case 0x04000301: return int_halt             & 0x00;
+        case 0x04000301: return arm_r.int_halt       & 0x00;
     }
 
     io_open_bus = true;
@@ -205,6 +213,8 @@ static void dma_load(uint8_t ch, uint8_t value) {
 }
 
 static void tmr_load(uint8_t idx, uint8_t value) {
+    timers_sync();
+
     uint8_t old = tmr[idx].ctrl.b.b0;
 
     tmr[idx].ctrl.b.b0 = value;
@@ -219,6 +229,20 @@ static void tmr_load(uint8_t idx, uint8_t value) {
 
         tmr_icnt[idx] = 0;
     }
+
+    timers_schedule();
+}
+
+static void tmr_reload(uint8_t idx, uint8_t byte, uint8_t value) {
+    //Overflows not yet caught up on must use the old value
+    timers_sync();
+
+    if (byte)
+        tmr[idx].reload.b.b1 = value;
+    else
+        tmr[idx].reload.b.b0 = value;
+
+    timers_schedule();
 }
 
 static void snd_reset_state(uint8_t ch, bool enb) {
@@ -534,12 +558,20 @@ void io_write(uint32_t address, uint8_t value) {
             snd_pcm_vol.b.b0 = value;
         break;
         case 0x04000083:
+            //Changes which timers feed the FIFOs
+            timers_sync();
+
             snd_pcm_vol.b.b1 = value;
 
+            timers_schedule();
+
             if (value & 0x08) fifo_a_len = 0;
             if (value & 0x80) fifo_b_len = 0;
         break;
         case 0x04000084:
+            //The master enable gates the FIFOs the timers feed
+            timers_sync();
+
             snd_psg_enb.b.b0 &=          0xf;
             snd_psg_enb.b.b0 |= value & ~0xf;
 
@@ -561,6 +593,8 @@ void io_write(uint32_t address, uint8_t value) {
                 snd_psg_vol.w     = 0;
                 snd_psg_enb.w     = 0;
             }
+
+            timers_schedule();
         break;
         case 0x04000085: snd_psg_enb.b.b1     =  value; break;
         case 0x04000086: snd_psg_enb.b.b2     =  value; break;
@@ -655,23 +689,23 @@ void io_write(uint32_t address, uint8_t value) {
         case 0x040000de: dma_ch[3].ctrl.b.b0  =  value; break;
         case 0x040000df: dma_load(3, value);            break;
 
-        case 0x04000100: tmr[0].reload.b.b0   =  value; break;
-        case 0x04000101: tmr[0].reload.b.b1   =  value; break;
+        case 0x04000100: tmr_reload(0, 0, value);       break;
+        case 0x04000101: tmr_reload(0, 1, value);       break;
         case 0x04000102: tmr_load(0, value);            break;
         case 0x04000103: tmr[0].ctrl.b.b1     =  value; break;
 
-        case 0x04000104: tmr[1].reload.b.b0   =  value; break;
-        case 0x04000105: tmr[1].reload.b.b1   =  value; break;
+        case 0x04000104: tmr_reload(1, 0, value);       break;
+        case 0x04000105: tmr_reload(1, 1, value);       break;
         case 0x04000106: tmr_load(1, value);            break;
         case 0x04000107: tmr[1].ctrl.b.b1     =  value; break;
 
-        case 0x04000108: tmr[2].reload.b.b0   =  value; break;
-        case 0x04000109: tmr[2].reload.b.b1   =  value; break;
+        case 0x04000108: tmr_reload(2, 0, value);       break;
+        case 0x04000109: tmr_reload(2, 1, value);       break;
         case 0x0400010a: tmr_load(2, value);            break;
         case 0x0400010b: tmr[2].ctrl.b.b1     =  value; break;
 
-        case 0x0400010c: tmr[3].reload.b.b0   =  value; break;
-        case 0x0400010d: tmr[3].reload.b.b1   =  value; break;
+        case 0x0400010c: tmr_reload(3, 0, value);       break;
+        case 0x0400010d: tmr_reload(3, 1, value);       break;
         case 0x0400010e: tmr_load(3, value);            break;
         case 0x0400010f: tmr[3].ctrl.b.b1     =  value; break;
 
@@ -729,14 +763,14 @@ void io_write(uint32_t address, uint8_t value) {
         break;
 
         case 0x04000300: post_boot            =  value; break;
-        case 0x04000301: int_halt             =  true;  break;
+        case 0x04000301: arm_r.int_halt       =  true;  break;
     }
 }
 
 void trigger_irq(uint16_t flag) {
     int_ack.w |= flag;
 
-    int_halt = false;
+    arm_r.int_halt = false;
 
     arm_check_irq();
 }
@@ -746,6 +780,21 @@ static const uint8_t ws1_s_lut[2] = { 4, 1 };
 static const uint8_t ws2_s_lut[2] = { 8, 1 };
 static const uint8_t ws_n_lut[4]  = { 4, 3, 2, 8 };
 
+static const uint8_t bus_size_lut[WS_REGIONS] = { 4, 4, 2, 4, 4, 2, 2, 4, 2, 2, 2, 2, 2, 2, 1, 1, 2 };
+
+static uint8_t ws_access(uint8_t region, access_type_e at) {
+    uint8_t cycles = 1;
+
+    if (region & 8)
+        cycles += at == NON_SEQ ? ws_n[(region >> 1) & 3] : ws_s[(region >> 1) & 3];
+    else if (region == 2)
+        cycles += 2;
+
+    return cycles;
+}
+
+static bool ws_fast = false;
+
 void update_ws() {
     ws_n[0] = ws_n_lut[(wait_cnt.w >> 2) & 3];
     ws_n[1] = ws_n_lut[(wait_cnt.w >> 5) & 3];
@@ -763,5 +812,43 @@ void update_ws() {
 
         ws_n_arm[i] = ws_n_t16[i] + ws_s_t16[i];
         ws_s_arm[i] = ws_s_t16[i] << 1;
+
+        //Approximate timing, fetches take one cycle from anywhere
+        if (arm_fast_enb) {
+            ws_n_t16[i] = ws_s_t16[i] = 1;
+            ws_n_arm[i] = ws_s_arm[i] = 1;
+        }
+    }
+
+    //16 bits bus with 2 wait states, ARM opcodes take 2 accesses
+    ws_wram_fetch[0] = arm_fast_enb ? 1 : 3;
+    ws_wram_fetch[1] = arm_fast_enb ? 1 : 6;
+
+    uint8_t size, at, region;
+
+    for (size = 0; size < 3; size++) {
+        for (at = NON_SEQ; at <= SEQUENTIAL; at++) {
+            for (region = 0; region < WS_REGIONS; region++) {
+                uint8_t cycles = ws_access(region, at);
+
+                //Smaller buses take two accesses, the second one sequential
+                if (bus_size_lut[region] < (1 << size))
+                    cycles += ws_access(region, SEQUENTIAL);
+
+                //Approximate timing, one cycle for any access
+                if (arm_fast_enb) cycles = 1;
+
+                ws_cost[size][at][region] = cycles;
+            }
+        }
+    }
+
+    arm_fetch_inval();
+
+    //Compiled code has the costs of the mode it was built on
+    if (ws_fast != arm_fast_enb) {
+        ws_fast = arm_fast_enb;
+
+        arm_blk_flush();
     }
 }
\ No newline at end of file
@@ -177,6 +177,16 @@ uint8_t ws_s_arm[4];
 uint8_t ws_n_t16[4];
 uint8_t ws_s_t16[4];
 
+//Opcode fetch cycles from work RAM, Thumb then ARM
+uint8_t ws_wram_fetch[2];
+
+//Data access cycles by width (byte, half, word), sequential flag and region,
+//with 32 bits accesses to 16 bits buses already split. Read-only outside io.c
+#define WS_OPEN_BUS  16 //Work RAM mirrors above 0x10000000, no wait states
+#define WS_REGIONS   17
+
+uint8_t ws_cost[3][2][WS_REGIONS];
+
 uint8_t post_boot;
 
 bool io_open_bus;
@@ -1,15 +1,18 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "arm.h"
+#include "arm_jit.h"
 #include "arm_mem.h"
 
+#include "bios.h"
+#include "image.h"
 #include "io.h"
+#include "save.h"
 #include "sdl.h"
 #include "video.h"
 
-const int64_t max_rom_sz = 32 * 1024 * 1024;
-
 static uint32_t to_pow2(uint32_t val) {
     val--;
 
@@ -22,63 +25,181 @@ static uint32_t to_pow2(uint32_t val) {
     return val + 1;
 }
 
+//FNV-1a, to tell if two runs ended on the same state
+static uint64_t hash_mem(uint64_t hash, const void *data, uint32_t size) {
+    const uint8_t *bytes = data;
+
+    while (size--) {
+        hash ^= *bytes++;
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+static uint64_t hash_state() {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    arm_flags_sync();
+
+    hash = hash_mem(hash, arm_r.r,    sizeof(arm_r.r));
+    hash = hash_mem(hash, &arm_r.cpsr, sizeof(arm_r.cpsr));
+    hash = hash_mem(hash, wram,  0x40000);
+    hash = hash_mem(hash, iwram, 0x8000);
+    hash = hash_mem(hash, pram,  0x400);
+    hash = hash_mem(hash, vram,  0x18000);
+    hash = hash_mem(hash, oam,   0x400);
+
+    return hash;
+}
+
 int main(int argc, char* argv[]) {
     printf("gdkGBA - Gameboy Advance emulator made by gdkchan\n");
     printf("This is FREE software released into the PUBLIC DOMAIN\n\n");
 
     arm_init();
 
-    if (argc < 2) {
+    char *rom_file = NULL;
+    char *shared = NULL;
+
+    bool rom_decode_all = false;
+    bool rom_populate = false;
+    bool save = true;
+    bool direct_boot = false;
+    bool stats = false;
+    bool hash = false;
+
+    uint32_t frames = 0;
+
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--no-block-cache"))
+            arm_blk_enb = false;
+        else if (!strcmp(argv[i], "--no-predecode"))
+            arm_rom_enb = false;
+        else if (!strcmp(argv[i], "--no-fuse"))
+            arm_fuse_enb = false;
+        else if (!strcmp(argv[i], "--predecode-all"))
+            rom_decode_all = true;
+        else if (!strcmp(argv[i], "--rom-populate"))
+            rom_populate = true;
+        else if (!strcmp(argv[i], "--shared") && i + 1 < argc)
+            shared = argv[++i];
+        else if (!strcmp(argv[i], "--no-save"))
+            save = false;
+        else if (!strcmp(argv[i], "--save-atomic"))
+            save_atomic = true;
+        else if (!strcmp(argv[i], "--jit"))
+            arm_jit_enb = true;
+        else if (!strcmp(argv[i], "--no-idle-skip"))
+            arm_idle_enb = false;
+        else if (!strcmp(argv[i], "--no-copy-loops"))
+            arm_copy_enb = false;
+        else if (!strcmp(argv[i], "--fast-timing"))
+            arm_fast_enb = true;
+        else if (!strcmp(argv[i], "--idle-loop") && i + 1 < argc)
+            arm_idle_addr = strtoul(argv[++i], NULL, 16);
+        else if (!strcmp(argv[i], "--hle-bios"))
+            bios_hle = true;
+        else if (!strcmp(argv[i], "--direct-boot"))
+            direct_boot = true;
+        else if (!strcmp(argv[i], "--stats"))
+            stats = true;
+        else if (!strcmp(argv[i], "--hash"))
+            hash = true;
+        else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+            frames = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--profile-pairs"))
+            arm_pair_enb = true;
+        else
+            rom_file = argv[i];
+    }
+
+    //Costs depend on the timing mode
+    update_ws();
+
+    //Every opcode has to go through the interpreter to be counted
+    if (arm_pair_enb) {
+        arm_blk_enb = false;
+        arm_rom_enb = false;
+        arm_jit_enb = false;
+    }
+
+    if (rom_file == NULL) {
         printf("Error: Invalid number of arguments!\n");
         printf("Please specify a ROM file.\n");
 
         return 0;
     }
 
-    FILE *image;
-
-    image = fopen("gba_bios.bin", "rb");
-
-    if (image == NULL) {
-        printf("Error: GBA BIOS not found!\n");
-        printf("Place it on this directory with the name \"gba_bios.bin\".\n");
+    if (shared != NULL && !image_share(shared, rom_file, "gba_bios.bin")) {
+        printf("Error: Shared image couldn't be opened or holds another ROM.\n");
 
         return 0;
     }
 
-    fread(bios, 16384, 1, image);
+    if (!image_bios_load("gba_bios.bin")) {
+        printf("Warning: GBA BIOS not found, using the HLE BIOS.\n");
+        printf("For full accuracy, place it on this directory with the name \"gba_bios.bin\".\n\n");
 
-    fclose(image);
+        bios_hle = true;
 
-    image = fopen(argv[1], "rb");
+        bios_stub();
+    }
 
-    if (image == NULL) {
+    if (!image_rom_load(rom_file, rom_populate)) {
         printf("Error: ROM file couldn't be opened.\n");
         printf("Make sure that the file exists and the name is correct.\n");
 
         return 0;
     }
 
-    fseek(image, 0, SEEK_END);
-
-    cart_rom_size = ftell(image);
     cart_rom_mask = to_pow2(cart_rom_size) - 1;
 
-    if (cart_rom_size > max_rom_sz) cart_rom_size = max_rom_sz;
+    arm_mem_map();
+
+    if (save) save_init(rom_file);
 
-    fseek(image, 0, SEEK_SET);
-    fread(rom, cart_rom_size, 1, image);
+    if (arm_rom_enb && rom_decode_all) arm_rom_decode_all();
 
-    fclose(image);
+    if (arm_jit_enb && !arm_jit_init()) {
+        printf("Warning: JIT not available on this host, using the interpreter.\n");
+
+        arm_jit_enb = false;
+    }
 
     sdl_init();
-    arm_reset();
 
+    if (direct_boot)
+        arm_direct_boot();
+    else
+        arm_reset();
+
+    //Time to the first frame that ends with the game code running
+    uint32_t boot_start = SDL_GetTicks();
+    uint32_t boot_ms = 0;
+    uint32_t boot_frames = 0;
+
+    bool booted = false;
     bool run = true;
 
+    uint32_t frame = 0;
+
     while (run) {
         run_frame();
 
+        if (frames && ++frame == frames) run = false;
+
+        if (!booted) {
+            boot_frames++;
+
+            if (arm_r.r[15] >= 0x02000000) {
+                boot_ms = SDL_GetTicks() - boot_start;
+                booted  = true;
+            }
+        }
+
         SDL_Event event;
 
         while (SDL_PollEvent(&event)) {
@@ -120,8 +241,29 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    //Writes back what's left of the save, before the stats count it
+    save_uninit();
+
+    if (stats) {
+        if (booted)
+            printf("Boot: %u frames, %u ms to the first game frame\n", boot_frames, boot_ms);
+
+        arm_rom_stats();
+        arm_jit_stats();
+        arm_idle_stats();
+        arm_copy_stats();
+        save_stats();
+    }
+
+    if (arm_pair_enb) arm_pair_stats();
+
+    if (hash) printf("State hash: %016llx\n", (unsigned long long)hash_state());
+
     sdl_uninit();
     arm_uninit();
+    arm_jit_uninit();
+
+    image_unload();
 
     return 0;
 }
\ No newline at end of file
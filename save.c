@@ -0,0 +1,345 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "arm_mem.h"
+#include "save.h"
+#include "sdl.h"
+
+/*
+ * Save persistence
+ *
+ * The save is loaded from the ROM file name with a .sav extension. Writes
+ * to save memory mark 256 bytes blocks as dirty, and a thread writes them
+ * back once the game has stopped writing for a while (or after a few
+ * seconds of constant writing), so a game that keeps rewriting its save
+ * doesn't cause a flush per frame. Only dirty blocks are written, unless
+ * the save type changed or commits are atomic, then the whole save is.
+ */
+
+#define SAVE_BLK_SHIFT     8
+#define SAVE_BLKS          (0x20000 >> SAVE_BLK_SHIFT)
+#define SAVE_QUIET_MS      500
+#define SAVE_MAX_DELAY_MS  5000
+
+static const uint32_t save_size[SAVE_COUNT] = { 0x10000, 0x20000, 0x2000 };
+
+static bool save_enb = false;
+static bool save_quit;
+static bool save_pending;
+
+static char *save_path;
+
+static SDL_Thread *save_thread;
+static SDL_mutex  *save_mtx;
+static SDL_cond   *save_cond;
+
+static uint32_t save_map[SAVE_COUNT][SAVE_BLKS >> 5];
+static uint32_t save_first_ms;
+static uint32_t save_last_ms;
+
+//Only touched by the writer thread once it's running
+static save_type_e save_disk_type;
+static uint32_t    save_disk_size;
+
+static uint8_t  save_buff[0x20000];
+static uint32_t save_buff_map[SAVE_BLKS >> 5];
+
+static uint32_t save_flushes;
+static uint64_t save_bytes;
+
+static uint8_t *save_mem(save_type_e type) {
+    switch (type) {
+        case SAVE_SRAM:   return sram;
+        case SAVE_FLASH:  return flash;
+        case SAVE_EEPROM: return eeprom;
+        default:          return NULL;
+    }
+}
+
+//The type is only known once the game accesses its save memory
+static save_type_e save_type() {
+    if (eeprom_used) return SAVE_EEPROM;
+    if (flash_used)  return SAVE_FLASH;
+
+    return SAVE_SRAM;
+}
+
+static void save_sync(FILE *file) {
+    fflush(file);
+
+#ifndef _WIN32
+    fsync(fileno(file));
+#endif
+}
+
+static bool save_write_all(uint32_t size) {
+    char *path = save_path;
+    char *tmp  = NULL;
+
+    if (save_atomic) {
+        tmp = malloc(strlen(save_path) + 5);
+
+        sprintf(tmp, "%s.tmp", save_path);
+
+        path = tmp;
+    }
+
+    FILE *file = fopen(path, "wb");
+
+    bool ok = file != NULL && fwrite(save_buff, size, 1, file) == 1;
+
+    if (file != NULL) {
+        save_sync(file);
+
+        ok = !fclose(file) && ok;
+    }
+
+    if (tmp != NULL) {
+#ifdef _WIN32
+        if (ok) remove(save_path);
+#endif
+        ok = ok && !rename(tmp, save_path);
+
+        if (!ok) remove(tmp);
+
+        free(tmp);
+    }
+
+    if (ok) save_bytes += size;
+
+    return ok;
+}
+
+static bool save_write_dirty(uint32_t size) {
+    FILE *file = fopen(save_path, "r+b");
+
+    if (file == NULL) return false;
+
+    bool ok = true;
+
+    uint32_t blk = 0;
+    uint32_t last = (size + (1 << SAVE_BLK_SHIFT) - 1) >> SAVE_BLK_SHIFT;
+
+    while (blk < last) {
+        if (!(save_buff_map[blk >> 5] & (1 << (blk & 31)))) {
+            blk++;
+
+            continue;
+        }
+
+        //Consecutive dirty blocks go on a single write
+        uint32_t start = blk;
+
+        while (blk < last && (save_buff_map[blk >> 5] & (1 << (blk & 31)))) blk++;
+
+        uint32_t offs = start << SAVE_BLK_SHIFT;
+        uint32_t len  = (blk - start) << SAVE_BLK_SHIFT;
+
+        if (offs + len > size) len = size - offs;
+
+        ok = ok &&
+            !fseek(file, offs, SEEK_SET) &&
+            fwrite(save_buff + offs, len, 1, file) == 1;
+
+        if (ok) save_bytes += len;
+    }
+
+    save_sync(file);
+
+    return !fclose(file) && ok;
+}
+
+//Called and returns with save_mtx held, it's only released for the disk writes
+static void save_flush() {
+    save_type_e type = save_type();
+
+    uint32_t size = save_size[type];
+
+    //The file keeps its size, a 64KB flash save isn't grown to 128KB
+    if (save_disk_size && save_disk_size < size) size = save_disk_size;
+
+    memcpy(save_buff, save_mem(type), size);
+    memcpy(save_buff_map, save_map[type], sizeof(save_buff_map));
+    memset(save_map, 0, sizeof(save_map));
+
+    save_pending = false;
+
+    uint32_t i;
+    bool dirty = false;
+
+    for (i = 0; i < (SAVE_BLKS >> 5); i++) dirty |= save_buff_map[i] != 0;
+
+    //Writes to the memory of other save types, like flash commands
+    if (!dirty && type == save_disk_type) return;
+
+    SDL_UnlockMutex(save_mtx);
+
+    bool ok;
+
+    if (save_atomic || type != save_disk_type)
+        ok = save_write_all(size);
+    else
+        ok = save_write_dirty(size);
+
+    if (ok) {
+        save_disk_type = type;
+        save_disk_size = size;
+
+        save_flushes++;
+    } else {
+        printf("Warning: Save file \"%s\" couldn't be written.\n", save_path);
+
+        //Try the whole save again on the next flush
+        save_disk_type = SAVE_COUNT;
+    }
+
+    SDL_LockMutex(save_mtx);
+}
+
+static int save_run(void *data) {
+    SDL_LockMutex(save_mtx);
+
+    while (!save_quit) {
+        if (!save_pending) {
+            SDL_CondWait(save_cond, save_mtx);
+
+            continue;
+        }
+
+        uint32_t due = save_last_ms + SAVE_QUIET_MS;
+
+        if (due - save_first_ms > SAVE_MAX_DELAY_MS) due = save_first_ms + SAVE_MAX_DELAY_MS;
+
+        int32_t wait = (int32_t)(due - SDL_GetTicks());
+
+        if (wait > 0)
+            SDL_CondWaitTimeout(save_cond, save_mtx, wait);
+        else
+            save_flush();
+    }
+
+    //Whatever is left once the emulation stopped
+    if (save_pending) save_flush();
+
+    SDL_UnlockMutex(save_mtx);
+
+    return 0;
+}
+
+static void save_load() {
+    FILE *file = fopen(save_path, "rb");
+
+    save_disk_type = SAVE_COUNT;
+    save_disk_size = 0;
+
+    if (file == NULL) return;
+
+    fseek(file, 0, SEEK_END);
+
+    int64_t size = ftell(file);
+
+    fseek(file, 0, SEEK_SET);
+
+    //The size tells the type, 64KB may be either SRAM or a 512Kbits flash
+    if (size > 0 && size <= 0x2000) {
+        fread(eeprom, size, 1, file);
+
+        save_disk_type = SAVE_EEPROM;
+    } else if (size > 0 && size <= 0x10000) {
+        fread(sram, size, 1, file);
+
+        memcpy(flash, sram, size);
+
+        save_disk_type = SAVE_SRAM;
+    } else if (size > 0) {
+        if (size > 0x20000) size = 0x20000;
+
+        fread(flash, size, 1, file);
+
+        save_disk_type = SAVE_FLASH;
+    }
+
+    if (size > 0) save_disk_size = size;
+
+    fclose(file);
+}
+
+void save_init(const char *rom_file) {
+    const char *ext = strrchr(rom_file, '.');
+
+    size_t len = ext != NULL && strpbrk(ext, "/\\") == NULL
+        ? (size_t)(ext - rom_file)
+        : strlen(rom_file);
+
+    save_path = malloc(len + 5);
+
+    memcpy(save_path, rom_file, len);
+    strcpy(save_path + len, ".sav");
+
+    save_load();
+
+    save_mtx  = SDL_CreateMutex();
+    save_cond = SDL_CreateCond();
+
+    save_quit    = false;
+    save_pending = false;
+
+    save_thread = SDL_CreateThread(save_run, "save", NULL);
+
+    save_enb = save_thread != NULL;
+}
+
+void save_uninit() {
+    if (!save_enb) return;
+
+    SDL_LockMutex(save_mtx);
+
+    save_quit = true;
+
+    SDL_CondSignal(save_cond);
+    SDL_UnlockMutex(save_mtx);
+
+    SDL_WaitThread(save_thread, NULL);
+
+    SDL_DestroyCond(save_cond);
+    SDL_DestroyMutex(save_mtx);
+
+    free(save_path);
+
+    save_enb = false;
+}
+
+void save_dirty(save_type_e type, uint32_t address, uint32_t size) {
+    if (!save_enb) return;
+
+    uint32_t blk  = address >> SAVE_BLK_SHIFT;
+    uint32_t last = (address + size - 1) >> SAVE_BLK_SHIFT;
+
+    SDL_LockMutex(save_mtx);
+
+    for (; blk <= last; blk++) save_map[type][blk >> 5] |= 1 << (blk & 31);
+
+    save_last_ms = SDL_GetTicks();
+
+    if (!save_pending) {
+        save_pending  = true;
+        save_first_ms = save_last_ms;
+
+        SDL_CondSignal(save_cond);
+    }
+
+    SDL_UnlockMutex(save_mtx);
+}
+
+void save_stats() {
+    printf("Saves: %u flushes, %llu bytes written\n",
+        save_flushes,
+        (unsigned long long)save_bytes);
+}
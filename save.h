@@ -0,0 +1,19 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum {
+    SAVE_SRAM,
+    SAVE_FLASH,
+    SAVE_EEPROM,
+    SAVE_COUNT
+} save_type_e;
+
+//Commits write the whole save to a new file and rename it over the old one
+bool save_atomic;
+
+void save_init(const char *rom_file);
+void save_uninit();
+
+void save_dirty(save_type_e type, uint32_t address, uint32_t size);
+
+void save_stats();
@@ -0,0 +1,124 @@
+#include "arm.h"
+
+#include "sched.h"
+#include "timer.h"
+#include "video.h"
+
+/*
+ * Event scheduler
+ *
+ * Every device that needs to do something at a given time schedules an
+ * event on a 64-bits master timestamp. The CPU runs straight up to the
+ * earliest one, then all events that are due fire in timestamp order.
+ * Each event is pending at most once, and the pending ones are kept on a
+ * binary min-heap.
+ */
+
+static void (*const sched_proc[SCHED_COUNT])() = {
+    timers_event,
+    video_hblank,
+    video_line
+};
+
+static uint64_t sched_when[SCHED_COUNT];
+static uint8_t  sched_heap[SCHED_COUNT];
+static uint8_t  sched_pos[SCHED_COUNT]; //Heap index + 1, 0 when not pending
+static uint8_t  sched_len;
+
+static bool sched_before(uint8_t lhs, uint8_t rhs) {
+    if (sched_when[lhs] != sched_when[rhs])
+        return sched_when[lhs] < sched_when[rhs];
+    else
+        return lhs < rhs;
+}
+
+static void sched_swap(uint8_t i, uint8_t j) {
+    uint8_t tmp = sched_heap[i];
+
+    sched_heap[i] = sched_heap[j];
+    sched_heap[j] = tmp;
+
+    sched_pos[sched_heap[i]] = i + 1;
+    sched_pos[sched_heap[j]] = j + 1;
+}
+
+static void sched_up(uint8_t i) {
+    while (i && sched_before(sched_heap[i], sched_heap[(i - 1) >> 1])) {
+        sched_swap(i, (i - 1) >> 1);
+
+        i = (i - 1) >> 1;
+    }
+}
+
+static void sched_down(uint8_t i) {
+    while (true) {
+        uint8_t l = i * 2 + 1;
+        uint8_t r = i * 2 + 2;
+        uint8_t m = i;
+
+        if (l < sched_len && sched_before(sched_heap[l], sched_heap[m])) m = l;
+        if (r < sched_len && sched_before(sched_heap[r], sched_heap[m])) m = r;
+
+        if (m == i) break;
+
+        sched_swap(i, m);
+
+        i = m;
+    }
+}
+
+//Timestamp of the instruction boundary the CPU is at
+uint64_t sched_now() {
+    return sched_base + arm_r.cycles_step;
+}
+
+void sched_set(sched_event_e evt, uint64_t when) {
+    sched_when[evt] = when;
+
+    if (sched_pos[evt] == 0) {
+        sched_heap[sched_len] = evt;
+        sched_pos[evt] = ++sched_len;
+    }
+
+    sched_up(sched_pos[evt] - 1);
+    sched_down(sched_pos[evt] - 1);
+
+    //Scheduled while the CPU runs, make it stop in time
+    if (when < sched_base + arm_r.cycles_target)
+        arm_r.cycles_target = when > sched_base ? when - sched_base : 0;
+}
+
+void sched_clear(sched_event_e evt) {
+    if (sched_pos[evt] == 0) return;
+
+    uint8_t i = sched_pos[evt] - 1;
+
+    sched_pos[evt] = 0;
+
+    if (i != --sched_len) {
+        sched_heap[i] = sched_heap[sched_len];
+        sched_pos[sched_heap[i]] = i + 1;
+
+        sched_up(i);
+        sched_down(i);
+    }
+}
+
+void sched_run() {
+    uint64_t next = sched_when[sched_heap[0]];
+
+    arm_exec(next > sched_base ? next - sched_base : 0);
+
+    sched_base += arm_r.cycles_target;
+
+    //Timers overflowing on the last instruction go first, as if clocked by it
+    timers_sync();
+
+    while (sched_len && sched_when[sched_heap[0]] <= sched_now()) {
+        sched_event_e evt = sched_heap[0];
+
+        sched_clear(evt);
+
+        sched_proc[evt]();
+    }
+}
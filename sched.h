@@ -0,0 +1,18 @@
+#include <stdint.h>
+
+//Events, in the order they fire when due at the same time
+typedef enum {
+    SCHED_TIMER,
+    SCHED_HBLANK,
+    SCHED_LINE,
+    SCHED_COUNT
+} sched_event_e;
+
+uint64_t sched_base; //Timestamp of arm_r.cycles == 0
+
+uint64_t sched_now();
+
+void sched_set(sched_event_e evt, uint64_t when);
+void sched_clear(sched_event_e evt);
+
+void sched_run();
@@ -2,50 +2,161 @@
 
 #include "dma.h"
 #include "io.h"
+#include "sched.h"
 #include "sound.h"
 #include "timer.h"
 
+/*
+ * Timers
+ *
+ * Counters are not clocked, they are computed when looked at from the
+ * timestamp they last had a known value (tmr_start). Overflows are found
+ * in closed form, including cascades into the next timer, so an event is
+ * only scheduled for the first overflow with a visible effect (an IRQ or
+ * a FIFO load). Any other overflow is caught up on the next sync.
+ */
+
+#define TMR_NEVER  UINT64_MAX
+
 static const uint8_t pscale_shift_lut[4]  = { 0, 6, 8, 10 };
 
-void timers_clock(uint32_t cycles) {
+static uint64_t tmr_start[4]; //Timestamp the counter had its value, prescaler phase 0
+static uint64_t tmr_last;     //Timestamp the timers were last synced at
+
+static bool tmr_counting(uint8_t idx) {
+    return (tmr_enb & (1 << idx)) && !(tmr[idx].ctrl.w & TMR_CASCADE);
+}
+
+static bool tmr_cascading(uint8_t idx) {
+    return idx && (tmr_enb & (1 << idx)) && (tmr[idx].ctrl.w & TMR_CASCADE);
+}
+
+//FIFOs are only fed with the sound on and the FIFO going to a speaker
+static bool tmr_fifo_a(uint8_t idx) {
+    return (snd_psg_enb.w & PSG_ENB) &&
+           (snd_pcm_vol.w & 0x0300) &&
+           ((snd_pcm_vol.w >> 10) & 1) == idx;
+}
+
+static bool tmr_fifo_b(uint8_t idx) {
+    return (snd_psg_enb.w & PSG_ENB) &&
+           (snd_pcm_vol.w & 0x3000) &&
+           ((snd_pcm_vol.w >> 14) & 1) == idx;
+}
+
+static void tmr_overflow(uint8_t idx) {
+    if (tmr_fifo_a(idx)) {
+        //DMA Sound A FIFO
+        fifo_a_load();
+
+        if (fifo_a_len <= 0x10) dma_transfer_fifo(1);
+    }
+
+    if (tmr_fifo_b(idx)) {
+        //DMA Sound B FIFO
+        fifo_b_load();
+
+        if (fifo_b_len <= 0x10) dma_transfer_fifo(2);
+    }
+
+    if (tmr[idx].ctrl.w & TMR_IRQ) trigger_irq(TMR0_FLAG << idx);
+
+    //Count up the next timer in the chain
+    if (idx < 3 && tmr_cascading(idx + 1)) {
+        if (++tmr[idx + 1].count.w > 0xffff) {
+            tmr[idx + 1].count.w = tmr[idx + 1].reload.w;
+
+            tmr_overflow(idx + 1);
+        }
+    }
+}
+
+//Timestamp of the next overflow of a counting timer
+static uint64_t tmr_next(uint8_t idx) {
+    uint8_t shift = pscale_shift_lut[tmr[idx].ctrl.w & 3];
+
+    return tmr_start[idx] + ((uint64_t)(0x10000 - tmr[idx].count.w) << shift);
+}
+
+//Saturating multiply, overflow times past 2^62 cycles are never reached
+static uint64_t tmr_mul(uint64_t lhs, uint64_t rhs) {
+    if (lhs && rhs > (TMR_NEVER >> 2) / lhs) return TMR_NEVER;
+
+    return lhs * rhs;
+}
+
+static uint64_t tmr_add(uint64_t lhs, uint64_t rhs) {
+    return lhs > TMR_NEVER - rhs ? TMR_NEVER : lhs + rhs;
+}
+
+//Clocks the timers up to the instruction boundary the CPU is at
+void timers_sync() {
+    uint64_t now = sched_now();
     uint8_t idx;
-    bool overflow = false;
+
+    tmr_last = now;
+
+    if (!tmr_enb) return;
 
     for (idx = 0; idx < 4; idx++) {
-        if (!(tmr[idx].ctrl.w & TMR_ENB)) {
-            overflow = false;
-            continue;
-        }
+        if (!tmr_counting(idx)) continue;
 
-        if (tmr[idx].ctrl.w & TMR_CASCADE) {
-            if (overflow) tmr[idx].count.w++;
-        } else {
-            uint8_t shift = pscale_shift_lut[tmr[idx].ctrl.w & 3];
-            uint32_t inc = (tmr_icnt[idx] += cycles) >> shift;
+        uint8_t shift = pscale_shift_lut[tmr[idx].ctrl.w & 3];
+        uint64_t next;
 
-            tmr[idx].count.w += inc;
-            tmr_icnt[idx] -= inc << shift;
+        while ((next = tmr_next(idx)) <= now) {
+            tmr[idx].count.w = tmr[idx].reload.w;
+            tmr_start[idx]   = next;
+
+            tmr_overflow(idx);
         }
 
-        if ((overflow = (tmr[idx].count.w > 0xffff))) {
-            tmr[idx].count.w = tmr[idx].reload.w + (tmr[idx].count.w - 0x10000);
+        uint32_t inc = (now - tmr_start[idx]) >> shift;
 
-            if (((snd_pcm_vol.w >> 10) & 1) == idx) {
-                //DMA Sound A FIFO
-                fifo_a_load();
+        tmr[idx].count.w += inc;
+        tmr_start[idx]   += (uint64_t)inc << shift;
 
-                if (fifo_a_len <= 0x10) dma_transfer_fifo(1);
-            }
+        tmr_icnt[idx] = now - tmr_start[idx];
+    }
+}
 
-            if (((snd_pcm_vol.w >> 14) & 1) == idx) {
-                //DMA Sound B FIFO
-                fifo_b_load();
+//Schedules the next visible overflow, call with the timers in sync
+void timers_schedule() {
+    uint64_t first = TMR_NEVER;  //Next overflow of the previous timer
+    uint64_t period = TMR_NEVER; //Cycles between its overflows after that
+    uint64_t when = TMR_NEVER;
+    uint8_t idx;
+
+    for (idx = 0; idx < 4; idx++) {
+        if (tmr_counting(idx)) {
+            uint8_t shift = pscale_shift_lut[tmr[idx].ctrl.w & 3];
+
+            //Control writes may have changed the prescaler or stopped the timer
+            tmr_start[idx] = tmr_last - tmr_icnt[idx];
 
-                if (fifo_b_len <= 0x10) dma_transfer_fifo(2);
-            }
+            first  = tmr_next(idx);
+            period = (uint64_t)(0x10000 - tmr[idx].reload.w) << shift;
+        } else if (tmr_cascading(idx) && first != TMR_NEVER) {
+            uint64_t ticks = 0x10000 - tmr[idx].count.w;
+
+            first  = tmr_add(first, tmr_mul(ticks - 1, period));
+            period = tmr_mul(0x10000 - tmr[idx].reload.w, period);
+        } else {
+            first  = TMR_NEVER;
+            period = TMR_NEVER;
         }
 
-        if ((tmr[idx].ctrl.w & TMR_IRQ) && overflow)
-            trigger_irq(TMR0_FLAG << idx);
+        if (first < when && ((tmr[idx].ctrl.w & TMR_IRQ) || tmr_fifo_a(idx) || tmr_fifo_b(idx)))
+            when = first;
     }
-}
\ No newline at end of file
+
+    if (when == TMR_NEVER)
+        sched_clear(SCHED_TIMER);
+    else
+        sched_set(SCHED_TIMER, when);
+}
+
+void timers_event() {
+    timers_sync();
+    timers_schedule();
+}
@@ -2,10 +2,12 @@
 #define TMR_IRQ      (1 << 6)
 #define TMR_ENB      (1 << 7)
 
-uint32_t tmr_icnt[4];
+uint32_t tmr_icnt[4]; //Prescaler phase, kept while the timer is not counting
 
 uint8_t tmr_enb;
 uint8_t tmr_irq;
 uint8_t tmr_ie;
 
-void timers_clock(uint32_t cycles);
\ No newline at end of file
+void timers_sync();
+void timers_schedule();
+void timers_event();
@@ -3,15 +3,16 @@
 
 #include "dma.h"
 #include "io.h"
+#include "sched.h"
 #include "sdl.h"
 #include "sound.h"
+#include "video.h"
 
 #define LINES_VISIBLE  160
 #define LINES_TOTAL    228
 
 #define CYC_LINE_TOTAL  1232
 #define CYC_LINE_HBLK0  1006
-#define CYC_LINE_HBLK1  (CYC_LINE_TOTAL - CYC_LINE_HBLK0)
 
 void *screen;
 
@@ -368,42 +369,63 @@ static void vcount_match() {
     disp_stat.w |= VCNT_FLAG;
 }
 
-void run_frame() {
-    disp_stat.w &= ~VBLK_FLAG;
+static uint64_t line_time; //Timestamp of the current line start
 
-    SDL_LockTexture(texture, NULL, &screen, &tex_pitch);
+static bool frame_done;
 
-    for (v_count.w = 0; v_count.w < LINES_TOTAL; v_count.w++) {
-        disp_stat.w &= ~(HBLK_FLAG | VCNT_FLAG);
+static void line_start() {
+    disp_stat.w &= ~(HBLK_FLAG | VCNT_FLAG);
 
-        //V-Count match and V-Blank start
-        if (v_count.w == disp_stat.b.b1) vcount_match();
+    //V-Count match and V-Blank start
+    if (v_count.w == disp_stat.b.b1) vcount_match();
 
-        if (v_count.w == LINES_VISIBLE) {
-            bg_refxi[2].w = bg_refxe[2].w;
-            bg_refyi[2].w = bg_refye[2].w;
+    if (v_count.w == LINES_VISIBLE) {
+        bg_refxi[2].w = bg_refxe[2].w;
+        bg_refyi[2].w = bg_refye[2].w;
 
-            bg_refxi[3].w = bg_refxe[3].w;
-            bg_refyi[3].w = bg_refye[3].w;
+        bg_refxi[3].w = bg_refxe[3].w;
+        bg_refyi[3].w = bg_refye[3].w;
 
-            vblank_start();
-            dma_transfer(VBLANK);
-        }
+        vblank_start();
+        dma_transfer(VBLANK);
+    }
 
-        arm_exec(CYC_LINE_HBLK0);
+    sched_set(SCHED_HBLANK, line_time + CYC_LINE_HBLK0);
+    sched_set(SCHED_LINE,   line_time + CYC_LINE_TOTAL);
+}
 
-        //H-Blank start
-        if (v_count.w < LINES_VISIBLE) {
-            render_line();
-            dma_transfer(HBLANK);
-        }
+void video_hblank() {
+    //H-Blank start
+    if (v_count.w < LINES_VISIBLE) {
+        render_line();
+        dma_transfer(HBLANK);
+    }
 
-        hblank_start();
+    hblank_start();
+}
 
-        arm_exec(CYC_LINE_HBLK1);
+void video_line() {
+    sound_clock(CYC_LINE_TOTAL);
 
-        sound_clock(CYC_LINE_TOTAL);
-    }
+    line_time += CYC_LINE_TOTAL;
+
+    //The next frame starts on the next run_frame
+    if (++v_count.w < LINES_TOTAL)
+        line_start();
+    else
+        frame_done = true;
+}
+
+void run_frame() {
+    disp_stat.w &= ~VBLK_FLAG;
+
+    SDL_LockTexture(texture, NULL, &screen, &tex_pitch);
+
+    v_count.w = 0;
+
+    line_start();
+
+    for (frame_done = false; !frame_done;) sched_run();
 
     SDL_UnlockTexture(texture);
     SDL_RenderCopy(renderer, texture, NULL, NULL);
@@ -1 +1,4 @@
-void run_frame();
\ No newline at end of file
+void run_frame();
+
+void video_hblank();
+void video_line();